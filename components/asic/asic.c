@@ -1,6 +1,8 @@
 #include <string.h>
 
 #include <esp_log.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #include "bm1397.h"
 #include "bm1366.h"
@@ -8,144 +10,285 @@
 #include "bm1370.h"
 
 #include "asic.h"
-#include "device_config.h"
 #include "frequency_transition_bmXX.h"
+#include "serial.h"
+#include "device_config.h"
+#include "utils.h"
 
 static const double NONCE_SPACE = 4294967296.0; //  2^32
 
+// Dispatch the next job before the chips run out of work on the current one
+#define JOB_DISPATCH_MARGIN 0.9
+#define JOB_INTERVAL_MIN_MS 10.0
+
+#define BAUD_SWITCH_DELAY_MS 10
+#define BAUD_CALIBRATION_PROBES 32
+#define BAUD_FALLBACK_WRITES 3
+
 static const char *TAG = "asic";
 
-uint8_t ASIC_init(GlobalState * GLOBAL_STATE)
-{
-    ESP_LOGI(TAG, "Initializing %dx %s", GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.name);
+static const bm13xx_chip_t * asic_chip;
+static const bm13xx_functions_t * asic_functions;
 
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
+static const bm13xx_chip_t * get_asic_chip(Asic id)
+{
+    switch (id) {
         case BM1397:
-            return BM1397_init(GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value, GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.difficulty);
+            return &BM1397_CHIP;
         case BM1366:
-            return BM1366_init(GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value, GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.difficulty);
+            return &BM1366_CHIP;
         case BM1368:
-            return BM1368_init(GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value, GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.difficulty);
+            return &BM1368_CHIP;
         case BM1370:
-            return BM1370_init(GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value, GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.difficulty);
+            return &BM1370_CHIP;
     }
-    return ESP_OK;
+    return NULL;
+}
+
+uint8_t ASIC_init(GlobalState * GLOBAL_STATE)
+{
+    ESP_LOGI(TAG, "Initializing %dx %s", GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.name);
+
+    // Resolve the chip once, every later call goes straight through the function table
+    asic_chip = get_asic_chip(GLOBAL_STATE->DEVICE_CONFIG.family.asic.id);
+    if (asic_chip == NULL) {
+        ESP_LOGE(TAG, "Unsupported ASIC %s", GLOBAL_STATE->DEVICE_CONFIG.family.asic.name);
+        return 0;
+    }
+    asic_functions = BM13XX_bind(asic_chip);
+
+    return asic_functions->init(GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value, GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, GLOBAL_STATE->DEVICE_CONFIG.family.asic.difficulty);
 }
 
 task_result * ASIC_process_work(GlobalState * GLOBAL_STATE)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            return BM1397_process_work(GLOBAL_STATE);
-        case BM1366:
-            return BM1366_process_work(GLOBAL_STATE);
-        case BM1368:
-            return BM1368_process_work(GLOBAL_STATE);
-        case BM1370:
-            return BM1370_process_work(GLOBAL_STATE);
+    if (asic_functions == NULL) {
+        return NULL;
     }
-    return NULL;
+    return asic_functions->process_work(GLOBAL_STATE);
 }
 
 int ASIC_set_max_baud(GlobalState * GLOBAL_STATE)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            return BM1397_set_max_baud();
-        case BM1366:
-            return BM1366_set_max_baud();
-        case BM1368:
-            return BM1368_set_max_baud();
-        case BM1370:
-            return BM1370_set_max_baud();
+    if (asic_functions == NULL) {
+        return 0;
     }
-    return 0;
+    return asic_functions->set_max_baud();
 }
 
-void ASIC_send_work(GlobalState * GLOBAL_STATE, void * next_job)
+int ASIC_set_baud(GlobalState * GLOBAL_STATE, int baud)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            BM1397_send_work(GLOBAL_STATE, next_job);
-            break;
-        case BM1366:
-            BM1366_send_work(GLOBAL_STATE, next_job);
-            break;
-        case BM1368:
-            BM1368_send_work(GLOBAL_STATE, next_job);
+    if (asic_functions == NULL || asic_functions->set_baud(baud) != baud) {
+        return 0;
+    }
+    SERIAL_set_baud(baud);
+    vTaskDelay(pdMS_TO_TICKS(BAUD_SWITCH_DELAY_MS));
+    SERIAL_clear_buffer();
+    return baud;
+}
+
+bool ASIC_probe_link(GlobalState * GLOBAL_STATE, uint16_t probes, bm13xx_link_quality_t * quality)
+{
+    if (asic_functions == NULL) {
+        return false;
+    }
+    asic_functions->probe_link(GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, probes, quality);
+    return quality->errors == 0;
+}
+
+int ASIC_calibrate_baud(GlobalState * GLOBAL_STATE)
+{
+    if (asic_chip == NULL) {
+        return 0;
+    }
+
+    // Step up from the slowest rate and keep the last one every probe got through on.
+    // Going up means at most one switch is sent over a link that doesn't work.
+    int chosen = 0;
+    int failed = 0;
+    for (int i = 0; i < asic_chip->baud_count; i++) {
+        int baud = asic_chip->bauds[i].baud;
+        bm13xx_link_quality_t quality;
+
+        if (ASIC_set_baud(GLOBAL_STATE, baud) != baud) {
             break;
-        case BM1370:
-            BM1370_send_work(GLOBAL_STATE, next_job);
+        }
+        bool reliable = ASIC_probe_link(GLOBAL_STATE, BAUD_CALIBRATION_PROBES, &quality);
+        ESP_LOGI(TAG, "Baud %d: %u/%u probes failed, round trip %lu us", baud, quality.errors, quality.probes, quality.round_trip_us);
+        if (!reliable) {
+            failed = baud;
             break;
+        }
+        chosen = baud;
+    }
+
+    if (failed != 0 && chosen != 0) {
+        // Switch the chips back while the host still talks at the failed rate, which is where they
+        // listen if they heard the switch up. Only the chosen rate's own register is written: the
+        // fast UART configuration on the BM1366/BM1368/BM1370, MISC_CONTROL on the BM1397.
+        // The caller checks the link, the chips need a reset if none of these got through.
+        for (int i = 0; i < BAUD_FALLBACK_WRITES; i++) {
+            asic_functions->set_baud(chosen);
+        }
+        SERIAL_set_baud(chosen);
+        vTaskDelay(pdMS_TO_TICKS(BAUD_SWITCH_DELAY_MS));
+        SERIAL_clear_buffer();
     }
+
+    ESP_LOGI(TAG, "Calibrated UART baud: %d", chosen);
+    return chosen;
+}
+
+void ASIC_send_work(GlobalState * GLOBAL_STATE, void * next_job)
+{
+    if (asic_functions == NULL) {
+        return;
+    }
+    asic_functions->send_work(GLOBAL_STATE, next_job);
 }
 
 void ASIC_set_version_mask(GlobalState * GLOBAL_STATE, uint32_t mask)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            BM1397_set_version_mask(mask);
-            break;
-        case BM1366:
-            BM1366_set_version_mask(mask);
-            break;
-        case BM1368:
-            BM1368_set_version_mask(mask);
-            break;
-        case BM1370:
-            BM1370_set_version_mask(mask);
-            break;
+    if (asic_functions == NULL) {
+        return;
     }
+    asic_functions->set_version_mask(mask);
 }
 
 bool ASIC_set_frequency(GlobalState * GLOBAL_STATE, float frequency)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            ESP_LOGE(TAG, "Frequency transition not implemented for BM1397");
-            return false;
-        case BM1366:
-            do_frequency_transition(frequency, BM1366_send_hash_frequency);
-            return true;
-        case BM1368:
-            do_frequency_transition(frequency, BM1368_send_hash_frequency);
-            return true;
-        case BM1370:
-            do_frequency_transition(frequency, BM1370_send_hash_frequency);
-            return true;
+    if (asic_functions == NULL) {
+        return false;
+    }
+    return asic_functions->set_frequency(frequency);
+}
+
+bool ASIC_set_chip_frequency(GlobalState * GLOBAL_STATE, uint8_t asic_nr, float frequency)
+{
+    if (asic_functions == NULL || asic_nr >= GLOBAL_STATE->DEVICE_CONFIG.family.asic_count) {
+        return false;
+    }
+    return asic_functions->set_chip_frequency(asic_nr, frequency);
+}
+
+// Below the requested frequency when the ramp backed off
+float ASIC_get_frequency(GlobalState * GLOBAL_STATE)
+{
+    return frequency_ramp_stats()->frequency;
+}
+
+// Upper bound on the job interval. With full version rolling a job lasts minutes,
+// this keeps new templates reaching the chips as often as before.
+static double get_asic_job_interval_max_ms(GlobalState * GLOBAL_STATE)
+{
+    if (asic_chip == NULL) {
+        return 500;
     }
-    return false;
+    return asic_chip->job_interval_max_ms / GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
 }
 
 double ASIC_get_asic_job_frequency_ms(GlobalState * GLOBAL_STATE)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            // no version-rolling so same Nonce Space is splitted between Small Cores
-            return (NONCE_SPACE / (double) (GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value * GLOBAL_STATE->DEVICE_CONFIG.family.asic.small_core_count * 1000)) / (double) GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
-        case BM1366:
-            return 2000 / GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
-        case BM1368:
-        case BM1370:
-            return 500 / GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+    double max_interval_ms = get_asic_job_interval_max_ms(GLOBAL_STATE);
+
+    // Hashes per second over the whole chain, every small core does one hash per clock
+    double hashrate = GLOBAL_STATE->POWER_MANAGEMENT_MODULE.frequency_value * 1e6
+                    * GLOBAL_STATE->DEVICE_CONFIG.family.asic.small_core_count
+                    * GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+    if (hashrate <= 0) {
+        return max_interval_ms;
+    }
+
+    // The chips split the nonce range between them and roll every version bit
+    // enabled in the mask. BM1397 has no version rolling on chip, its midstates
+    // are already covered by the small core count.
+    double versions = 1;
+    if (asic_chip != NULL && asic_chip->version_rolling) {
+        uint32_t version_mask = GLOBAL_STATE->version_mask != 0 ? GLOBAL_STATE->version_mask : STRATUM_DEFAULT_VERSION_MASK;
+        versions = (double) (1ULL << __builtin_popcount((version_mask >> 13) & 0xFFFF));
+    }
+
+    double job_duration_ms = NONCE_SPACE * versions / hashrate * 1000.0;
+    double interval_ms = job_duration_ms * JOB_DISPATCH_MARGIN;
+
+    if (interval_ms > max_interval_ms) {
+        interval_ms = max_interval_ms;
+    }
+    if (interval_ms < JOB_INTERVAL_MIN_MS) {
+        interval_ms = JOB_INTERVAL_MIN_MS;
     }
-    return 500;
+    return interval_ms;
 }
 
-void ASIC_read_registers(GlobalState * GLOBAL_STATE)
+int ASIC_get_polled_registers(GlobalState * GLOBAL_STATE, uint8_t * registers, int max)
 {
-    switch (GLOBAL_STATE->DEVICE_CONFIG.family.asic.id) {
-        case BM1397:
-            BM1397_read_registers();
-            break;
-        case BM1366:
-            BM1366_read_registers();
-            break;
-        case BM1368:
-            BM1368_read_registers();
-            break;
-        case BM1370:
-            BM1370_read_registers();
-            break;
+    if (asic_chip == NULL) {
+        return 0;
+    }
+
+    int count = 0;
+    for (int reg = 0; reg < asic_chip->register_map_size && count < max; reg++) {
+        if (asic_chip->register_map[reg] != REGISTER_INVALID) {
+            registers[count++] = reg;
+        }
+    }
+    return count;
+}
+
+register_type_t ASIC_get_register_type(GlobalState * GLOBAL_STATE, uint8_t reg)
+{
+    if (asic_chip == NULL || reg >= asic_chip->register_map_size) {
+        return REGISTER_INVALID;
+    }
+    return asic_chip->register_map[reg];
+}
+
+void ASIC_read_register(GlobalState * GLOBAL_STATE, uint8_t asic_nr, uint8_t reg)
+{
+    if (asic_functions == NULL) {
+        return;
+    }
+    asic_functions->read_register(asic_nr, reg);
+}
+
+int ASIC_get_hash_counting_candidates(GlobalState * GLOBAL_STATE, const uint32_t ** candidates)
+{
+    if (asic_chip == NULL) {
+        return 0;
+    }
+    *candidates = asic_chip->hash_counting;
+    return asic_chip->hash_counting_count;
+}
+
+bool ASIC_set_hash_counting(GlobalState * GLOBAL_STATE, uint32_t hash_counting)
+{
+    if (asic_functions == NULL) {
+        return false;
+    }
+    return asic_functions->set_hash_counting(hash_counting);
+}
+
+uint32_t ASIC_set_difficulty(GlobalState * GLOBAL_STATE, uint32_t difficulty)
+{
+    if (asic_functions == NULL) {
+        return 0;
+    }
+    return asic_functions->set_difficulty(difficulty);
+}
+
+uint32_t ASIC_get_difficulty(GlobalState * GLOBAL_STATE)
+{
+    if (asic_functions == NULL) {
+        return 0;
+    }
+    return asic_functions->get_difficulty();
+}
+
+bool ASIC_get_nonce_plan(GlobalState * GLOBAL_STATE, bm13xx_nonce_plan_t * plan)
+{
+    if (asic_functions == NULL) {
+        return false;
     }
+    asic_functions->get_nonce_plan(plan);
+    return true;
 }
@@ -0,0 +1,660 @@
+#include "bm13xx.h"
+
+#include "crc.h"
+#include "global_state.h"
+#include "serial.h"
+#include "utils.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frequency_transition_bmXX.h"
+#include "pll.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define BM_CHIP_ID 0x00
+#define PLL0_PARAMETER 0x08
+#define HASH_COUNTING_NUMBER 0x10
+#define MISC_CONTROL 0x18
+#define VERSION_ROLLING 0xA4
+
+#define PROBE_TIMEOUT_MS 50
+
+// Init frames are collected and sent in one UART write, whole frames only
+#define TX_BATCH_SIZE 256
+
+const register_type_t BM13XX_COUNTER_REGISTER_MAP[0x8D] = {
+    [0x4C] = REGISTER_ERROR_COUNT,
+    [0x88] = REGISTER_DOMAIN_0_COUNT,
+    [0x89] = REGISTER_DOMAIN_1_COUNT,
+    [0x8A] = REGISTER_DOMAIN_2_COUNT,
+    [0x8B] = REGISTER_DOMAIN_3_COUNT,
+    [0x8C] = REGISTER_TOTAL_COUNT
+};
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t nonce;                   // 2-5
+    uint8_t midstate_num;             // 6
+    uint8_t id;                       // 7
+    uint16_t version;                 // 8-9, not sent by the BM1397
+} bm13xx_asic_result_job_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t value;                   // 2-5
+    uint8_t asic_address;             // 6
+    uint8_t register_address;         // 7
+} bm13xx_asic_result_cmd_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint16_t preamble;                // 0-1
+    union {
+        bm13xx_asic_result_job_t job; // 2-9
+        bm13xx_asic_result_cmd_t cmd; // 2-7
+    };
+} bm13xx_asic_result_t;
+
+static const char * TAG = "bm13xx";
+
+static const bm13xx_chip_t * chip;
+static bm13xx_functions_t functions;
+
+static task_result result;
+
+static uint16_t chip_count;
+static uint32_t hash_counting;
+static uint32_t ticket_difficulty;
+static bool baud_switched; // a rate other than the initial one was sent since init
+static uint8_t id = 0;
+
+static uint8_t tx_batch[TX_BATCH_SIZE];
+static int tx_batch_length;
+static bool tx_batching;
+
+typedef enum
+{
+    INIT_PHASE_WRITES,
+    INIT_PHASE_ENUMERATE,
+    INIT_PHASE_ADDRESSES,
+    INIT_PHASE_CHIP_INIT,
+    INIT_PHASE_FREQUENCY,
+    INIT_PHASE_DELAYS,
+    INIT_PHASE_COUNT,
+} init_phase_t;
+
+static const char * INIT_PHASE_NAMES[INIT_PHASE_COUNT] = {"writes", "enumerate", "addresses", "chip init", "frequency", "delays"};
+
+static void tx_flush(void)
+{
+    if (tx_batch_length > 0 && SERIAL_send(tx_batch, tx_batch_length, BM13XX_SERIALTX_DEBUG) == 0) {
+        ESP_LOGE(TAG, "Failed to send data to %s", chip->name);
+    }
+    tx_batch_length = 0;
+}
+
+// Anything that waits for the chips or for time to pass flushes first
+static void tx_batch_begin(void)
+{
+    tx_batch_length = 0;
+    tx_batching = true;
+}
+
+static void tx_batch_end(void)
+{
+    tx_flush();
+    tx_batching = false;
+}
+
+void BM13XX_send(uint8_t header, const uint8_t * data, uint8_t data_len, bool debug)
+{
+    packet_type_t packet_type = (header & TYPE_JOB) ? JOB_PACKET : CMD_PACKET;
+    const uint8_t total_length = (packet_type == JOB_PACKET) ? (data_len + 6) : (data_len + 5);
+
+    uint8_t buf[total_length];
+
+    // add the preamble
+    buf[0] = 0x55;
+    buf[1] = 0xAA;
+
+    // add the header field
+    buf[2] = header;
+
+    // add the length field
+    buf[3] = (packet_type == JOB_PACKET) ? (data_len + 4) : (data_len + 3);
+
+    // add the data
+    memcpy(buf + 4, data, data_len);
+
+    // add the correct crc type
+    if (packet_type == JOB_PACKET) {
+        uint16_t crc16_total = crc16_false(buf + 2, data_len + 2);
+        buf[4 + data_len] = (crc16_total >> 8) & 0xFF;
+        buf[5 + data_len] = crc16_total & 0xFF;
+    } else {
+        buf[4 + data_len] = crc5(buf + 2, data_len + 2);
+    }
+
+    if (tx_batching) {
+        if (tx_batch_length + total_length > TX_BATCH_SIZE) {
+            tx_flush();
+        }
+        memcpy(tx_batch + tx_batch_length, buf, total_length);
+        tx_batch_length += total_length;
+        return;
+    }
+
+    // send serial data
+    if (SERIAL_send(buf, total_length, debug) == 0) {
+        ESP_LOGE(TAG, "Failed to send data to %s", chip->name);
+    }
+}
+
+// Ceiling of asic_nr * 256 / chip_count. A plain 256 / chip_count interval
+// leaves the top bytes without a chip when the count doesn't divide 256,
+// e.g. 252-255 on six chips, and nonces there decode to a chip that isn't there.
+uint8_t BM13XX_chip_address(uint16_t asic_nr, uint16_t chip_count)
+{
+    if (chip_count == 0) {
+        return 0;
+    }
+    return (asic_nr * 256 + chip_count - 1) / chip_count;
+}
+
+uint16_t BM13XX_chip_number(uint8_t address, uint16_t chip_count)
+{
+    return address * chip_count / 256;
+}
+
+static void _write_register(uint8_t header, uint8_t address, uint8_t reg, const uint8_t data[4])
+{
+    uint8_t cmd[6] = {address, reg, data[0], data[1], data[2], data[3]};
+    BM13XX_send(TYPE_CMD | header | CMD_WRITE, cmd, 6, BM13XX_SERIALTX_DEBUG);
+}
+
+static void _send_chain_inactive(void)
+{
+    BM13XX_send((TYPE_CMD | GROUP_ALL | CMD_INACTIVE), (uint8_t[]){0x00, 0x00}, 2, BM13XX_SERIALTX_DEBUG);
+}
+
+static void _set_chip_address(uint8_t chipAddr)
+{
+    BM13XX_send((TYPE_CMD | GROUP_SINGLE | CMD_SETADDRESS), (uint8_t[]){chipAddr, 0x00}, 2, BM13XX_SERIALTX_DEBUG);
+}
+
+static void bm13xx_set_version_mask(uint32_t version_mask)
+{
+    if (!chip->version_rolling) {
+        return;
+    }
+
+    int versions_to_roll = version_mask >> 13;
+    uint8_t version_data[4] = {0x90, 0x00, versions_to_roll >> 8, versions_to_roll & 0xFF};
+    _write_register(GROUP_ALL, 0x00, VERSION_ROLLING, version_data);
+}
+
+static float write_pll(uint8_t group, uint8_t address, float target_freq)
+{
+    uint8_t fb_divider, refdiv, postdiv1, postdiv2;
+    float new_freq;
+
+    pll_get_parameters(target_freq, chip->pll_fb_min, chip->pll_fb_max, &fb_divider, &refdiv, &postdiv1, &postdiv2, &new_freq);
+
+    uint8_t vdo_scale = (fb_divider * FREQ_MULT / refdiv >= 2400) ? 0x50 : 0x40;
+    uint8_t postdiv = (((postdiv1 - 1) & 0xf) << 4) | ((postdiv2 - 1) & 0xf);
+    uint8_t freq_data[4] = {vdo_scale, fb_divider, refdiv, postdiv};
+
+    _write_register(group, address, PLL0_PARAMETER, freq_data);
+    return new_freq;
+}
+
+static void bm13xx_send_hash_frequency(float target_freq)
+{
+    float new_freq = write_pll(GROUP_ALL, 0x00, target_freq);
+
+    ESP_LOGI(TAG, "Setting Frequency to %g MHz (%g)", target_freq, new_freq);
+}
+
+// Every chip has its own PLL, so a chip can run off the chain frequency
+static bool bm13xx_set_chip_frequency(uint8_t asic_nr, float target_freq)
+{
+    if (!chip->frequency_transition || chip->send_hash_frequency != NULL) {
+        ESP_LOGE(TAG, "Per chip frequency not implemented for %s", chip->name);
+        return false;
+    }
+
+    float new_freq = write_pll(GROUP_SINGLE, BM13XX_chip_address(asic_nr, chip_count), target_freq);
+    frequency_ramp_set_chip_frequency(asic_nr, target_freq);
+
+    ESP_LOGI(TAG, "Setting ASIC %d Frequency to %g MHz (%g)", asic_nr, target_freq, new_freq);
+    return true;
+}
+
+static void write_hash_counting(void)
+{
+    uint8_t data[4] = {hash_counting >> 24, hash_counting >> 16, hash_counting >> 8, hash_counting};
+    _write_register(GROUP_ALL, 0x00, HASH_COUNTING_NUMBER, data);
+}
+
+static void write_ticket_mask(uint32_t difficulty)
+{
+    uint8_t difficulty_mask[6];
+    get_difficulty_mask(difficulty, difficulty_mask);
+    BM13XX_send((TYPE_CMD | GROUP_ALL | CMD_WRITE), difficulty_mask, 6, BM13XX_SERIALTX_DEBUG);
+    ticket_difficulty = _largest_power_of_two(difficulty);
+}
+
+static uint32_t bm13xx_set_difficulty(uint32_t difficulty)
+{
+    write_ticket_mask(difficulty);
+
+    ESP_LOGI(TAG, "Setting ticket mask to difficulty %" PRIu32, ticket_difficulty);
+    return ticket_difficulty;
+}
+
+static uint32_t bm13xx_get_difficulty(void)
+{
+    return ticket_difficulty;
+}
+
+static bool bm13xx_set_hash_counting(uint32_t value)
+{
+    if (chip->hash_counting_count == 0) {
+        ESP_LOGE(TAG, "Hash counting number not implemented for %s", chip->name);
+        return false;
+    }
+
+    hash_counting = value != 0 ? value : chip->hash_counting[0];
+    write_hash_counting();
+
+    ESP_LOGI(TAG, "Setting hash counting number to 0x%08" PRIX32, hash_counting);
+    return true;
+}
+
+static void bm13xx_get_nonce_plan(bm13xx_nonce_plan_t * plan)
+{
+    plan->chip_count = chip_count;
+    plan->min_span = 256;
+    plan->max_span = 0;
+    plan->covered = 0;
+    plan->hash_counting = chip->hash_counting_count > 0 ? hash_counting : 0;
+
+    for (int asic_nr = 0; asic_nr < chip_count; asic_nr++) {
+        uint16_t start = BM13XX_chip_address(asic_nr, chip_count);
+        uint16_t end = asic_nr + 1 < chip_count ? BM13XX_chip_address(asic_nr + 1, chip_count) : 256;
+        uint16_t span = end - start;
+
+        if (span < plan->min_span) {
+            plan->min_span = span;
+        }
+        if (span > plan->max_span) {
+            plan->max_span = span;
+        }
+        // Bytes whose nonces decode back to this chip
+        for (uint16_t address = start; address < end; address++) {
+            plan->covered += BM13XX_chip_number(address, chip_count) == asic_nr;
+        }
+    }
+}
+
+static bool bm13xx_set_frequency(float frequency)
+{
+    if (!chip->frequency_transition) {
+        ESP_LOGE(TAG, "Frequency transition not implemented for %s", chip->name);
+        return false;
+    }
+
+    // Only called while hashing, so the counters can steer the ramp
+    do_frequency_transition(frequency, functions.send_hash_frequency, true);
+    return true;
+}
+
+// Baud formula = 25M/((denominator+1)*8)
+// The denominator is 5 bits found in the misc_control (bits 9-13)
+static int bm13xx_set_default_baud(void)
+{
+    // default divider of 26 (11010) for 115,749
+    _write_register(GROUP_ALL, 0x00, MISC_CONTROL, (uint8_t[]){0x00, 0x00, 0b01111010, 0b00110001});
+    return 115749;
+}
+
+static int bm13xx_set_baud(int baud)
+{
+    for (int i = 0; i < chip->baud_count; i++) {
+        const bm13xx_baud_t * rate = &chip->bauds[i];
+        if (rate->baud == baud) {
+            // The initial rate needs no write until another one was sent
+            if (!rate->initial || baud_switched) {
+                _write_register(GROUP_ALL, 0x00, rate->reg, rate->data);
+            }
+            baud_switched |= !rate->initial;
+            return rate->baud;
+        }
+    }
+    return 0;
+}
+
+static int bm13xx_set_max_baud(void)
+{
+    int baud = chip->bauds[chip->baud_count - 1].baud;
+    ESP_LOGI(TAG, "Setting max baud of %d", baud);
+    return bm13xx_set_baud(baud);
+}
+
+// Read the chip id of every chip, a probe fails unless all of them answer intact
+static void bm13xx_probe_link(uint16_t asic_count, uint16_t probes, bm13xx_link_quality_t * quality)
+{
+    uint8_t buffer[BM13XX_RESULT_MAX_LENGTH];
+
+    memset(quality, 0, sizeof(bm13xx_link_quality_t));
+    for (int probe = 0; probe < probes; probe++) {
+        int64_t start = esp_timer_get_time();
+        bool failed = false;
+
+        BM13XX_send((TYPE_CMD | GROUP_ALL | CMD_READ), (uint8_t[]){0x00, BM_CHIP_ID}, 2, BM13XX_SERIALTX_DEBUG);
+        for (int i = 0; i < asic_count && !failed; i++) {
+            failed = SERIAL_rx(buffer, chip->result_length, PROBE_TIMEOUT_MS) != chip->result_length
+                  || buffer[0] != 0xAA || buffer[1] != 0x55
+                  || ((buffer[2] << 8) | buffer[3]) != chip->chip_id
+                  || crc5(buffer + 2, chip->result_length - 2) != 0;
+        }
+
+        uint32_t round_trip_us = esp_timer_get_time() - start;
+        if (failed) {
+            quality->errors++;
+            // Let the rest of a broken answer arrive before the next probe
+            vTaskDelay(pdMS_TO_TICKS(PROBE_TIMEOUT_MS));
+            SERIAL_clear_buffer();
+        } else if (round_trip_us > quality->round_trip_us) {
+            quality->round_trip_us = round_trip_us;
+        }
+        quality->probes++;
+    }
+}
+
+static init_phase_t init_phase(bm13xx_init_op_t op)
+{
+    switch (op) {
+        case BM13XX_INIT_ENUMERATE:
+            return INIT_PHASE_ENUMERATE;
+        case BM13XX_INIT_CHAIN_INACTIVE:
+        case BM13XX_INIT_SET_ADDRESSES:
+            return INIT_PHASE_ADDRESSES;
+        case BM13XX_INIT_CHIP_INIT:
+            return INIT_PHASE_CHIP_INIT;
+        case BM13XX_INIT_FREQUENCY:
+            return INIT_PHASE_FREQUENCY;
+        case BM13XX_INIT_DELAY:
+            return INIT_PHASE_DELAYS;
+        default:
+            return INIT_PHASE_WRITES;
+    }
+}
+
+static void log_init_phases(const int64_t * phase_us, int64_t total_us)
+{
+    char line[160];
+    int len = 0;
+    for (int phase = 0; phase < INIT_PHASE_COUNT && len < sizeof(line); phase++) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%s %lld ms", phase > 0 ? ", " : "",
+                        INIT_PHASE_NAMES[phase], (long long) (phase_us[phase] / 1000));
+    }
+    ESP_LOGI(TAG, "Init took %lld ms: %s", (long long) (total_us / 1000), line);
+}
+
+static uint8_t bm13xx_init(float frequency, uint16_t asic_count, uint16_t difficulty)
+{
+    int chip_counter = 0;
+    int64_t phase_us[INIT_PHASE_COUNT] = {0};
+    int64_t start_us = esp_timer_get_time();
+
+    // The chips come out of reset at their power on frequency and UART rate
+    frequency_ramp_init(asic_count);
+    baud_switched = false;
+
+    // The register writes go out as few UART writes as possible
+    tx_batch_begin();
+
+    for (const bm13xx_init_step_t * step = chip->init; step->op != BM13XX_INIT_END; step++) {
+        int64_t step_start_us = esp_timer_get_time();
+
+        switch (step->op) {
+            case BM13XX_INIT_WRITE:
+                _write_register(GROUP_ALL, 0x00, step->reg, step->data);
+                break;
+            case BM13XX_INIT_WRITE_CHIP:
+                _write_register(GROUP_SINGLE, step->address, step->reg, step->data);
+                break;
+            case BM13XX_INIT_ENUMERATE:
+                BM13XX_send((TYPE_CMD | GROUP_ALL | CMD_READ), (uint8_t[]){0x00, BM_CHIP_ID}, 2, BM13XX_SERIALTX_DEBUG);
+                tx_flush();
+                chip_counter = count_asic_chips(asic_count, chip->chip_id, chip->result_length);
+                if (chip_counter == 0) {
+                    tx_batch_end();
+                    return 0;
+                }
+                break;
+            case BM13XX_INIT_CHAIN_INACTIVE:
+                _send_chain_inactive();
+                break;
+            case BM13XX_INIT_SET_ADDRESSES:
+                // split the chip address space evenly
+                chip_count = chip_counter;
+                for (int i = 0; i < chip_counter; i++) {
+                    _set_chip_address(BM13XX_chip_address(i, chip_count));
+                }
+                break;
+            case BM13XX_INIT_CHIP_INIT:
+                for (int i = 0; i < chip_counter; i++) {
+                    for (const bm13xx_init_step_t * chip_step = chip->chip_init; chip_step->op != BM13XX_INIT_END; chip_step++) {
+                        _write_register(GROUP_SINGLE, BM13XX_chip_address(i, chip_count), chip_step->reg, chip_step->data);
+                    }
+                    if (chip->chip_init_delay_ms > 0) {
+                        tx_flush();
+                        vTaskDelay(pdMS_TO_TICKS(chip->chip_init_delay_ms));
+                    }
+                }
+                break;
+            case BM13XX_INIT_VERSION_MASK:
+                functions.set_version_mask(STRATUM_DEFAULT_VERSION_MASK);
+                break;
+            case BM13XX_INIT_DIFFICULTY:
+                write_ticket_mask(difficulty);
+                break;
+            case BM13XX_INIT_DEFAULT_BAUD:
+                functions.set_default_baud();
+                break;
+            case BM13XX_INIT_FREQUENCY:
+                // Every ramp step has to reach the chips before the next one
+                tx_batch_end();
+                // No work is loaded yet, without hashing there's no counter feedback
+                if (chip->frequency_transition) {
+                    do_frequency_transition(frequency, functions.send_hash_frequency, false);
+                } else {
+                    frequency_ramp_set_frequency(frequency, functions.send_hash_frequency);
+                }
+                tx_batch_begin();
+                break;
+            case BM13XX_INIT_DELAY:
+                tx_flush();
+                vTaskDelay(pdMS_TO_TICKS(step->delay_ms));
+                break;
+            case BM13XX_INIT_HASH_COUNTING:
+                write_hash_counting();
+                break;
+            default:
+                break;
+        }
+
+        phase_us[init_phase(step->op)] += esp_timer_get_time() - step_start_us;
+    }
+
+    tx_batch_end();
+    log_init_phases(phase_us, esp_timer_get_time() - start_us);
+
+    return chip_counter;
+}
+
+static void bm13xx_send_work(void * pvParameters, bm_job * next_bm_job)
+{
+    GlobalState * GLOBAL_STATE = (GlobalState *) pvParameters;
+
+    union {
+        bm13xx_job_t header;
+        job_packet midstate;
+    } job;
+    uint8_t job_length;
+
+    id = (id + chip->job_id_stride) % 128;
+
+    if (chip->job_format == BM13XX_JOB_MIDSTATE) {
+        job.midstate.job_id = id;
+        job.midstate.num_midstates = next_bm_job->num_midstates;
+        memcpy(&job.midstate.starting_nonce, &next_bm_job->starting_nonce, 4);
+        memcpy(&job.midstate.nbits, &next_bm_job->target, 4);
+        memcpy(&job.midstate.ntime, &next_bm_job->ntime, 4);
+        memcpy(&job.midstate.merkle4, next_bm_job->merkle_root + 28, 4);
+        memcpy(job.midstate.midstate, next_bm_job->midstate, 32);
+
+        if (job.midstate.num_midstates == 4) {
+            memcpy(job.midstate.midstate1, next_bm_job->midstate1, 32);
+            memcpy(job.midstate.midstate2, next_bm_job->midstate2, 32);
+            memcpy(job.midstate.midstate3, next_bm_job->midstate3, 32);
+        }
+        job_length = sizeof(job_packet);
+    } else {
+        job.header.job_id = id;
+        job.header.num_midstates = 0x01;
+        memcpy(&job.header.starting_nonce, &next_bm_job->starting_nonce, 4);
+        memcpy(&job.header.nbits, &next_bm_job->target, 4);
+        memcpy(&job.header.ntime, &next_bm_job->ntime, 4);
+        memcpy(job.header.merkle_root, next_bm_job->merkle_root_be, 32);
+        memcpy(job.header.prev_block_hash, next_bm_job->prev_block_hash_be, 32);
+        memcpy(&job.header.version, &next_bm_job->version, 4);
+        job_length = sizeof(bm13xx_job_t);
+    }
+
+    pthread_mutex_lock(&GLOBAL_STATE->jobs_lock);
+    asic_job_store(&GLOBAL_STATE->ASIC_TASK_MODULE, id, next_bm_job);
+    pthread_mutex_unlock(&GLOBAL_STATE->jobs_lock);
+
+    //debug sent jobs - this can get crazy if the interval is short
+    #if BM13XX_DEBUG_JOBS
+    ESP_LOGI(TAG, "Send Job: %02X", id);
+    #endif
+
+    BM13XX_send((TYPE_JOB | GROUP_SINGLE | CMD_WRITE), (uint8_t *)&job, job_length, BM13XX_DEBUG_WORK);
+}
+
+static task_result * bm13xx_process_work(void * pvParameters)
+{
+    union {
+        bm13xx_asic_result_t asic_result;
+        uint8_t frame[BM13XX_RESULT_MAX_LENGTH];
+    } rx = {0};
+
+    memset(&result, 0, sizeof(task_result));
+
+    if (receive_work(rx.frame, chip->result_length) == ESP_FAIL) {
+        return NULL;
+    }
+
+    // The job response flag is the top bit of the last byte, next to the crc
+    bool is_job_response = rx.frame[chip->result_length - 1] & 0x80;
+
+    if (!is_job_response) {
+        uint8_t register_address = rx.asic_result.cmd.register_address;
+        result.register_type = register_address < chip->register_map_size ? chip->register_map[register_address] : REGISTER_INVALID;
+        if (result.register_type == REGISTER_INVALID) {
+            ESP_LOGW(TAG, "Unknown register read: %02x", register_address);
+            return NULL;
+        }
+        result.asic_nr = BM13XX_chip_number(rx.asic_result.cmd.asic_address, chip_count);
+        result.value = ntohl(rx.asic_result.cmd.value);
+
+        return &result;
+    }
+
+    uint8_t job_id = (rx.asic_result.job.id & chip->result_job_id_mask) >> chip->result_job_id_shift;
+    uint8_t small_core_id = rx.asic_result.job.id & ~chip->result_job_id_mask; // small core, or midstate index on the BM1397
+    uint32_t nonce_h = ntohl(rx.asic_result.job.nonce);
+    uint8_t asic_nr = BM13XX_chip_number((nonce_h >> 17) & 0xff, chip_count); // Asic address is encoded in the next 8 bits
+    uint8_t core_id = (uint8_t)((nonce_h >> 25) & 0x7f);
+
+    GlobalState * GLOBAL_STATE = (GlobalState *) pvParameters;
+
+    uint32_t dispatch_seq;
+    bm_job * job = asic_job_lookup(&GLOBAL_STATE->ASIC_TASK_MODULE, job_id, &dispatch_seq);
+    if (job == NULL) {
+        ESP_LOGW(TAG, "Invalid job nonce found, 0x%02X", job_id);
+        return NULL;
+    }
+    uint32_t rolled_version;
+
+    if (chip->version_rolling) {
+        uint32_t version_bits = (ntohs(rx.asic_result.job.version) << 13); // shift the 16 bit value left 13
+        ESP_LOGI(TAG, "Job ID: %02X, Asic nr: %d, Core: %d/%d, Ver: %08" PRIX32, job_id, asic_nr, core_id, small_core_id, version_bits);
+        rolled_version = job->version | version_bits;
+    } else {
+        // Each midstate is the next version in the mask
+        rolled_version = job->version;
+        for (int i = 0; i < small_core_id; i++) {
+            rolled_version = increment_bitmask(rolled_version, job->version_mask);
+        }
+    }
+
+    result.job_id = job_id;
+    result.dispatch_seq = dispatch_seq;
+    result.nonce = rx.asic_result.job.nonce;
+    result.rolled_version = rolled_version;
+    result.asic_nr = asic_nr;
+    result.core_id = core_id;
+    result.small_core_id = small_core_id;
+
+    return &result;
+}
+
+static void bm13xx_read_register(uint8_t asic_nr, uint8_t reg)
+{
+    BM13XX_send((TYPE_CMD | GROUP_SINGLE | CMD_READ), (uint8_t[]){BM13XX_chip_address(asic_nr, chip_count), reg}, 2, BM13XX_SERIALTX_DEBUG);
+}
+
+const bm13xx_functions_t * BM13XX_bind(const bm13xx_chip_t * descriptor)
+{
+    chip = descriptor;
+    id = 0;
+    chip_count = 1;
+    hash_counting = chip->hash_counting_count > 0 ? chip->hash_counting[0] : 0;
+    ticket_difficulty = 0;
+
+    // Every ramp step looks up the PLL settings, build their table before the first ramp
+    pll_prepare_table(chip->pll_fb_min, chip->pll_fb_max);
+
+    functions = (bm13xx_functions_t) {
+        .init = bm13xx_init,
+        .send_work = bm13xx_send_work,
+        .process_work = bm13xx_process_work,
+        .set_version_mask = bm13xx_set_version_mask,
+        .send_hash_frequency = chip->send_hash_frequency != NULL ? chip->send_hash_frequency : bm13xx_send_hash_frequency,
+        .set_frequency = bm13xx_set_frequency,
+        .set_chip_frequency = bm13xx_set_chip_frequency,
+        .set_default_baud = bm13xx_set_default_baud,
+        .set_max_baud = bm13xx_set_max_baud,
+        .set_baud = bm13xx_set_baud,
+        .probe_link = bm13xx_probe_link,
+        .read_register = bm13xx_read_register,
+        .set_hash_counting = bm13xx_set_hash_counting,
+        .get_nonce_plan = bm13xx_get_nonce_plan,
+        .set_difficulty = bm13xx_set_difficulty,
+        .get_difficulty = bm13xx_get_difficulty,
+    };
+
+    return &functions;
+}
@@ -0,0 +1,671 @@
+#include "bm13xx_sim.h"
+
+#include "crc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PREAMBLE_TX_0 0x55
+#define PREAMBLE_TX_1 0xAA
+#define PREAMBLE_RX_0 0xAA
+#define PREAMBLE_RX_1 0x55
+
+#define TYPE_JOB 0x20
+#define GROUP_ALL 0x10
+#define CMD_MASK 0x0F
+
+#define CMD_SETADDRESS 0x00
+#define CMD_WRITE 0x01
+#define CMD_READ 0x02
+#define CMD_INACTIVE 0x03
+
+#define REG_CHIP_ID 0x00
+#define REG_HASHRATE 0x04
+#define REG_PLL0 0x08
+#define REG_HASH_COUNTING 0x10
+#define REG_TICKET_MASK 0x14
+#define REG_ERROR_COUNT 0x4C
+#define REG_DOMAIN_0_COUNT 0x88
+#define REG_TOTAL_COUNT 0x8C
+#define REG_VERSION_ROLLING 0xA4
+
+#define HASH_CNT_LSB 4294967296.0 // counters tick once per difficulty 1 (2^32 hashes)
+#define HASHRATE_UNIT 16777216.0 // BM1397 hashrate register unit (2^24 hashes)
+#define HASH_DOMAINS 4
+#define MAX_VERSION_VARIANTS 16
+
+#define IN_BUF_SIZE 256
+#define OUT_QUEUE_SIZE 256 // power of two
+#define FRAME_MAX_LENGTH 11
+
+typedef struct
+{
+    uint16_t chip_id;
+    uint8_t result_length;
+    uint16_t small_cores;
+    uint8_t small_core_bits;  // low bits of the result id byte
+    uint8_t job_id_shift;     // job id position in the result id byte
+    bool version_rolling;
+    uint8_t postdiv_offset;   // the BM1366+ program postdiv - 1
+} sim_model_t;
+
+static const sim_model_t MODELS[] = {
+    { .chip_id = 0x1366, .result_length = 11, .small_cores =  894, .small_core_bits = 3, .job_id_shift = 0, .version_rolling = true,  .postdiv_offset = 1 },
+    { .chip_id = 0x1368, .result_length = 11, .small_cores = 1276, .small_core_bits = 4, .job_id_shift = 1, .version_rolling = true,  .postdiv_offset = 1 },
+    { .chip_id = 0x1370, .result_length = 11, .small_cores = 2040, .small_core_bits = 4, .job_id_shift = 1, .version_rolling = true,  .postdiv_offset = 1 },
+    { .chip_id = 0x1397, .result_length =  9, .small_cores =  672, .small_core_bits = 2, .job_id_shift = 0, .version_rolling = false, .postdiv_offset = 0 },
+};
+
+typedef struct
+{
+    uint8_t address;
+    uint16_t span;                // address bytes searched, up to the next chip's address
+    uint32_t registers[256];
+    float frequency_mhz;
+    double hashes;
+    uint64_t updated_us;
+} sim_chip_t;
+
+typedef struct
+{
+    uint8_t data[FRAME_MAX_LENGTH];
+    uint8_t length;
+    uint8_t offset;
+    uint64_t ready_us;
+} sim_frame_t;
+
+typedef struct
+{
+    bool valid;
+    uint8_t job_id;
+    uint8_t variants;             // versions or midstates searched
+    uint32_t version_bits[MAX_VERSION_VARIANTS]; // rolled bits, reported back in the result
+    uint32_t midstates[MAX_VERSION_VARIANTS][8];
+    uint8_t tail[16];             // last 16 header bytes, the nonce is filled in per hash
+    uint64_t next;                // next search position
+} sim_job_t;
+
+static bm13xx_sim_config_t config;
+static const sim_model_t * model;
+static sim_chip_t * chips;
+static uint8_t next_address_index;
+static bool hashing;
+
+static uint8_t in_buf[IN_BUF_SIZE];
+static int in_len;
+
+static sim_frame_t out_queue[OUT_QUEUE_SIZE];
+static uint16_t out_head;
+static uint16_t out_count;
+static uint64_t last_ready_us;
+
+static sim_job_t job;
+static uint8_t header_prefix[64]; // first header block of header jobs, version filled in per variant
+static uint32_t rng_state;
+static bm13xx_sim_stats_t stats;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t read_be32(const uint8_t * p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint32_t read_le32(const uint8_t * p)
+{
+    return ((uint32_t) p[3] << 24) | ((uint32_t) p[2] << 16) | ((uint32_t) p[1] << 8) | p[0];
+}
+
+static void write_be32(uint8_t * p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void write_le32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+// SHA256 compression function, kept local so the model runs the same on host and target
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t SHA256_INIT[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(uint32_t state[8], const uint8_t block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = read_be32(block + i * 4);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+// Double SHA256 of an 80 byte header given the state after its first 64 bytes
+static void hash_header_tail(const uint32_t midstate[8], const uint8_t tail[16], uint8_t hash[32])
+{
+    uint8_t block[64] = {0};
+    uint32_t state[8];
+
+    memcpy(state, midstate, sizeof(state));
+    memcpy(block, tail, 16);
+    block[16] = 0x80;
+    block[62] = 0x02; // 640 bits
+    block[63] = 0x80;
+    sha256_transform(state, block);
+
+    memset(block, 0, sizeof(block));
+    for (int i = 0; i < 8; i++) {
+        write_be32(block + i * 4, state[i]);
+    }
+    block[32] = 0x80;
+    block[62] = 0x01; // 256 bits
+    block[63] = 0x00;
+    memcpy(state, SHA256_INIT, sizeof(state));
+    sha256_transform(state, block);
+
+    for (int i = 0; i < 8; i++) {
+        write_be32(hash + i * 4, state[i]);
+    }
+}
+
+// Leading zero bits of the hash read as a little endian 256 bit number
+static int hash_zero_bits(const uint8_t hash[32])
+{
+    int bits = 0;
+    for (int i = 31; i >= 0; i--) {
+        if (hash[i] == 0) {
+            bits += 8;
+            continue;
+        }
+        return bits + __builtin_clz(hash[i]) - 24;
+    }
+    return bits;
+}
+
+// Deposit the low bits of value into the set bits of mask
+static uint32_t deposit_bits(uint32_t value, uint32_t mask)
+{
+    uint32_t result = 0;
+    for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+        if (value & bit) {
+            result |= mask & -mask;
+        }
+        mask &= mask - 1;
+    }
+    return result;
+}
+
+static void advance_counters(uint64_t now_us)
+{
+    for (int i = 0; i < config.chip_count; i++) {
+        sim_chip_t * chip = &chips[i];
+        if (hashing && now_us > chip->updated_us) {
+            chip->hashes += (double) (now_us - chip->updated_us) * chip->frequency_mhz * model->small_cores;
+        }
+        chip->updated_us = now_us;
+    }
+}
+
+static void queue_frame(uint8_t * frame, uint64_t now_us)
+{
+    if (out_count == OUT_QUEUE_SIZE) {
+        stats.dropped++;
+        return;
+    }
+
+    // The crc covers the flag bits in the top of the last byte, find the 5 bit value that closes it
+    uint8_t length = model->result_length;
+    uint8_t flags = frame[length - 1] & 0xE0;
+    for (uint8_t crc = 0; crc < 32; crc++) {
+        frame[length - 1] = flags | crc;
+        if (crc5(frame + 2, length - 2) == 0) {
+            break;
+        }
+    }
+
+    if (config.crc_error_rate > 0 && (rng_next() % 1000000) < config.crc_error_rate * 1000000) {
+        frame[2 + rng_next() % (length - 3)] ^= 1 << (rng_next() % 8);
+        stats.injected_crc_errors++;
+    }
+
+    uint64_t ready_us = now_us + config.latency_us;
+    if (config.latency_jitter_us > 0) {
+        ready_us += rng_next() % config.latency_jitter_us;
+    }
+    // The wire is FIFO, jitter can't reorder responses
+    if (ready_us < last_ready_us) {
+        ready_us = last_ready_us;
+    }
+    last_ready_us = ready_us;
+
+    sim_frame_t * slot = &out_queue[(out_head + out_count) & (OUT_QUEUE_SIZE - 1)];
+    memcpy(slot->data, frame, length);
+    slot->length = length;
+    slot->offset = 0;
+    slot->ready_us = ready_us;
+    out_count++;
+}
+
+static uint32_t read_register(sim_chip_t * chip, uint8_t reg)
+{
+    double counter = chip->hashes / HASH_CNT_LSB;
+
+    switch (reg) {
+        case REG_CHIP_ID:
+            return ((uint32_t) model->chip_id << 16) | chip->address;
+        case REG_HASHRATE:
+            return (uint32_t) (chip->frequency_mhz * 1e6 * model->small_cores / HASHRATE_UNIT) & 0x7FFFFFFF;
+        case REG_TOTAL_COUNT:
+            return (uint32_t) (uint64_t) counter;
+        case REG_DOMAIN_0_COUNT:
+        case REG_DOMAIN_0_COUNT + 1:
+        case REG_DOMAIN_0_COUNT + 2:
+        case REG_DOMAIN_0_COUNT + 3:
+            return (uint32_t) (uint64_t) (counter / HASH_DOMAINS);
+        case REG_ERROR_COUNT:
+            return 0;
+        default:
+            return chip->registers[reg];
+    }
+}
+
+static void respond_register(sim_chip_t * chip, uint8_t reg, uint64_t now_us)
+{
+    uint8_t frame[FRAME_MAX_LENGTH] = {PREAMBLE_RX_0, PREAMBLE_RX_1};
+
+    write_be32(frame + 2, read_register(chip, reg));
+    frame[6] = chip->address;
+    frame[7] = reg;
+    stats.register_reads++;
+    queue_frame(frame, now_us);
+}
+
+static void set_frequency(sim_chip_t * chip, const uint8_t data[4])
+{
+    uint16_t fb_divider = ((data[0] & 0x0F) << 8) | data[1];
+    uint8_t refdiv = data[2];
+    uint8_t postdiv1 = (data[3] >> 4) + model->postdiv_offset;
+    uint8_t postdiv2 = (data[3] & 0x0F) + model->postdiv_offset;
+
+    if (refdiv == 0 || postdiv1 == 0 || postdiv2 == 0) {
+        return;
+    }
+    chip->frequency_mhz = 25.0f * fb_divider / (refdiv * postdiv1 * postdiv2);
+}
+
+static void write_register(sim_chip_t * chip, uint8_t reg, const uint8_t data[4])
+{
+    chip->registers[reg] = read_be32(data);
+    if (reg == REG_PLL0) {
+        set_frequency(chip, data);
+    }
+    if (reg == REG_HASH_COUNTING) {
+        stats.hash_counting = chip->registers[reg];
+    }
+}
+
+static uint8_t ticket_zero_bits(void)
+{
+    if (config.zero_bits != 0) {
+        return config.zero_bits;
+    }
+    // The ticket mask holds log2(difficulty) set bits on top of difficulty 1
+    return 32 + __builtin_popcount(chips[0].registers[REG_TICKET_MASK]);
+}
+
+static void load_job(const uint8_t * data, int len)
+{
+    memset(&job, 0, sizeof(job));
+    job.job_id = data[0];
+
+    if (model->version_rolling) {
+        // bm13xx_job_t: the hashes are sent with their 32 bit words in reverse order
+        if (len < 82) {
+            return;
+        }
+        memset(header_prefix, 0, sizeof(header_prefix));
+        for (int word = 0; word < 8; word++) {
+            memcpy(header_prefix + 4 + word * 4, data + 46 + (7 - word) * 4, 4); // prev_block_hash
+        }
+        for (int word = 0; word < 7; word++) {
+            memcpy(header_prefix + 36 + word * 4, data + 14 + (7 - word) * 4, 4); // merkle_root
+        }
+        memcpy(job.tail, data + 14, 4);      // last merkle root word
+        memcpy(job.tail + 4, data + 10, 4);  // ntime
+        memcpy(job.tail + 8, data + 6, 4);   // nbits
+
+        uint32_t version = read_le32(data + 78);
+        uint32_t mask = (chips[0].registers[REG_VERSION_ROLLING] & 0xFFFF) << 13;
+        int combinations = __builtin_popcount(mask) >= 4 ? MAX_VERSION_VARIANTS : 1 << __builtin_popcount(mask);
+        job.variants = combinations;
+        for (int v = 0; v < combinations; v++) {
+            job.version_bits[v] = deposit_bits(v, mask);
+            write_le32(header_prefix, version | job.version_bits[v]);
+            memcpy(job.midstates[v], SHA256_INIT, sizeof(SHA256_INIT));
+            sha256_transform(job.midstates[v], header_prefix);
+        }
+    } else {
+        // job_packet: midstates are sent reversed, the last state word first
+        if (len < 50) {
+            return;
+        }
+        job.variants = data[1] == 4 && len >= 146 ? 4 : 1;
+        for (int v = 0; v < job.variants; v++) {
+            const uint8_t * midstate = data + 18 + v * 32;
+            for (int i = 0; i < 8; i++) {
+                job.midstates[v][i] = read_le32(midstate + (7 - i) * 4);
+            }
+        }
+        memcpy(job.tail, data + 14, 4);      // merkle4
+        memcpy(job.tail + 4, data + 10, 4);  // ntime
+        memcpy(job.tail + 8, data + 6, 4);   // nbits
+    }
+
+    job.valid = true;
+    stats.jobs++;
+}
+
+static sim_chip_t * chip_at(uint8_t address)
+{
+    for (int i = 0; i < config.chip_count; i++) {
+        if (chips[i].address == address) {
+            return &chips[i];
+        }
+    }
+    return NULL;
+}
+
+// Each chip searches the address bytes from its own address up to the next
+// chip's. Bytes below the lowest address are never searched, and chips
+// sharing an address search the same nonces.
+static void update_spans(void)
+{
+    for (int i = 0; i < config.chip_count; i++) {
+        uint16_t end = 256;
+        for (int j = 0; j < config.chip_count; j++) {
+            if (chips[j].address > chips[i].address && chips[j].address < end) {
+                end = chips[j].address;
+            }
+        }
+        chips[i].span = end - chips[i].address;
+    }
+}
+
+static void handle_frame(const uint8_t * frame, int length, uint64_t now_us)
+{
+    uint8_t header = frame[2];
+    const uint8_t * data = frame + 4;
+
+    if (header & TYPE_JOB) {
+        int data_len = length - 6;
+        uint16_t crc = crc16_false((uint8_t *) frame + 2, length - 4);
+        if (crc != ((frame[length - 2] << 8) | frame[length - 1])) {
+            stats.tx_crc_errors++;
+            return;
+        }
+        stats.frames++;
+        advance_counters(now_us);
+        hashing = true;
+        load_job(data, data_len);
+        return;
+    }
+
+    if (crc5((uint8_t *) frame + 2, length - 3) != frame[length - 1]) {
+        stats.tx_crc_errors++;
+        return;
+    }
+    stats.frames++;
+
+    bool all = header & GROUP_ALL;
+    sim_chip_t * target = all ? NULL : chip_at(data[0]);
+
+    switch (header & CMD_MASK) {
+        case CMD_SETADDRESS:
+            if (next_address_index < config.chip_count) {
+                chips[next_address_index++].address = data[0];
+                update_spans();
+            }
+            break;
+        case CMD_INACTIVE:
+            next_address_index = 0;
+            break;
+        case CMD_READ:
+            advance_counters(now_us);
+            if (all) {
+                for (int i = 0; i < config.chip_count; i++) {
+                    respond_register(&chips[i], data[1], now_us);
+                }
+            } else if (target != NULL) {
+                respond_register(target, data[1], now_us);
+            }
+            break;
+        case CMD_WRITE:
+            if (length < 11) {
+                break;
+            }
+            advance_counters(now_us);
+            if (all) {
+                for (int i = 0; i < config.chip_count; i++) {
+                    write_register(&chips[i], data[1], data + 2);
+                }
+            } else if (target != NULL) {
+                write_register(target, data[1], data + 2);
+            }
+            break;
+    }
+}
+
+bool bm13xx_sim_init(const bm13xx_sim_config_t * sim_config)
+{
+    model = NULL;
+    for (int i = 0; i < sizeof(MODELS) / sizeof(MODELS[0]); i++) {
+        if (MODELS[i].chip_id == sim_config->chip_id) {
+            model = &MODELS[i];
+        }
+    }
+    if (model == NULL || sim_config->chip_count == 0) {
+        return false;
+    }
+
+    free(chips);
+    chips = calloc(sim_config->chip_count, sizeof(sim_chip_t));
+    if (chips == NULL) {
+        return false;
+    }
+
+    config = *sim_config;
+    for (int i = 0; i < config.chip_count; i++) {
+        chips[i].frequency_mhz = 50.0f;
+    }
+    rng_state = config.seed != 0 ? config.seed : 1;
+    next_address_index = 0;
+    hashing = false;
+    in_len = 0;
+    out_head = 0;
+    out_count = 0;
+    last_ready_us = 0;
+    memset(&job, 0, sizeof(job));
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+void bm13xx_sim_write(const uint8_t * data, int len, uint64_t now_us)
+{
+    while (len > 0) {
+        int chunk = len < IN_BUF_SIZE - in_len ? len : IN_BUF_SIZE - in_len;
+        memcpy(in_buf + in_len, data, chunk);
+        in_len += chunk;
+        data += chunk;
+        len -= chunk;
+
+        int pos = 0;
+        while (in_len - pos >= 4) {
+            if (in_buf[pos] != PREAMBLE_TX_0 || in_buf[pos + 1] != PREAMBLE_TX_1) {
+                pos++;
+                continue;
+            }
+            int frame_length = in_buf[pos + 3] + 2;
+            if (frame_length < 7 || frame_length > IN_BUF_SIZE) {
+                pos++;
+                continue;
+            }
+            if (in_len - pos < frame_length) {
+                break;
+            }
+            handle_frame(in_buf + pos, frame_length, now_us);
+            pos += frame_length;
+        }
+
+        memmove(in_buf, in_buf + pos, in_len - pos);
+        in_len -= pos;
+    }
+}
+
+int bm13xx_sim_read(uint8_t * buf, int len, uint64_t now_us)
+{
+    int copied = 0;
+    while (copied < len && out_count > 0) {
+        sim_frame_t * frame = &out_queue[out_head];
+        if (frame->ready_us > now_us) {
+            break;
+        }
+
+        int chunk = frame->length - frame->offset;
+        if (chunk > len - copied) {
+            chunk = len - copied;
+        }
+        memcpy(buf + copied, frame->data + frame->offset, chunk);
+        frame->offset += chunk;
+        copied += chunk;
+
+        if (frame->offset == frame->length) {
+            out_head = (out_head + 1) & (OUT_QUEUE_SIZE - 1);
+            out_count--;
+        }
+    }
+    return copied;
+}
+
+bool bm13xx_sim_poll(uint64_t now_us)
+{
+    if (!job.valid || out_count == OUT_QUEUE_SIZE) {
+        return false;
+    }
+
+    int zero_bits = ticket_zero_bits();
+    uint8_t small_core_mask = (1 << model->small_core_bits) - 1;
+
+    for (uint32_t i = 0; i < config.hashes_per_poll; i++) {
+        // Spread the search over the chips, the rolled versions or midstates and
+        // the nonce range of each chip, the same way the chain splits it
+        uint64_t position = job.next++;
+        sim_chip_t * chip = &chips[position % config.chip_count];
+        position /= config.chip_count;
+        uint8_t variant = position % job.variants;
+        position /= job.variants;
+
+        uint32_t low = position & 0x1FFFF;
+        position >>= 17;
+        uint8_t address = chip->address;
+        if (chip->span > 1) {
+            address += position % chip->span;
+            position /= chip->span;
+        }
+        uint32_t nonce = ((uint32_t) (position & 0x7F) << 25) | ((uint32_t) address << 17) | low;
+
+        uint8_t hash[32];
+        write_be32(job.tail + 12, nonce);
+        hash_header_tail(job.midstates[variant], job.tail, hash);
+        stats.hashes++;
+
+        if (hash_zero_bits(hash) < zero_bits) {
+            continue;
+        }
+
+        uint8_t frame[FRAME_MAX_LENGTH] = {PREAMBLE_RX_0, PREAMBLE_RX_1};
+        write_be32(frame + 2, nonce);
+        frame[6] = 0;
+        if (model->version_rolling) {
+            uint8_t small_core = low & small_core_mask;
+            frame[7] = ((job.job_id << model->job_id_shift) & ~small_core_mask) | small_core;
+            uint16_t version_bits = job.version_bits[variant] >> 13;
+            frame[8] = version_bits >> 8;
+            frame[9] = version_bits & 0xFF;
+        } else {
+            frame[7] = (job.job_id & ~small_core_mask) | variant;
+        }
+        frame[model->result_length - 1] = 0x80; // job response
+        queue_frame(frame, now_us);
+        stats.nonces++;
+        return true;
+    }
+    return false;
+}
+
+uint64_t bm13xx_sim_next_ready_us(void)
+{
+    return out_count > 0 ? out_queue[out_head].ready_us : UINT64_MAX;
+}
+
+bool bm13xx_sim_has_job(void)
+{
+    return job.valid;
+}
+
+void bm13xx_sim_set_crc_error_rate(float crc_error_rate)
+{
+    config.crc_error_rate = crc_error_rate;
+}
+
+void bm13xx_sim_flush(void)
+{
+    out_head = 0;
+    out_count = 0;
+}
+
+const bm13xx_sim_stats_t * bm13xx_sim_stats(void)
+{
+    return &stats;
+}
@@ -1,13 +1,22 @@
 #include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "common.h"
 #include "serial.h"
 #include "esp_log.h"
 #include "crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #define PREAMBLE 0xAA55
 
+// The chips answer a chip id read back to back, at 115200 baud a frame takes
+// about a millisecond. The first answer may take a while, once the expected
+// count is in only a short quiet period confirms no more chips follow.
+#define CHIP_ID_TIMEOUT_MS 1000
+#define CHIP_ID_CONFIRM_MS 50
+
 static const char * TAG = "common";
 
 unsigned char _reverse_bits(unsigned char num)
@@ -42,7 +51,8 @@ int count_asic_chips(uint16_t asic_count, uint16_t chip_id, int chip_id_response
 
     int chip_counter = 0;
     while (true) {
-        int received = SERIAL_rx(buffer, chip_id_response_length, 1000);
+        int timeout_ms = chip_counter >= asic_count ? CHIP_ID_CONFIRM_MS : CHIP_ID_TIMEOUT_MS;
+        int received = SERIAL_rx(buffer, chip_id_response_length, timeout_ms);
         if (received == 0) break;
 
         if (received == -1) {
@@ -88,46 +98,114 @@ int count_asic_chips(uint16_t asic_count, uint16_t chip_id, int chip_id_response
     return chip_counter;
 }
 
-esp_err_t receive_work(uint8_t * buffer, int buffer_size)
+// Bytes received from the chain that are not yet parsed into frames.
+// Only used from the result task, other tasks request a reset through rx_reset.
+#define RX_RING_SIZE 512 // power of two
+#define RX_TIMEOUT_MS 10000
+
+static uint8_t rx_ring[RX_RING_SIZE];
+static uint16_t rx_head;
+static uint16_t rx_count;
+static rx_stats_t rx_stats;
+static atomic_bool rx_reset;
+
+static inline uint8_t rx_peek(uint16_t offset)
 {
-    int received = SERIAL_rx(buffer, buffer_size, 10000);
+    return rx_ring[(rx_head + offset) & (RX_RING_SIZE - 1)];
+}
 
-    if (received < 0) {
-        ESP_LOGE(TAG, "UART error in serial RX");
-        return ESP_FAIL;
-    }
+static inline void rx_drop(uint16_t len)
+{
+    rx_head = (rx_head + len) & (RX_RING_SIZE - 1);
+    rx_count -= len;
+}
 
-    if (received == 0) {
-        ESP_LOGD(TAG, "UART timeout in serial RX");
-        return ESP_FAIL;
+static int16_t rx_fill(uint16_t timeout_ms)
+{
+    // Read into the contiguous free space after the tail, the next call wraps around
+    uint16_t tail = (rx_head + rx_count) & (RX_RING_SIZE - 1);
+    uint16_t space = RX_RING_SIZE - rx_count;
+    if (space > RX_RING_SIZE - tail) {
+        space = RX_RING_SIZE - tail;
     }
 
-    if (received != buffer_size) {
-        ESP_LOGE(TAG, "Invalid response length %i", received);
-        ESP_LOG_BUFFER_HEX(TAG, buffer, received);
-        SERIAL_clear_buffer();
-        return ESP_FAIL;
+    int16_t received = SERIAL_rx_stream(rx_ring + tail, space, timeout_ms);
+    if (received > 0) {
+        rx_count += received;
     }
+    return received;
+}
 
-    uint16_t received_preamble = (buffer[0] << 8) | buffer[1];
-    if (received_preamble != PREAMBLE) {
-        ESP_LOGE(TAG, "Preamble mismatch: got 0x%04x, expected 0x%04x", received_preamble, PREAMBLE);
-        ESP_LOG_BUFFER_HEX(TAG, buffer, received);
-        SERIAL_clear_buffer();
-        return ESP_FAIL;
-    }
+esp_err_t receive_work(uint8_t * buffer, int buffer_size)
+{
+    TickType_t start = xTaskGetTickCount();
 
-    if (crc5(buffer + 2, buffer_size - 2) != 0) {
-        ESP_LOGE(TAG, "Checksum failed on response");        
-        ESP_LOG_BUFFER_HEX(TAG, buffer, received);
-        SERIAL_clear_buffer();
-        return ESP_FAIL;
+    while (true) {
+        // Drop whatever was buffered before the UART was flushed
+        if (atomic_exchange(&rx_reset, false)) {
+            rx_head = 0;
+            rx_count = 0;
+        }
+
+        // Scan for the preamble and resync byte by byte, so a corrupted frame
+        // doesn't take the good frames behind it down as well
+        while (rx_count > 0) {
+            if (rx_peek(0) != (PREAMBLE >> 8) || (rx_count > 1 && rx_peek(1) != (PREAMBLE & 0xFF))) {
+                rx_drop(1);
+                rx_stats.resync_bytes++;
+                continue;
+            }
+
+            if (rx_count < buffer_size) {
+                break;
+            }
+
+            for (int i = 0; i < buffer_size; i++) {
+                buffer[i] = rx_peek(i);
+            }
+
+            if (crc5(buffer + 2, buffer_size - 2) != 0) {
+                ESP_LOGE(TAG, "Checksum failed on response");
+                ESP_LOG_BUFFER_HEX(TAG, buffer, buffer_size);
+                rx_stats.crc_errors++;
+                rx_drop(1);
+                continue;
+            }
+
+            rx_drop(buffer_size);
+            rx_stats.frames++;
+            return ESP_OK;
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= pdMS_TO_TICKS(RX_TIMEOUT_MS)) {
+            ESP_LOGD(TAG, "UART timeout in serial RX");
+            return ESP_FAIL;
+        }
+
+        int16_t received = rx_fill(RX_TIMEOUT_MS - pdTICKS_TO_MS(elapsed));
+        if (received < 0) {
+            ESP_LOGE(TAG, "UART error in serial RX");
+            return ESP_FAIL;
+        }
+        if (received == 0) {
+            ESP_LOGD(TAG, "UART timeout in serial RX");
+            return ESP_FAIL;
+        }
     }
+}
+
+void receive_work_reset(void)
+{
+    atomic_store(&rx_reset, true);
+}
 
-    return ESP_OK;
+const rx_stats_t * receive_work_stats(void)
+{
+    return &rx_stats;
 }
 
-void get_difficulty_mask(uint16_t difficulty, uint8_t *job_difficulty_mask)
+void get_difficulty_mask(uint32_t difficulty, uint8_t *job_difficulty_mask)
 {
     // The mask must be a power of 2 so there are no holes
     // Correct:   {0b00000000, 0b00000000, 0b11111111, 0b11111111}
@@ -1,25 +1,157 @@
 #include "frequency_transition_bmXX.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include <math.h>
+#include <stdlib.h>
 
 #define EPSILON 0.0001f
 #define STEP_SIZE 6.25 // MHz step size
+#define STEP_DELAY_MS 100
+#define POWER_ON_FREQUENCY 50 // MHz
+
+// Closed loop ramp, every step is held for SETTLE_MS plus a window of WINDOW_MS to MAX_WINDOW_MS plus the register reads
+#define MAX_STEP_SIZE 25.0   // MHz, steps double up to this while the chips keep up
+#define SETTLE_MS 50
+#define WINDOW_MS 250
+#define MAX_WINDOW_MS 2000
+#define WINDOW_MARGIN 2.0f   // the window aims for this many times MIN_TICKS on the slowest chip
+#define MIN_TICKS 32         // fewer counter increments are too noisy to judge a chip on
+#define HASHRATE_DROP 0.25f  // tolerated drop of the GH/s per MHz against the average of the good steps
+#define NOISE_Z 3.0f         // the tolerated drop is widened to this many standard deviations of the counter
+#define ERROR_RISE 0.005f    // tolerated rise of the error share of the hashrate
 
 static const char * TAG = "frequency_transition";
 
-static float current_frequency = 50; // Mhz
+static float current_frequency = POWER_ON_FREQUENCY; // Mhz
+
+static chip_frequency_t * chips;
+static uint16_t chip_count;
+static frequency_ramp_stats_t stats;
+
+static frequency_ramp_sample_fn feedback_fn;
+static void * feedback_ctx;
+
+// Held by a ramp, and by single chip changes in between so a ramp can't start halfway through them
+static SemaphoreHandle_t ramp_lock;
+
+// Counter increments per ms and MHz of the slowest hashing chip at the last measured step, 0 if unknown
+static float tick_rate;
+
+typedef enum {
+    STEP_GOOD,
+    STEP_UNJUDGED,  // a chip had too few counter increments to tell
+    STEP_DEGRADED,
+} step_result_t;
+
+// What a chip did at the good steps of the running ramp
+typedef struct {
+    float efficiency;   // GH/s per MHz
+    float error_share;  // error rate over hashrate at the first judged step
+    uint16_t steps;
+} ramp_baseline_t;
 
-void do_frequency_transition(float target_frequency, set_hash_frequency_fn set_frequency_fn)
+static void lock(void)
 {
-    if (fabs(current_frequency - target_frequency) < EPSILON) {
-        return;
+    if (ramp_lock != NULL) {
+        xSemaphoreTake(ramp_lock, portMAX_DELAY);
+    }
+}
+
+static void unlock(void)
+{
+    if (ramp_lock != NULL) {
+        xSemaphoreGive(ramp_lock);
+    }
+}
+
+void frequency_ramp_init(uint16_t asic_count)
+{
+    if (ramp_lock == NULL) {
+        ramp_lock = xSemaphoreCreateMutex();
+    }
+    lock();
+
+    current_frequency = POWER_ON_FREQUENCY;
+
+    if (asic_count != chip_count) {
+        free(chips);
+        chips = calloc(asic_count, sizeof(chip_frequency_t));
+        chip_count = chips != NULL ? asic_count : 0;
+    }
+    for (int asic_nr = 0; asic_nr < chip_count; asic_nr++) {
+        chips[asic_nr].frequency = current_frequency;
+        chips[asic_nr].hashrate = 0;
+        chips[asic_nr].error_rate = 0;
+    }
+    stats = (frequency_ramp_stats_t) { .frequency = current_frequency };
+    unlock();
+}
+
+void frequency_ramp_set_feedback(frequency_ramp_sample_fn sample_fn, void * ctx)
+{
+    feedback_ctx = ctx;
+    feedback_fn = sample_fn;
+}
+
+bool frequency_ramp_try_lock(void)
+{
+    return ramp_lock != NULL && xSemaphoreTake(ramp_lock, 0) == pdTRUE;
+}
+
+void frequency_ramp_unlock(void)
+{
+    xSemaphoreGive(ramp_lock);
+}
+
+const frequency_ramp_stats_t * frequency_ramp_stats(void)
+{
+    return &stats;
+}
+
+const chip_frequency_t * frequency_ramp_chips(uint16_t * asic_count)
+{
+    *asic_count = chip_count;
+    return chips;
+}
+
+static void set_frequency(float frequency, set_hash_frequency_fn set_frequency_fn)
+{
+    set_frequency_fn(frequency);
+
+    current_frequency = frequency;
+    for (int asic_nr = 0; asic_nr < chip_count; asic_nr++) {
+        chips[asic_nr].frequency = frequency;
     }
+}
+
+void frequency_ramp_set_frequency(float frequency, set_hash_frequency_fn set_frequency_fn)
+{
+    lock();
+    set_frequency(frequency, set_frequency_fn);
+    stats = (frequency_ramp_stats_t) {
+        .start_frequency = frequency,
+        .target_frequency = frequency,
+        .frequency = frequency,
+        .steps = 1,
+    };
+    unlock();
+}
 
+void frequency_ramp_set_chip_frequency(uint8_t asic_nr, float frequency)
+{
+    if (asic_nr < chip_count) {
+        chips[asic_nr].frequency = frequency;
+    }
+}
+
+static void ramp_open_loop(float target_frequency, set_hash_frequency_fn set_frequency_fn)
+{
     if (fabs(target_frequency - current_frequency) < STEP_SIZE) {
-        current_frequency = target_frequency;
-        set_frequency_fn(current_frequency);
+        set_frequency(target_frequency, set_frequency_fn);
+        stats.steps++;
         return;
     }
 
@@ -30,22 +162,205 @@ void do_frequency_transition(float target_frequency, set_hash_frequency_fn set_f
 
     if (current_step != target_step) {
         int signum = (target_frequency > current_frequency) ? 1 : -1;
-        
+
         while ((signum > 0 && current_step < target_step) ||
                (signum < 0 && current_step > target_step)) {
             current_step += signum;
 
-            current_frequency = current_step * STEP_SIZE;
-            set_frequency_fn(current_frequency);
-            
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+            set_frequency(current_step * STEP_SIZE, set_frequency_fn);
+            stats.steps++;
+
+            vTaskDelay(STEP_DELAY_MS / portTICK_PERIOD_MS);
         }
     }
-    
+
     if (fabs(current_frequency - target_frequency) > EPSILON) {
-        current_frequency = target_frequency;
-        set_frequency_fn(current_frequency);
+        set_frequency(target_frequency, set_frequency_fn);
+        stats.steps++;
+    }
+}
+
+// Counter rates at the frequency just programmed
+static bool measure(frequency_ramp_sample_t * samples)
+{
+    vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+
+    // Restarts the window, so the rates don't include the previous step
+    feedback_fn(feedback_ctx, samples, chip_count);
+
+    // The counters tick at a few to a few dozen per domain in WINDOW_MS depending on the chip,
+    // hold long enough for the slowest chip to reach MIN_TICKS at its rate from the last step
+    uint32_t window_ms = WINDOW_MS;
+    if (tick_rate > 0) {
+        float ms = MIN_TICKS * WINDOW_MARGIN / (tick_rate * current_frequency);
+        window_ms = ms > MAX_WINDOW_MS ? MAX_WINDOW_MS : ms < WINDOW_MS ? WINDOW_MS : (uint32_t) ms;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(window_ms));
+    if (!feedback_fn(feedback_ctx, samples, chip_count)) {
+        return false;
+    }
+
+    // Chips that aren't hashing at all don't stretch the window
+    float slowest = 0;
+    for (int asic_nr = 0; asic_nr < chip_count; asic_nr++) {
+        float rate = samples[asic_nr].ticks / ((float) window_ms * current_frequency);
+        if (samples[asic_nr].ticks > 0 && (slowest == 0 || rate < slowest)) {
+            slowest = rate;
+        }
+    }
+    if (slowest > 0) {
+        tick_rate = slowest;
+    }
+    return true;
+}
+
+// Compares every chip against its good steps so far. A step only passes when every chip was judged on it.
+static step_result_t judge_step(float frequency, const frequency_ramp_sample_t * samples, ramp_baseline_t * baselines)
+{
+    step_result_t result = STEP_GOOD;
+
+    for (int asic_nr = 0; asic_nr < chip_count; asic_nr++) {
+        const frequency_ramp_sample_t * sample = &samples[asic_nr];
+        ramp_baseline_t * baseline = &baselines[asic_nr];
+
+        if (sample->ticks < MIN_TICKS) {
+            // Once judged, a chip whose counters fall far below the minimum has stalled
+            if (baseline->steps > 0 && sample->ticks < MIN_TICKS / 4) {
+                ESP_LOGW(TAG, "ASIC %d counters stalled at %g MHz", asic_nr, frequency);
+                chips[asic_nr].limit = frequency;
+                result = STEP_DEGRADED;
+            } else if (result == STEP_GOOD) {
+                result = STEP_UNJUDGED;
+            }
+            continue;
+        }
+
+        chips[asic_nr].hashrate = sample->hashrate;
+        chips[asic_nr].error_rate = sample->error_rate;
+
+        // A single stalled domain shows up long before it moves the chip total
+        float hashrate = sample->domain_hashrate >= 0 ? fminf(sample->hashrate, sample->domain_hashrate) : sample->hashrate;
+        float efficiency = hashrate / frequency;
+        float error_share = sample->error_rate / sample->hashrate;
+
+        if (baseline->steps > 0) {
+            // A count of n is only good to about 1 / sqrt(n)
+            float drop = fmaxf(HASHRATE_DROP, NOISE_Z / sqrtf(sample->ticks));
+            if (efficiency < baseline->efficiency * (1 - drop)) {
+                ESP_LOGW(TAG, "ASIC %d hashrate dropped to %.1f GH/s at %g MHz", asic_nr, hashrate, frequency);
+                chips[asic_nr].limit = frequency;
+                result = STEP_DEGRADED;
+                continue;
+            }
+            if (error_share > baseline->error_share + ERROR_RISE) {
+                ESP_LOGW(TAG, "ASIC %d error rate rose to %.2f%% at %g MHz", asic_nr, error_share * 100, frequency);
+                chips[asic_nr].limit = frequency;
+                result = STEP_DEGRADED;
+                continue;
+            }
+        } else {
+            baseline->error_share = error_share;
+        }
+
+        baseline->efficiency = (baseline->efficiency * baseline->steps + efficiency) / (baseline->steps + 1);
+        baseline->steps++;
+    }
+
+    return result;
+}
+
+static void ramp_closed_loop(float target_frequency, set_hash_frequency_fn set_frequency_fn, frequency_ramp_sample_t * samples, ramp_baseline_t * baselines)
+{
+    // Reference at the starting frequency, chips that aren't hashing can't be judged
+    tick_rate = 0;
+    if (!measure(samples)) {
+        ESP_LOGW(TAG, "No counter feedback, ramping open loop");
+        stats.closed_loop = false;
+        ramp_open_loop(target_frequency, set_frequency_fn);
+        return;
+    }
+    // The first window is only long enough to learn the tick rate on slow chips
+    if (judge_step(current_frequency, samples, baselines) == STEP_UNJUDGED && measure(samples)) {
+        judge_step(current_frequency, samples, baselines);
+    }
+
+    ESP_LOGI(TAG, "Ramping up frequency from %g MHz to %g MHz on counter feedback", current_frequency, target_frequency);
+
+    float step = STEP_SIZE;
+    while (current_frequency < target_frequency - EPSILON) {
+        float good_frequency = current_frequency;
+
+        set_frequency(fminf(current_frequency + step, target_frequency), set_frequency_fn);
+        stats.steps++;
+
+        if (!measure(samples)) {
+            // Lost the feedback for this step, carry on at the smallest step
+            step = STEP_SIZE;
+            continue;
+        }
+        stats.checked_steps++;
+
+        step_result_t result = judge_step(current_frequency, samples, baselines);
+        if (result == STEP_GOOD) {
+            step = fmin(step * 2, MAX_STEP_SIZE);
+            continue;
+        }
+        if (result == STEP_UNJUDGED) {
+            // Too few counter increments to tell, only the smallest step is taken unchecked
+            step = STEP_SIZE;
+            continue;
+        }
+
+        ESP_LOGW(TAG, "Backing off to %g MHz", good_frequency);
+        set_frequency(good_frequency, set_frequency_fn);
+        stats.backoffs++;
+        break;
     }
-    
-    ESP_LOGI(TAG, "Successfully transitioned to %g MHz", target_frequency);
+}
+
+float do_frequency_transition(float target_frequency, set_hash_frequency_fn set_frequency_fn, bool closed_loop)
+{
+    lock();
+    if (fabs(current_frequency - target_frequency) < EPSILON) {
+        unlock();
+        return current_frequency;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    stats = (frequency_ramp_stats_t) {
+        .start_frequency = current_frequency,
+        .target_frequency = target_frequency,
+        .frequency = current_frequency,
+        .in_progress = true,
+    };
+
+    // Only going up can push a chip past what it holds, down ramps don't need feedback
+    frequency_ramp_sample_t * samples = NULL;
+    ramp_baseline_t * baselines = NULL;
+    if (closed_loop && feedback_fn != NULL && chip_count > 0 && target_frequency > current_frequency + STEP_SIZE) {
+        samples = calloc(chip_count, sizeof(frequency_ramp_sample_t));
+        baselines = calloc(chip_count, sizeof(ramp_baseline_t));
+        stats.closed_loop = samples != NULL && baselines != NULL;
+    }
+
+    if (stats.closed_loop) {
+        ramp_closed_loop(target_frequency, set_frequency_fn, samples, baselines);
+    } else {
+        ramp_open_loop(target_frequency, set_frequency_fn);
+    }
+
+    free(samples);
+    free(baselines);
+
+    stats.frequency = current_frequency;
+    stats.duration_ms = (esp_timer_get_time() - start_us) / 1000;
+    stats.in_progress = false;
+
+    ESP_LOGI(TAG, "Transitioned to %g MHz in %u steps (%u checked, %u back offs), %lu ms", current_frequency,
+             stats.steps, stats.checked_steps, stats.backoffs, (unsigned long) stats.duration_ms);
+
+    float frequency = current_frequency;
+    unlock();
+    return frequency;
 }
@@ -4,14 +4,35 @@
 #include <esp_err.h>
 #include "global_state.h"
 #include "common.h"
+#include "bm13xx.h"
 
 uint8_t ASIC_init(GlobalState * GLOBAL_STATE);
 task_result * ASIC_process_work(GlobalState * GLOBAL_STATE);
 int ASIC_set_max_baud(GlobalState * GLOBAL_STATE);
+// Switch the chips and the host to baud, returns baud or 0 if the chip doesn't support it
+int ASIC_set_baud(GlobalState * GLOBAL_STATE, int baud);
+// Chip id probes of the whole chain, true if all of them were answered intact
+bool ASIC_probe_link(GlobalState * GLOBAL_STATE, uint16_t probes, bm13xx_link_quality_t * quality);
+// Find the fastest rate the link carries without errors, returns 0 if even the slowest one fails
+int ASIC_calibrate_baud(GlobalState * GLOBAL_STATE);
 void ASIC_send_work(GlobalState * GLOBAL_STATE, void * next_job);
 void ASIC_set_version_mask(GlobalState * GLOBAL_STATE, uint32_t mask);
 bool ASIC_set_frequency(GlobalState * GLOBAL_STATE, float target_frequency);
+float ASIC_get_frequency(GlobalState * GLOBAL_STATE);
+bool ASIC_set_chip_frequency(GlobalState * GLOBAL_STATE, uint8_t asic_nr, float frequency);
 double ASIC_get_asic_job_frequency_ms(GlobalState * GLOBAL_STATE);
-void ASIC_read_registers(GlobalState * GLOBAL_STATE);
+// Registers with a known type, the hash counters polled by the hashrate monitor
+int ASIC_get_polled_registers(GlobalState * GLOBAL_STATE, uint8_t * registers, int max);
+register_type_t ASIC_get_register_type(GlobalState * GLOBAL_STATE, uint8_t reg);
+void ASIC_read_register(GlobalState * GLOBAL_STATE, uint8_t asic_nr, uint8_t reg);
+// Register 0x10 values known for the chip, the first is its default. Returns the count, 0 if the chip has none
+int ASIC_get_hash_counting_candidates(GlobalState * GLOBAL_STATE, const uint32_t ** candidates);
+// Write register 0x10 on all chips, 0 restores the chip default
+bool ASIC_set_hash_counting(GlobalState * GLOBAL_STATE, uint32_t hash_counting);
+bool ASIC_get_nonce_plan(GlobalState * GLOBAL_STATE, bm13xx_nonce_plan_t * plan);
+// Write the ticket mask on all chips, rounded down to a power of 2. Returns the difficulty set, 0 without chips
+uint32_t ASIC_set_difficulty(GlobalState * GLOBAL_STATE, uint32_t difficulty);
+// Difficulty of the ticket mask on the chips, the least a returned nonce is worth
+uint32_t ASIC_get_difficulty(GlobalState * GLOBAL_STATE);
 
 #endif // ASIC_H
@@ -0,0 +1,208 @@
+#ifndef BM13XX_H_
+#define BM13XX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "mining.h"
+
+#define BM13XX_SERIALTX_DEBUG false
+#define BM13XX_SERIALRX_DEBUG false
+#define BM13XX_DEBUG_WORK false //causes insane amount of debug output
+#define BM13XX_DEBUG_JOBS false //causes insane amount of debug output
+
+#define TYPE_JOB 0x20
+#define TYPE_CMD 0x40
+
+#define GROUP_SINGLE 0x00
+#define GROUP_ALL 0x10
+
+#define CMD_SETADDRESS 0x00
+#define CMD_WRITE 0x01
+#define CMD_READ 0x02
+#define CMD_INACTIVE 0x03
+
+#define BM13XX_RESULT_MAX_LENGTH 11
+
+typedef struct __attribute__((__packed__))
+{
+    uint8_t job_id;
+    uint8_t num_midstates;
+    uint8_t starting_nonce[4];
+    uint8_t nbits[4];
+    uint8_t ntime[4];
+    uint8_t merkle_root[32];
+    uint8_t prev_block_hash[32];
+    uint8_t version[4];
+} bm13xx_job_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint8_t job_id;
+    uint8_t num_midstates;
+    uint8_t starting_nonce[4];
+    uint8_t nbits[4];
+    uint8_t ntime[4];
+    uint8_t merkle4[4];
+    uint8_t midstate[32];
+    uint8_t midstate1[32];
+    uint8_t midstate2[32];
+    uint8_t midstate3[32];
+} job_packet;
+
+typedef enum
+{
+    BM13XX_JOB_HEADER,   // full block header, the chip rolls versions itself (BM1366,BM1368,BM1370)
+    BM13XX_JOB_MIDSTATE, // up to 4 precomputed midstates (BM1397)
+} bm13xx_job_format_t;
+
+typedef enum
+{
+    BM13XX_INIT_END = 0,
+    BM13XX_INIT_WRITE,          // write a register on all chips
+    BM13XX_INIT_WRITE_CHIP,     // write a register on the chip at .address
+    BM13XX_INIT_ENUMERATE,      // read the chip id on all chips and count the answers, stops init if none answer
+    BM13XX_INIT_CHAIN_INACTIVE,
+    BM13XX_INIT_SET_ADDRESSES,  // spread the chip addresses over 0-255, see BM13XX_chip_address
+    BM13XX_INIT_CHIP_INIT,      // replay the chip_init table on every chip
+    BM13XX_INIT_VERSION_MASK,   // write the default version mask
+    BM13XX_INIT_DIFFICULTY,     // write the ticket mask for the configured difficulty
+    BM13XX_INIT_DEFAULT_BAUD,
+    BM13XX_INIT_FREQUENCY,      // ramp (or set) the hash frequency to the configured value
+    BM13XX_INIT_DELAY,
+    BM13XX_INIT_HASH_COUNTING,  // write register 0x10, the chip default or the value set since
+} bm13xx_init_op_t;
+
+typedef struct
+{
+    bm13xx_init_op_t op;
+    uint8_t address;
+    uint8_t reg;
+    uint8_t data[4];
+    uint16_t delay_ms;
+} bm13xx_init_step_t;
+
+#define BM13XX_STEP(_op) { .op = (_op) }
+#define BM13XX_WRITE(_reg, d0, d1, d2, d3) { .op = BM13XX_INIT_WRITE, .reg = (_reg), .data = {d0, d1, d2, d3} }
+#define BM13XX_WRITE_CHIP(_addr, _reg, d0, d1, d2, d3) { .op = BM13XX_INIT_WRITE_CHIP, .address = (_addr), .reg = (_reg), .data = {d0, d1, d2, d3} }
+#define BM13XX_DELAY(_ms) { .op = BM13XX_INIT_DELAY, .delay_ms = (_ms) }
+
+/**
+ * @brief A UART rate the chips can be switched to with a single register write
+ */
+typedef struct
+{
+    int baud;
+    uint8_t reg;
+    uint8_t data[4];
+    bool initial;   // the rate init leaves the chips at, the write only undoes a faster rate sent since
+} bm13xx_baud_t;
+
+// MISC_CONTROL write for a divider of the 25 MHz clock, baud = 25M/((divider+1)*8)
+#define BM13XX_MISC_CONTROL_BAUD(_divider) { .baud = 25000000 / (((_divider) + 1) * 8), .reg = 0x18, .data = {0x00, 0x00, 0x60 | (_divider), 0x31} }
+
+// Fast UART configuration back at its reset value, as the BM1397 init writes it. The chips
+// talk at the rate they came out of init with again, MISC_CONTROL is left as init wrote it.
+#define BM13XX_FAST_UART_OFF_BAUD(_baud) { .baud = (_baud), .reg = 0x28, .data = {0x06, 0x00, 0x00, 0x0F}, .initial = true }
+
+/**
+ * @brief Result of a run of chip id probes, see bm13xx_functions_t.probe_link
+ */
+typedef struct
+{
+    uint16_t probes;
+    uint16_t errors;                     // probes with a missing, short or corrupt answer
+    uint32_t round_trip_us;              // slowest probe, command sent to last answer received
+} bm13xx_link_quality_t;
+
+/**
+ * @brief How the chain splits the nonce space between the chips
+ *
+ * Nonce bits 17-24 carry the address of the chip that found it. Every chip
+ * owns the address bytes from its own address up to the next chip's, so the
+ * spans tell how evenly the nonce space is shared.
+ */
+typedef struct
+{
+    uint16_t chip_count;
+    uint16_t min_span;                   // address bytes of the chip with the fewest
+    uint16_t max_span;
+    uint16_t covered;                    // address bytes owned by a chip, 256 without gaps
+    uint32_t hash_counting;              // register 0x10 value on the chips, 0 if the chip has none
+} bm13xx_nonce_plan_t;
+
+/**
+ * @brief Everything that differs between the BM13xx chips
+ *
+ * The generic engine in bm13xx.c drives any chip described by one of these.
+ */
+typedef struct
+{
+    const char * name;
+    uint16_t chip_id;
+    uint8_t result_length;               // length of result and chip id frames, preamble included
+
+    const bm13xx_init_step_t * init;     // terminated by BM13XX_INIT_END
+    const bm13xx_init_step_t * chip_init; // BM13XX_INIT_WRITE steps sent to every chip by address
+    uint16_t chip_init_delay_ms;         // wait after each chip's chip_init
+
+    bm13xx_job_format_t job_format;
+    uint8_t job_id_stride;               // job ids step by this, modulo 128
+    uint8_t result_job_id_mask;          // job id bits in the result id byte, the rest is the small core / midstate
+    uint8_t result_job_id_shift;
+    bool version_rolling;                // the chip rolls the version bits in the mask and returns them
+    uint16_t job_interval_max_ms;        // upper bound on the job interval for a single chip
+
+    uint16_t pll_fb_min;
+    uint16_t pll_fb_max;
+    bool frequency_transition;           // the frequency can be ramped while hashing
+    void (*send_hash_frequency)(float frequency); // optional, replaces the generic PLL programming
+
+    const bm13xx_baud_t * bauds;         // supported rates, slowest first
+    uint8_t baud_count;
+
+    const register_type_t * register_map; // indexed by register address
+    uint8_t register_map_size;
+
+    // Register 0x10 values from stock firmware dumps, the first is written at init.
+    // What the register does isn't documented, the nonce range benchmark compares them.
+    const uint32_t * hash_counting;
+    uint8_t hash_counting_count;
+} bm13xx_chip_t;
+
+/**
+ * @brief Chip operations, resolved once for the chip on the board
+ */
+typedef struct
+{
+    uint8_t (*init)(float frequency, uint16_t asic_count, uint16_t difficulty);
+    void (*send_work)(void * GLOBAL_STATE, bm_job * next_bm_job);
+    task_result * (*process_work)(void * GLOBAL_STATE);
+    void (*set_version_mask)(uint32_t version_mask);
+    void (*send_hash_frequency)(float frequency);
+    bool (*set_frequency)(float frequency);
+    bool (*set_chip_frequency)(uint8_t asic_nr, float frequency);
+    int (*set_default_baud)(void);
+    int (*set_max_baud)(void);
+    int (*set_baud)(int baud);
+    void (*probe_link)(uint16_t asic_count, uint16_t probes, bm13xx_link_quality_t * quality);
+    void (*read_register)(uint8_t asic_nr, uint8_t reg);
+    bool (*set_hash_counting)(uint32_t hash_counting);
+    void (*get_nonce_plan)(bm13xx_nonce_plan_t * plan);
+    uint32_t (*set_difficulty)(uint32_t difficulty);
+    uint32_t (*get_difficulty)(void);
+} bm13xx_functions_t;
+
+// Counter registers shared by the BM1366, BM1368 and BM1370
+extern const register_type_t BM13XX_COUNTER_REGISTER_MAP[0x8D];
+
+const bm13xx_functions_t * BM13XX_bind(const bm13xx_chip_t * chip);
+void BM13XX_send(uint8_t header, const uint8_t * data, uint8_t data_len, bool debug);
+
+// Address of chip asic_nr, the chips are spread over all 256 address bytes without gaps
+uint8_t BM13XX_chip_address(uint16_t asic_nr, uint16_t chip_count);
+// Chip that owns an address byte, the inverse of BM13XX_chip_address
+uint16_t BM13XX_chip_number(uint8_t address, uint16_t chip_count);
+
+#endif /* BM13XX_H_ */
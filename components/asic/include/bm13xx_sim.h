@@ -0,0 +1,79 @@
+#ifndef BM13XX_SIM_H_
+#define BM13XX_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Software model of a BM1366/BM1368/BM1370/BM1397 chain.
+ *
+ * It takes the byte stream the host would send to the chain and produces
+ * the byte stream the chain would answer with: chip id and register reads,
+ * including the hash and domain counters, and nonces found by hashing the
+ * jobs it receives. serial_sim.c puts it behind the SERIAL_* functions for
+ * host builds, so ASIC_task and ASIC_result_task can run without chips.
+ *
+ * The model doesn't sleep or read a clock, every call takes the current
+ * time so runs can be replayed.
+ */
+
+typedef struct
+{
+    uint16_t chip_id;            // 0x1366, 0x1368, 0x1370 or 0x1397
+    uint8_t chip_count;
+    uint8_t zero_bits;           // leading zero bits a nonce hash needs, 0 follows the ticket mask the host writes
+    uint32_t hashes_per_poll;    // hashing budget of one bm13xx_sim_poll call
+    float crc_error_rate;        // fraction of responses sent with a corrupted crc
+    uint32_t latency_us;         // delay before a response can be read
+    uint32_t latency_jitter_us;  // random extra delay on top of latency_us
+    uint32_t seed;
+} bm13xx_sim_config_t;
+
+typedef struct
+{
+    uint32_t frames;             // frames received from the host
+    uint32_t tx_crc_errors;      // host frames dropped on a crc mismatch
+    uint32_t jobs;
+    uint32_t register_reads;
+    uint64_t hashes;             // double SHA256 computed while searching nonces
+    uint32_t nonces;
+    uint32_t injected_crc_errors;
+    uint32_t dropped;            // responses lost to a full output queue
+    uint32_t hash_counting;      // last register 0x10 write, recorded only, the model doesn't know what it does
+} bm13xx_sim_stats_t;
+
+#define BM13XX_SIM_CONFIG_DEFAULT() { \
+    .chip_id = 0x1370, \
+    .chip_count = 1, \
+    .zero_bits = 16, \
+    .hashes_per_poll = 4096, \
+    .crc_error_rate = 0.0f, \
+    .latency_us = 0, \
+    .latency_jitter_us = 0, \
+    .seed = 1, \
+}
+
+bool bm13xx_sim_init(const bm13xx_sim_config_t * config);
+
+// Feed bytes sent by the host, frames may be split over several calls
+void bm13xx_sim_write(const uint8_t * data, int len, uint64_t now_us);
+
+// Copy up to len bytes of responses that are ready at now_us, returns the byte count
+int bm13xx_sim_read(uint8_t * buf, int len, uint64_t now_us);
+
+// Hash the current job for up to hashes_per_poll nonces, returns true if a nonce was queued
+bool bm13xx_sim_poll(uint64_t now_us);
+
+// Time the next queued response becomes readable, UINT64_MAX if none is queued
+uint64_t bm13xx_sim_next_ready_us(void);
+
+bool bm13xx_sim_has_job(void);
+
+// Change the injected crc error rate, e.g. to model a link that is too fast for the board
+void bm13xx_sim_set_crc_error_rate(float crc_error_rate);
+
+// Drop queued responses, like flushing the UART RX buffer
+void bm13xx_sim_flush(void);
+const bm13xx_sim_stats_t * bm13xx_sim_stats(void);
+
+#endif /* BM13XX_SIM_H_ */
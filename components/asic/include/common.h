@@ -21,20 +21,33 @@ typedef struct
 {
     // -- job result response
     uint8_t job_id;
+    uint32_t dispatch_seq;  // of the job the nonce was looked up against
     uint32_t nonce;
     uint32_t rolled_version;
+    uint8_t core_id;
+    uint8_t small_core_id;  // or midstate index on the BM1397
     // ---- register response
     register_type_t register_type;
     uint8_t asic_nr;
     uint32_t value;
 } task_result;
 
+typedef struct
+{
+    uint32_t frames;        // valid frames parsed
+    uint32_t crc_errors;    // frames dropped on a CRC mismatch
+    uint32_t resync_bytes;  // bytes skipped while searching for a preamble
+} rx_stats_t;
+
 
 unsigned char _reverse_bits(unsigned char num);
 int _largest_power_of_two(int num);
 
 int count_asic_chips(uint16_t asic_count, uint16_t chip_id, int chip_id_response_length);
 esp_err_t receive_work(uint8_t * buffer, int buffer_size);
-void get_difficulty_mask(uint16_t difficulty, uint8_t *job_difficulty_mask);
+// Discards the buffered bytes before the next frame is parsed
+void receive_work_reset(void);
+const rx_stats_t * receive_work_stats(void);
+void get_difficulty_mask(uint32_t difficulty, uint8_t *job_difficulty_mask);
 
 #endif /* COMMON_H_ */
@@ -2,29 +2,140 @@
 #define FREQUENCY_TRANSITION_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 extern const char *FREQUENCY_TRANSITION_TAG;
 
 /**
  * @brief Function pointer type for ASIC hash frequency setting functions
- * 
+ *
  * This type defines the signature for functions that set the hash frequency
  * for different ASIC types.
- * 
+ *
  * @param frequency The frequency to set in MHz
  */
 typedef void (*set_hash_frequency_fn)(float frequency);
 
+/**
+ * @brief Counter rates of one chip, measured while the ramp holds a step
+ */
+typedef struct {
+    float hashrate;          // GH/s from the total hash counter
+    float domain_hashrate;   // GH/s of the slowest hash domain times the domain count, negative without domain counters
+    float error_rate;        // GH/s from the error counter
+    uint32_t ticks;          // total counter increments per hash domain, low counts are too noisy to judge
+} frequency_ramp_sample_t;
+
+/**
+ * @brief Function pointer type for the ramp feedback
+ *
+ * Fills one sample per chip with the counter rates since the previous call.
+ *
+ * @param ctx Context given to frequency_ramp_set_feedback
+ * @param samples Array of asic_count samples to fill
+ * @param asic_count Number of chips on the chain
+ * @return false if the counters couldn't be read or there's no previous call to measure from
+ */
+typedef bool (*frequency_ramp_sample_fn)(void * ctx, frequency_ramp_sample_t * samples, uint16_t asic_count);
+
+/**
+ * @brief Frequency state of one chip
+ */
+typedef struct {
+    float frequency;         // MHz currently programmed
+    float limit;             // MHz the chip degraded at on its last closed loop ramp, 0 if it never did
+    float hashrate;          // GH/s at the last checked step
+    float error_rate;        // GH/s of errors at the last checked step
+} chip_frequency_t;
+
+/**
+ * @brief Telemetry of the last frequency ramp
+ */
+typedef struct {
+    float start_frequency;
+    float target_frequency;
+    float frequency;         // MHz reached, below the target after a back off
+    uint16_t steps;
+    uint16_t checked_steps;  // steps judged on counter feedback
+    uint16_t backoffs;
+    uint32_t duration_ms;
+    bool closed_loop;
+    bool in_progress;
+} frequency_ramp_stats_t;
+
+/**
+ * @brief Reset the per chip state to the power on frequency
+ *
+ * Call whenever the chips are reset, they come back at their default PLL setting.
+ *
+ * @param asic_count Number of chips on the chain
+ */
+void frequency_ramp_init(uint16_t asic_count);
+
+/**
+ * @brief Register the feedback used by ramps while the chips are hashing
+ *
+ * @param sample_fn Function reading the chip counters, NULL ramps open loop
+ * @param ctx Context handed to sample_fn
+ */
+void frequency_ramp_set_feedback(frequency_ramp_sample_fn sample_fn, void * ctx);
+
 /**
  * @brief Transition the ASIC frequency to a target value
- * 
- * This function gradually adjusts the ASIC frequency to reach the target value,
- * stepping up or down in increments to ensure stability.
- * 
+ *
+ * Steps towards the target, holding each step long enough for the frequency to
+ * settle. Going up with feedback registered, every step is judged on the chip
+ * counters, held long enough for the slowest chip to count enough increments:
+ * steps grow while the chips keep up, and the ramp backs off to the last good
+ * step and stops when the error rate rises, the hashrate per MHz of a chip or
+ * hash domain drops, or the counters of a chip stall. A step that can't be
+ * judged on every chip is taken at the smallest size. Without feedback it ramps
+ * blind in fixed steps.
+ *
  * @param target_frequency The target frequency in MHz
  * @param set_frequency_fn Function pointer to the appropriate ASIC's set_hash_frequency function
- * @param asic_type The type of ASIC chip (for logging purposes only)
+ * @param closed_loop Use the registered feedback, only valid while the chips are hashing
+ * @return The frequency reached in MHz
+ */
+float do_frequency_transition(float target_frequency, set_hash_frequency_fn set_frequency_fn, bool closed_loop);
+
+/**
+ * @brief Program a frequency in one go, for chips that can't ramp
+ *
+ * @param frequency The frequency in MHz
+ * @param set_frequency_fn Function pointer to the appropriate ASIC's set_hash_frequency function
+ */
+void frequency_ramp_set_frequency(float frequency, set_hash_frequency_fn set_frequency_fn);
+
+/**
+ * @brief Record the frequency of a single chip programmed off the chain frequency
+ *
+ * The next ramp moves every chip from the chain frequency again.
+ *
+ * @param asic_nr Chip on the chain
+ * @param frequency The frequency in MHz
+ */
+void frequency_ramp_set_chip_frequency(uint8_t asic_nr, float frequency);
+
+/**
+ * @brief Keep ramps from starting while single chips are moved off the chain frequency
+ *
+ * A ramp programs every chip, so it waits until frequency_ramp_unlock.
+ *
+ * @return false if a ramp is running, the chips mustn't be touched
+ */
+bool frequency_ramp_try_lock(void);
+
+void frequency_ramp_unlock(void);
+
+const frequency_ramp_stats_t * frequency_ramp_stats(void);
+
+/**
+ * @brief Per chip frequency state
+ *
+ * @param asic_count Set to the number of entries
+ * @return Array of chip states, NULL before frequency_ramp_init
  */
-void do_frequency_transition(float target_frequency, set_hash_frequency_fn set_frequency_fn);
+const chip_frequency_t * frequency_ramp_chips(uint16_t * asic_count);
 
 #endif // FREQUENCY_TRANSITION_H
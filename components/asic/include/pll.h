@@ -6,8 +6,22 @@
 
 #define FREQ_MULT 25.0 // MHz
 
+/**
+ * @brief Find the PLL settings closest to a target frequency
+ *
+ * Looks the target up in a table of every solution for the feedback divider
+ * range, built on first use. Picks the same settings as pll_search_parameters.
+ */
 void pll_get_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_divider_max, 
                         uint8_t *fb_divider, uint8_t *refdiv, uint8_t *postdiv1, uint8_t *postdiv2,
                         float *actual_freq);
 
+// Build the table for a feedback divider range ahead of the first lookup
+void pll_prepare_table(uint16_t fb_divider_min, uint16_t fb_divider_max);
+
+// Brute force search over every divider combination, the reference for the table
+void pll_search_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_divider_max,
+                           uint8_t *fb_divider, uint8_t *refdiv, uint8_t *postdiv1, uint8_t *postdiv2,
+                           float *actual_freq);
+
 #endif /* PLL_H_ */
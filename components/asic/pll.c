@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdlib.h>
 #include <float.h>
 #include <math.h>
 
@@ -8,11 +9,46 @@
 
 #define EPSILON 0.0001f
 
+// Every solution the search can pick lies within half a feedback step of
+// the target, the step is largest for the smallest divider (1 * 2 * 1)
+#define MAX_RADIUS (FREQ_MULT / 2 / 2 + 0.01)
+// Distinct PLL frequencies are at least 25 / 84^2 MHz apart, anything this much
+// further out than the nearest solution can't win a tie
+#define TIE_MARGIN 0.01f
+
+// Upper bound of (refdiv, postdiv1, postdiv2) combinations the search tries
+#define MAX_CANDIDATES 98
+
 static const char * TAG = "pll";
 
-void pll_get_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_divider_max, 
-                        uint8_t *fb_divider, uint8_t *refdiv, uint8_t *postdiv1, uint8_t *postdiv2,
-                        float *actual_freq) 
+typedef struct {
+    float freq;
+    uint8_t fb_divider;
+    uint8_t refdiv;
+    uint8_t postdiv1;
+    uint8_t postdiv2;
+} pll_entry_t;
+
+// Every solution for one feedback divider range, sorted by frequency
+static pll_entry_t * table;
+static int table_size;
+static uint16_t table_fb_min;
+static uint16_t table_fb_max;
+
+typedef struct {
+    float freq;
+    float min_diff;
+    float min_vco_freq;
+    uint16_t min_postdiv;
+    uint8_t fb_divider;
+    uint8_t refdiv;
+    uint8_t postdiv1;
+    uint8_t postdiv2;
+} pll_choice_t;
+
+void pll_search_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_divider_max,
+                           uint8_t *fb_divider, uint8_t *refdiv, uint8_t *postdiv1, uint8_t *postdiv2,
+                           float *actual_freq)
 {
     float best_freq = 0;
     uint8_t best_refdiv = 0, best_fb_divider = 0, best_postdiv1 = 0, best_postdiv2 = 0;
@@ -30,7 +66,7 @@ void pll_get_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_
                     float new_freq = FREQ_MULT * fb_divider / divider;
                     float curr_diff = fabs(target_freq - new_freq);
                     float vco_freq = FREQ_MULT * fb_divider / refdiv;
-                    // Prioritize: 
+                    // Prioritize:
                     // 1. Closest frequency to target
                     // 2. Lowest VCO frequency
                     // 3. Lowest postdiv1 * postdiv2
@@ -51,11 +87,197 @@ void pll_get_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_
         }
     }
 
-    ESP_LOGI(TAG, "Frequency: %g MHz (fb_divider: %d, refdiv: %d, postdiv1: %d, postdiv2: %d)", best_freq, best_fb_divider, best_refdiv, best_postdiv1, best_postdiv2);
-
     *actual_freq = best_freq;
     *fb_divider = best_fb_divider;
     *refdiv = best_refdiv;
     *postdiv1 = best_postdiv1;
     *postdiv2 = best_postdiv2;
 }
+
+// Position of the combination in the search loops, ties go to whichever comes first
+static int search_order(const pll_entry_t * entry)
+{
+    return ((2 - entry->refdiv) * 7 + (7 - entry->postdiv1)) * 7 + (7 - entry->postdiv2);
+}
+
+static int compare_entries(const void * a, const void * b)
+{
+    const pll_entry_t * entry_a = a;
+    const pll_entry_t * entry_b = b;
+
+    if (entry_a->freq != entry_b->freq) {
+        return entry_a->freq < entry_b->freq ? -1 : 1;
+    }
+    return search_order(entry_a) - search_order(entry_b);
+}
+
+static bool build_table(uint16_t fb_divider_min, uint16_t fb_divider_max)
+{
+    if (fb_divider_max > UINT8_MAX || fb_divider_min > fb_divider_max) {
+        return false;
+    }
+
+    int size = 0;
+    for (uint8_t refdiv = 2; refdiv > 0; refdiv--) {
+        for (uint8_t postdiv1 = 7; postdiv1 > 0; postdiv1--) {
+            for (uint8_t postdiv2 = postdiv1 - 1; postdiv2 > 0; postdiv2--) {
+                size += fb_divider_max - fb_divider_min + 1;
+            }
+        }
+    }
+
+    pll_entry_t * entries = malloc(size * sizeof(pll_entry_t));
+    if (entries == NULL) {
+        ESP_LOGW(TAG, "Not enough memory for the PLL table, searching instead");
+        return false;
+    }
+
+    pll_entry_t * entry = entries;
+    for (uint8_t refdiv = 2; refdiv > 0; refdiv--) {
+        for (uint8_t postdiv1 = 7; postdiv1 > 0; postdiv1--) {
+            for (uint8_t postdiv2 = postdiv1 - 1; postdiv2 > 0; postdiv2--) {
+                uint16_t divider = refdiv * postdiv1 * postdiv2;
+                for (uint16_t fb_divider = fb_divider_min; fb_divider <= fb_divider_max; fb_divider++) {
+                    *entry++ = (pll_entry_t) {
+                        .freq = FREQ_MULT * fb_divider / divider,
+                        .fb_divider = fb_divider,
+                        .refdiv = refdiv,
+                        .postdiv1 = postdiv1,
+                        .postdiv2 = postdiv2,
+                    };
+                }
+            }
+        }
+    }
+    qsort(entries, size, sizeof(pll_entry_t), compare_entries);
+
+    free(table);
+    table = entries;
+    table_size = size;
+    table_fb_min = fb_divider_min;
+    table_fb_max = fb_divider_max;
+
+    ESP_LOGI(TAG, "PLL table: %d solutions for feedback dividers %u-%u", size, fb_divider_min, fb_divider_max);
+    return true;
+}
+
+// The search only tries the rounded feedback divider of every divider
+static bool is_candidate(const pll_entry_t * entry, float target_freq)
+{
+    uint16_t divider = entry->refdiv * entry->postdiv1 * entry->postdiv2;
+    uint16_t fb_divider = round(target_freq / FREQ_MULT * divider);
+    return fb_divider == entry->fb_divider;
+}
+
+// Same comparison as the search
+static void consider(pll_choice_t * best, float target_freq, const pll_entry_t * entry)
+{
+    uint16_t divider = entry->refdiv * entry->postdiv1 * entry->postdiv2;
+    float new_freq = FREQ_MULT * entry->fb_divider / divider;
+    float curr_diff = fabs(target_freq - new_freq);
+    float vco_freq = FREQ_MULT * entry->fb_divider / entry->refdiv;
+
+    if (curr_diff < best->min_diff ||
+       (fabs(curr_diff - best->min_diff) < EPSILON && vco_freq < best->min_vco_freq) ||
+       (fabs(curr_diff - best->min_diff) < EPSILON && fabs(vco_freq - best->min_vco_freq) < EPSILON && entry->postdiv1 * entry->postdiv2 < best->min_postdiv)) {
+        best->min_diff = curr_diff;
+        best->min_vco_freq = vco_freq;
+        best->min_postdiv = entry->postdiv1 * entry->postdiv2;
+        best->freq = new_freq;
+        best->fb_divider = entry->fb_divider;
+        best->refdiv = entry->refdiv;
+        best->postdiv1 = entry->postdiv1;
+        best->postdiv2 = entry->postdiv2;
+    }
+}
+
+// Binary search for the target, then only the solutions close enough to
+// win go through the search's comparison, in the search's order.
+static void lookup(float target_freq, pll_choice_t * best)
+{
+    int first = 0;
+    for (int last = table_size; first < last; ) {
+        int mid = (first + last) / 2;
+        if (table[mid].freq < target_freq) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+
+    // The closest solution of every divider is a candidate, this ends within a few entries
+    float nearest = FLT_MAX;
+    for (int i = first; i < table_size && table[i].freq - target_freq <= fminf(nearest + TIE_MARGIN, MAX_RADIUS); i++) {
+        if (is_candidate(&table[i], target_freq)) {
+            nearest = fminf(nearest, table[i].freq - target_freq);
+        }
+    }
+    for (int i = first - 1; i >= 0 && target_freq - table[i].freq <= fminf(nearest + TIE_MARGIN, MAX_RADIUS); i--) {
+        if (is_candidate(&table[i], target_freq)) {
+            nearest = fminf(nearest, target_freq - table[i].freq);
+        }
+    }
+    if (nearest == FLT_MAX) {
+        return;
+    }
+
+    const pll_entry_t * candidates[MAX_CANDIDATES];
+    int count = 0;
+    for (int i = first; i < table_size && table[i].freq - target_freq <= nearest + TIE_MARGIN; i++) {
+        if (count < MAX_CANDIDATES && is_candidate(&table[i], target_freq)) {
+            candidates[count++] = &table[i];
+        }
+    }
+    for (int i = first - 1; i >= 0 && target_freq - table[i].freq <= nearest + TIE_MARGIN; i--) {
+        if (count < MAX_CANDIDATES && is_candidate(&table[i], target_freq)) {
+            candidates[count++] = &table[i];
+        }
+    }
+
+    // Insertion sort by search order, there are only a handful
+    for (int i = 1; i < count; i++) {
+        const pll_entry_t * candidate = candidates[i];
+        int j = i;
+        for (; j > 0 && search_order(candidates[j - 1]) > search_order(candidate); j--) {
+            candidates[j] = candidates[j - 1];
+        }
+        candidates[j] = candidate;
+    }
+
+    for (int i = 0; i < count; i++) {
+        consider(best, target_freq, candidates[i]);
+    }
+}
+
+void pll_prepare_table(uint16_t fb_divider_min, uint16_t fb_divider_max)
+{
+    if (table == NULL || table_fb_min != fb_divider_min || table_fb_max != fb_divider_max) {
+        build_table(fb_divider_min, fb_divider_max);
+    }
+}
+
+void pll_get_parameters(float target_freq, uint16_t fb_divider_min, uint16_t fb_divider_max,
+                        uint8_t *fb_divider, uint8_t *refdiv, uint8_t *postdiv1, uint8_t *postdiv2,
+                        float *actual_freq)
+{
+    pll_prepare_table(fb_divider_min, fb_divider_max);
+    if (table == NULL || table_fb_min != fb_divider_min || table_fb_max != fb_divider_max) {
+        pll_search_parameters(target_freq, fb_divider_min, fb_divider_max, fb_divider, refdiv, postdiv1, postdiv2, actual_freq);
+        return;
+    }
+
+    pll_choice_t best = {
+        .min_diff = FLT_MAX,
+        .min_vco_freq = FLT_MAX,
+        .min_postdiv = UINT16_MAX,
+    };
+    lookup(target_freq, &best);
+
+    ESP_LOGD(TAG, "Frequency: %g MHz (fb_divider: %d, refdiv: %d, postdiv1: %d, postdiv2: %d)", best.freq, best.fb_divider, best.refdiv, best.postdiv1, best.postdiv2);
+
+    *actual_freq = best.freq;
+    *fb_divider = best.fb_divider;
+    *refdiv = best.refdiv;
+    *postdiv1 = best.postdiv1;
+    *postdiv2 = best.postdiv2;
+}
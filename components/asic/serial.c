@@ -10,14 +10,18 @@
 #include "soc/uart_struct.h"
 
 #include "serial.h"
+#include "common.h"
 #include "utils.h"
 
 #define ECHO_TEST_TXD (17)
 #define ECHO_TEST_RXD (18)
 #define BUF_SIZE (1024)
+#define EVENT_QUEUE_SIZE (16)
 
 static const char *TAG = "serial";
 
+static QueueHandle_t uart_event_queue;
+
 esp_err_t SERIAL_init(void)
 {
     ESP_LOGI(TAG, "Initializing serial");
@@ -35,10 +39,8 @@ esp_err_t SERIAL_init(void)
     // Set UART1 pins(TX: IO17, RX: I018)
     ESP_ERROR_CHECK_WITHOUT_ABORT(uart_set_pin(UART_NUM_1, ECHO_TEST_TXD, ECHO_TEST_RXD, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
-    // Install UART driver (we don't need an event queue here)
-    // tx buffer 0 so the tx time doesn't overlap with the job wait time
-    //  by returning before the job is written
-    return uart_driver_install(UART_NUM_1, BUF_SIZE * 2, BUF_SIZE * 2, 0, NULL, 0);
+    // Install UART driver, the event queue wakes the result stream reader on RX data
+    return uart_driver_install(UART_NUM_1, BUF_SIZE * 2, BUF_SIZE * 2, EVENT_QUEUE_SIZE, &uart_event_queue, 0);
 }
 
 bool SERIAL_is_initialized(void)
@@ -78,7 +80,7 @@ int16_t SERIAL_rx(uint8_t *buf, uint16_t size, uint16_t timeout_ms)
 {
     int16_t bytes_read = uart_read_bytes(UART_NUM_1, buf, size, timeout_ms / portTICK_PERIOD_MS);
 
-    #if BM1397_SERIALRX_DEBUG || BM1366_SERIALRX_DEBUG || BM1368_SERIALRX_DEBUG || BM1370_SERIALRX_DEBUG
+    #if BM13XX_SERIALRX_DEBUG
     size_t buff_len = 0;
     if (bytes_read > 0) {
         uart_get_buffered_data_len(UART_NUM_1, &buff_len);
@@ -91,6 +93,61 @@ int16_t SERIAL_rx(uint8_t *buf, uint16_t size, uint16_t timeout_ms)
     return bytes_read;
 }
 
+/// @brief waits until RX data is available and reads what is buffered, without waiting for a full frame
+/// @param buf buffer to read data into
+/// @param size maximum number of bytes to read
+/// @param timeout_ms number of ms to wait for data before timing out
+/// @return number of bytes read, 0 on timeout, or -1 on error
+int16_t SERIAL_rx_stream(uint8_t *buf, uint16_t size, uint16_t timeout_ms)
+{
+    if (uart_event_queue == NULL) {
+        return SERIAL_rx(buf, size, timeout_ms);
+    }
+
+    size_t buffered = 0;
+    uart_get_buffered_data_len(UART_NUM_1, &buffered);
+
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    while (buffered == 0) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        uart_event_t event;
+        if (elapsed >= timeout || xQueueReceive(uart_event_queue, &event, timeout - elapsed) != pdTRUE) {
+            return 0;
+        }
+
+        switch (event.type) {
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                // The driver requires a flush here, the parser resyncs on the next preamble
+                ESP_LOGW(TAG, "UART RX overflow, flushing");
+                uart_flush_input(UART_NUM_1);
+                xQueueReset(uart_event_queue);
+                break;
+            default:
+                break;
+        }
+
+        uart_get_buffered_data_len(UART_NUM_1, &buffered);
+    }
+
+    if (buffered > size) {
+        buffered = size;
+    }
+
+    int16_t bytes_read = uart_read_bytes(UART_NUM_1, buf, buffered, 0);
+
+    #if BM13XX_SERIALRX_DEBUG
+    if (bytes_read > 0) {
+        printf("rx: ");
+        prettyHex((unsigned char*) buf, bytes_read);
+        printf("\n");
+    }
+    #endif
+
+    return bytes_read;
+}
+
 void SERIAL_debug_rx(void)
 {
     int ret;
@@ -109,4 +166,8 @@ void SERIAL_debug_rx(void)
 void SERIAL_clear_buffer(void)
 {
     uart_flush(UART_NUM_1);
+    if (uart_event_queue != NULL) {
+        xQueueReset(uart_event_queue);
+    }
+    receive_work_reset();
 }
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+
+#include "serial.h"
+#include "common.h"
+#include "bm13xx_sim.h"
+#include "utils.h"
+
+// Stand-in for serial.c on host (linux target) builds, the chain is the
+// software model in bm13xx_sim.c. It is configured from the environment:
+//   BM13XX_SIM_CHIP             chip id in hex, 1366, 1368, 1370 or 1397 (default 1370)
+//   BM13XX_SIM_CHIPS            chips on the chain (default 1)
+//   BM13XX_SIM_ZERO_BITS        nonce difficulty in leading zero bits, 0 follows the ticket mask (default 16)
+//   BM13XX_SIM_HASHES_PER_POLL  hashes computed per wait step (default 4096)
+//   BM13XX_SIM_CRC_ERROR_RATE   fraction of responses with a corrupted crc (default 0)
+//   BM13XX_SIM_LATENCY_US       response latency (default 0)
+//   BM13XX_SIM_JITTER_US        random extra latency (default 0)
+//   BM13XX_SIM_SEED             seed of the error and jitter generator (default 1)
+//   BM13XX_SIM_MAX_BAUD         fastest rate the link carries, half the responses are corrupted above it (default none)
+
+static const char *TAG = "serial_sim";
+
+static SemaphoreHandle_t sim_lock;
+static int baud_rate;
+static int max_baud;
+static float crc_error_rate;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned long env_ulong(const char * name, unsigned long fallback, int base)
+{
+    const char * value = getenv(name);
+    return value != NULL && *value != '\0' ? strtoul(value, NULL, base) : fallback;
+}
+
+static float env_float(const char * name, float fallback)
+{
+    const char * value = getenv(name);
+    return value != NULL && *value != '\0' ? strtof(value, NULL) : fallback;
+}
+
+esp_err_t SERIAL_init(void)
+{
+    bm13xx_sim_config_t config = BM13XX_SIM_CONFIG_DEFAULT();
+    config.chip_id = env_ulong("BM13XX_SIM_CHIP", config.chip_id, 16);
+    config.chip_count = env_ulong("BM13XX_SIM_CHIPS", config.chip_count, 10);
+    config.zero_bits = env_ulong("BM13XX_SIM_ZERO_BITS", config.zero_bits, 10);
+    config.hashes_per_poll = env_ulong("BM13XX_SIM_HASHES_PER_POLL", config.hashes_per_poll, 10);
+    config.crc_error_rate = env_float("BM13XX_SIM_CRC_ERROR_RATE", config.crc_error_rate);
+    config.latency_us = env_ulong("BM13XX_SIM_LATENCY_US", config.latency_us, 10);
+    config.latency_jitter_us = env_ulong("BM13XX_SIM_JITTER_US", config.latency_jitter_us, 10);
+    config.seed = env_ulong("BM13XX_SIM_SEED", config.seed, 10);
+    max_baud = env_ulong("BM13XX_SIM_MAX_BAUD", 0, 10);
+    crc_error_rate = config.crc_error_rate;
+
+    ESP_LOGI(TAG, "Simulating %d x BM%04X, %d zero bits, %.4f crc error rate, %lu us latency",
+             config.chip_count, config.chip_id, config.zero_bits, config.crc_error_rate, (unsigned long) config.latency_us);
+
+    if (sim_lock == NULL) {
+        sim_lock = xSemaphoreCreateMutex();
+        if (sim_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (!bm13xx_sim_init(&config)) {
+        ESP_LOGE(TAG, "Unsupported simulator config");
+        return ESP_ERR_INVALID_ARG;
+    }
+    baud_rate = UART_FREQ;
+    return ESP_OK;
+}
+
+bool SERIAL_is_initialized(void)
+{
+    return sim_lock != NULL;
+}
+
+esp_err_t SERIAL_set_baud(int baud)
+{
+    ESP_LOGI(TAG, "Changing UART baud to %i", baud);
+    baud_rate = baud;
+
+    xSemaphoreTake(sim_lock, portMAX_DELAY);
+    bm13xx_sim_set_crc_error_rate(max_baud > 0 && baud > max_baud ? 0.5f : crc_error_rate);
+    xSemaphoreGive(sim_lock);
+    return ESP_OK;
+}
+
+int SERIAL_send(uint8_t *data, int len, bool debug)
+{
+    if (debug)
+    {
+        printf("tx: ");
+        prettyHex((unsigned char *)data, len);
+        printf("\n");
+    }
+
+    xSemaphoreTake(sim_lock, portMAX_DELAY);
+    bm13xx_sim_write(data, len, now_us());
+    xSemaphoreGive(sim_lock);
+    return len;
+}
+
+// Read what the model has ready, hashing while nothing is. Returns once
+// min_bytes are read or the timeout expires, like uart_read_bytes.
+static int16_t sim_rx(uint8_t *buf, uint16_t size, uint16_t min_bytes, uint16_t timeout_ms)
+{
+    uint64_t deadline = now_us() + (uint64_t) timeout_ms * 1000;
+    int16_t bytes_read = 0;
+
+    for (;;) {
+        xSemaphoreTake(sim_lock, portMAX_DELAY);
+        uint64_t now = now_us();
+        bytes_read += bm13xx_sim_read(buf + bytes_read, size - bytes_read, now);
+        bool found = bytes_read < min_bytes && bm13xx_sim_poll(now);
+        xSemaphoreGive(sim_lock);
+
+        if (bytes_read >= min_bytes || now >= deadline) {
+            break;
+        }
+        if (!found) {
+            // Yield to the other tasks, the model hashes again on the next tick
+            vTaskDelay(1);
+        }
+    }
+
+    #if BM13XX_SERIALRX_DEBUG
+    if (bytes_read > 0) {
+        printf("rx: ");
+        prettyHex((unsigned char*) buf, bytes_read);
+        printf("\n");
+    }
+    #endif
+
+    return bytes_read;
+}
+
+/// @brief waits for a serial response from the device
+/// @param buf buffer to read data into
+/// @param buf number of ms to wait before timing out
+/// @return number of bytes read, or -1 on error
+int16_t SERIAL_rx(uint8_t *buf, uint16_t size, uint16_t timeout_ms)
+{
+    return sim_rx(buf, size, size, timeout_ms);
+}
+
+/// @brief waits until RX data is available and reads what is buffered, without waiting for a full frame
+/// @param buf buffer to read data into
+/// @param size maximum number of bytes to read
+/// @param timeout_ms number of ms to wait for data before timing out
+/// @return number of bytes read, 0 on timeout, or -1 on error
+int16_t SERIAL_rx_stream(uint8_t *buf, uint16_t size, uint16_t timeout_ms)
+{
+    return sim_rx(buf, size, 1, timeout_ms);
+}
+
+void SERIAL_debug_rx(void)
+{
+    uint8_t buf[100];
+    SERIAL_rx(buf, 100, 20);
+}
+
+void SERIAL_clear_buffer(void)
+{
+    xSemaphoreTake(sim_lock, portMAX_DELAY);
+    bm13xx_sim_flush();
+    xSemaphoreGive(sim_lock);
+    receive_work_reset();
+}
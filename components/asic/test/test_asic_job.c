@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include "unity.h"
+
+#include "asic_task.h"
+
+static bm_job * new_job(uint32_t dispatch_seq)
+{
+    bm_job *job = calloc(1, sizeof(bm_job));
+    job->dispatch_seq = dispatch_seq;
+    return job;
+}
+
+static void free_jobs(AsicTaskModule *module)
+{
+    for (int i = 0; i < ASIC_JOB_SLOTS; i++) {
+        if (module->jobs[i].job != NULL) {
+            free_bm_job(module->jobs[i].job);
+        }
+    }
+    if (module->retired_job != NULL) {
+        free_bm_job(module->retired_job);
+    }
+}
+
+TEST_CASE("Job slots return the job last stored under an id", "[asic_job]")
+{
+    AsicTaskModule module = {0};
+    uint32_t dispatch_seq;
+
+    TEST_ASSERT_NULL(asic_job_lookup(&module, 8, &dispatch_seq));
+
+    bm_job *job = new_job(1);
+    asic_job_store(&module, 8, job);
+    TEST_ASSERT_EQUAL_PTR(job, asic_job_lookup(&module, 8, &dispatch_seq));
+    TEST_ASSERT_EQUAL_UINT32(1, dispatch_seq);
+    TEST_ASSERT_TRUE(asic_job_unchanged(&module, 8, dispatch_seq));
+
+    // Ids the result frames can't carry
+    TEST_ASSERT_NULL(asic_job_lookup(&module, 9, &dispatch_seq));
+    TEST_ASSERT_NULL(asic_job_lookup(&module, 136, &dispatch_seq));
+
+    // A clean job drops everything sent before it
+    asic_job_invalidate_all(&module);
+    TEST_ASSERT_NULL(asic_job_lookup(&module, 8, &dispatch_seq));
+    TEST_ASSERT_FALSE(asic_job_unchanged(&module, 8, 1));
+
+    free_jobs(&module);
+}
+
+TEST_CASE("A replaced job is kept until the result task moves on", "[asic_job]")
+{
+    AsicTaskModule module = {0};
+    uint32_t dispatch_seq;
+
+    bm_job *first = new_job(1);
+    asic_job_store(&module, 0, first);
+    TEST_ASSERT_EQUAL_PTR(first, asic_job_lookup(&module, 0, &dispatch_seq));
+
+    // The slot is reused while the result task still checks a nonce of the first job
+    bm_job *second = new_job(2);
+    asic_job_store(&module, 0, second);
+    TEST_ASSERT_EQUAL_PTR(first, module.retired_job);
+    TEST_ASSERT_FALSE(asic_job_unchanged(&module, 0, dispatch_seq));
+
+    // Jobs nobody holds are freed as they are replaced
+    asic_job_store(&module, 4, new_job(3));
+    asic_job_store(&module, 4, new_job(4));
+    TEST_ASSERT_EQUAL_PTR(first, module.retired_job);
+
+    // Once the result task has looked up another job, the next store frees the first
+    TEST_ASSERT_EQUAL_PTR(second, asic_job_lookup(&module, 0, &dispatch_seq));
+    asic_job_store(&module, 8, new_job(5));
+    TEST_ASSERT_NULL(module.retired_job);
+
+    free_jobs(&module);
+}
+
+TEST_CASE("Duplicate results are found per dispatch", "[asic_job]")
+{
+    AsicTaskModule module = {0};
+
+    TEST_ASSERT_FALSE(asic_job_seen(&module, 4, 1, 0x1234, 0x20000000));
+    TEST_ASSERT_TRUE(asic_job_seen(&module, 4, 1, 0x1234, 0x20000000));
+    TEST_ASSERT_FALSE(asic_job_seen(&module, 4, 1, 0x1234, 0x20002000));
+
+    // A reused slot starts over
+    TEST_ASSERT_FALSE(asic_job_seen(&module, 4, 2, 0x1234, 0x20000000));
+
+    // Only the last ASIC_JOB_RESULTS results are remembered
+    for (uint32_t nonce = 0; nonce < ASIC_JOB_RESULTS; nonce++) {
+        TEST_ASSERT_FALSE(asic_job_seen(&module, 8, 3, nonce, 0));
+    }
+    TEST_ASSERT_TRUE(asic_job_seen(&module, 8, 3, 0, 0));
+    TEST_ASSERT_FALSE(asic_job_seen(&module, 8, 3, ASIC_JOB_RESULTS, 0));
+    TEST_ASSERT_FALSE(asic_job_seen(&module, 8, 3, 0, 0));
+}
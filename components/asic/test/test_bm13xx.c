@@ -0,0 +1,30 @@
+#include "unity.h"
+
+#include "bm13xx.h"
+#include "common.h"
+
+TEST_CASE("Chip addresses give every address byte to exactly one chip", "[bm13xx]")
+{
+    for (int chip_count = 1; chip_count <= 256; chip_count++) {
+        int asic_nr = 0;
+        for (int address = 0; address < 256; address++) {
+            // The byte belongs to the chip with the highest address at or below it
+            if (asic_nr + 1 < chip_count && BM13XX_chip_address(asic_nr + 1, chip_count) == address) {
+                asic_nr++;
+            }
+            TEST_ASSERT_EQUAL_UINT16(asic_nr, BM13XX_chip_number(address, chip_count));
+        }
+        TEST_ASSERT_EQUAL_INT(chip_count - 1, asic_nr);
+        TEST_ASSERT_EQUAL_UINT8(0, BM13XX_chip_address(0, chip_count));
+    }
+}
+
+TEST_CASE("Ticket mask holds difficulties past 16 bits", "[bm13xx]")
+{
+    uint8_t mask[6];
+    get_difficulty_mask(1 << 18, mask);
+
+    // 2^18 - 1 set bits, every byte bit reversed
+    uint8_t expected[6] = {0x00, 0x14, 0x00, 0xC0, 0xFF, 0xFF};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, mask, 6);
+}
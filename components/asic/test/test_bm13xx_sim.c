@@ -0,0 +1,89 @@
+#include <string.h>
+#include "unity.h"
+
+#include "bm13xx.h"
+#include "bm13xx_sim.h"
+#include "common.h"
+#include "crc.h"
+#include "mining.h"
+
+static void send_command(uint8_t header, uint8_t d0, uint8_t d1)
+{
+    uint8_t frame[7] = {0x55, 0xAA, header, 5, d0, d1};
+    frame[6] = crc5(frame + 2, 4);
+    bm13xx_sim_write(frame, sizeof(frame), 0);
+}
+
+TEST_CASE("Simulated chain answers the chip id read with its addresses", "[bm13xx_sim]")
+{
+    bm13xx_sim_config_t config = BM13XX_SIM_CONFIG_DEFAULT();
+    config.chip_count = 2;
+    TEST_ASSERT_TRUE(bm13xx_sim_init(&config));
+
+    send_command(0x53, 0x00, 0x00); // chain inactive
+    send_command(0x40, 0x00, 0x00); // set address 0x00
+    send_command(0x40, 0x80, 0x00); // set address 0x80
+    send_command(0x52, 0x00, 0x00); // read register 0x00 on all chips
+
+    uint8_t rx[22];
+    TEST_ASSERT_EQUAL_INT(22, bm13xx_sim_read(rx, sizeof(rx), 0));
+    for (int i = 0; i < 2; i++) {
+        uint8_t * frame = rx + i * 11;
+        TEST_ASSERT_EQUAL_UINT8(0xAA, frame[0]);
+        TEST_ASSERT_EQUAL_UINT8(0x55, frame[1]);
+        TEST_ASSERT_EQUAL_UINT8(0x13, frame[2]);
+        TEST_ASSERT_EQUAL_UINT8(0x70, frame[3]);
+        TEST_ASSERT_EQUAL_UINT8(i * 0x80, frame[5]);
+        TEST_ASSERT_EQUAL_UINT8(0, crc5(frame + 2, 9));
+    }
+}
+
+TEST_CASE("Simulated chain returns nonces that hash below its target", "[bm13xx_sim]")
+{
+    bm13xx_sim_config_t config = BM13XX_SIM_CONFIG_DEFAULT();
+    config.zero_bits = 8;
+    TEST_ASSERT_TRUE(bm13xx_sim_init(&config));
+    send_command(0x40, 0x00, 0x00);
+
+    bm_job job = {
+        .version = 0x20000000,
+        .ntime = 0x66a1b2c3,
+        .target = 0x1703a30c,
+    };
+    for (int i = 0; i < 32; i++) {
+        job.prev_block_hash[i] = i * 7;
+        job.merkle_root[i] = 255 - i * 3;
+    }
+    // The chip takes the hashes with their 32 bit words in reverse order
+    for (int word = 0; word < 8; word++) {
+        memcpy(job.prev_block_hash_be + word * 4, job.prev_block_hash + (7 - word) * 4, 4);
+        memcpy(job.merkle_root_be + word * 4, job.merkle_root + (7 - word) * 4, 4);
+    }
+
+    uint8_t frame[88] = {0x55, 0xAA, 0x21, 86, 0x18, 0x01};
+    memcpy(frame + 10, &job.target, 4);
+    memcpy(frame + 14, &job.ntime, 4);
+    memcpy(frame + 18, job.merkle_root_be, 32);
+    memcpy(frame + 50, job.prev_block_hash_be, 32);
+    memcpy(frame + 82, &job.version, 4);
+    uint16_t crc = crc16_false(frame + 2, 84);
+    frame[86] = crc >> 8;
+    frame[87] = crc & 0xFF;
+    bm13xx_sim_write(frame, sizeof(frame), 0);
+
+    while (!bm13xx_sim_poll(0)) {
+    }
+
+    uint8_t rx[11];
+    TEST_ASSERT_EQUAL_INT(11, bm13xx_sim_read(rx, sizeof(rx), 0));
+    TEST_ASSERT_EQUAL_UINT8(0, crc5(rx + 2, 9));
+    TEST_ASSERT_EQUAL_UINT8(0x80, rx[10] & 0x80);
+    TEST_ASSERT_EQUAL_UINT8(0x18, (rx[7] & 0xF0) >> 1);
+
+    uint32_t nonce;
+    memcpy(&nonce, rx + 2, 4);
+    uint32_t rolled_version = job.version | (((uint32_t) rx[8] << 8 | rx[9]) << 13);
+
+    // 8 leading zero bits is a difficulty of at least 0xFFFF / 2^40
+    TEST_ASSERT_TRUE(test_nonce_value(&job, nonce, rolled_version) >= 5.9e-8);
+}
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "crc.h"
+
+static const char *TAG = "test_crc";
+
+// Reference bit-serial implementations the table driven versions must match
+
+static uint8_t crc5_bitwise(uint8_t *data, uint8_t len)
+{
+    uint8_t crc = 0x1F;
+
+    for (uint8_t byte_counter = 0; byte_counter < len; byte_counter++) {
+        uint8_t byte = data[byte_counter];
+        for (uint8_t bit_counter = 0; bit_counter < 8; bit_counter++) {
+            uint8_t bit = (byte >> 7) & 1;
+            byte <<= 1;
+
+            uint8_t new_bit = ((crc >> 4) ^ bit) & 1;
+            crc = ((crc << 1) | new_bit) ^ (new_bit << 2);
+            crc &= 0x1F;
+        }
+    }
+
+    return crc;
+}
+
+static uint16_t crc16_false_bytewise(uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc = crc16_table[(crc >> 8) ^ *data++] ^ (crc << 8);
+    }
+
+    return crc;
+}
+
+TEST_CASE("Check CRC5 known command", "[crc]")
+{
+    // read chip id broadcast: 55 AA 52 05 00 00 0A
+    uint8_t cmd[] = {0x52, 0x05, 0x00, 0x00};
+    TEST_ASSERT_EQUAL_HEX8(0x0A, crc5(cmd, sizeof(cmd)));
+}
+
+TEST_CASE("Check CRC16-FALSE check value", "[crc]")
+{
+    uint8_t data[] = "123456789";
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16_false(data, 9));
+}
+
+TEST_CASE("Check CRC5 and CRC16-FALSE match reference for all two byte inputs", "[crc]")
+{
+    uint8_t data[2];
+    for (int i = 0; i < 65536; i++) {
+        data[0] = i >> 8;
+        data[1] = i & 0xFF;
+        TEST_ASSERT_EQUAL_HEX8(crc5_bitwise(data, 2), crc5(data, 2));
+        TEST_ASSERT_EQUAL_HEX16(crc16_false_bytewise(data, 2), crc16_false(data, 2));
+    }
+}
+
+TEST_CASE("Check CRC5 and CRC16-FALSE match reference for every length", "[crc]")
+{
+    uint8_t data[255];
+    srand(1);
+    for (int round = 0; round < 16; round++) {
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = rand();
+        }
+        for (int len = 0; len <= sizeof(data); len++) {
+            TEST_ASSERT_EQUAL_HEX8(crc5_bitwise(data, len), crc5(data, len));
+            TEST_ASSERT_EQUAL_HEX16(crc16_false_bytewise(data, len), crc16_false(data, len));
+        }
+    }
+}
+
+TEST_CASE("Benchmark CRC5 and CRC16-FALSE against reference", "[crc][benchmark]")
+{
+    // Result frame (9 bytes after the preamble) and a BM1366 job frame (84 bytes after the preamble)
+    uint8_t data[84];
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+    const int iterations = 10000;
+    volatile uint32_t sink = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) sink += crc5_bitwise(data, 9);
+    int64_t crc5_reference_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) sink += crc5(data, 9);
+    int64_t crc5_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) sink += crc16_false_bytewise(data, sizeof(data));
+    int64_t crc16_reference_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) sink += crc16_false(data, sizeof(data));
+    int64_t crc16_us = esp_timer_get_time() - start;
+
+    // Timings only, QEMU and a loaded CI runner make them too noisy to assert on
+    ESP_LOGI(TAG, "crc5 9 bytes: %lld us -> %lld us", (long long) crc5_reference_us, (long long) crc5_us);
+    ESP_LOGI(TAG, "crc16_false 84 bytes: %lld us -> %lld us", (long long) crc16_reference_us, (long long) crc16_us);
+}
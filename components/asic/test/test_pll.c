@@ -1,3 +1,4 @@
+#include <math.h>
 #include "unity.h"
 
 #include "pll.h"
@@ -10,9 +11,34 @@ TEST_CASE("Check PLL frequency calculation", "[pll]")
 
     pll_get_parameters(frequency, 60, 200, &fb_divider, &refdiv, &postdiv1, &postdiv2, &actual_freq);
 
-    TEST_ASSERT_EQUAL_UINT8(68, fb_divider);
+    TEST_ASSERT_EQUAL_UINT8(72, fb_divider); // 25 MHz * 72 / (2 * 2 * 1)
     TEST_ASSERT_EQUAL_UINT8(2, refdiv);
     TEST_ASSERT_EQUAL_UINT8(2, postdiv1);
     TEST_ASSERT_EQUAL_UINT8(1, postdiv2);
     TEST_ASSERT_FLOAT_WITHIN(0.01, 450.0, actual_freq);
 }
+
+static void check_table_range(uint16_t fb_divider_min, uint16_t fb_divider_max)
+{
+    // Every 0.01 MHz, plus the points either side of the rounding boundaries
+    for (int step = 0; step <= 100000; step++) {
+        float targets[] = {step * 0.01f, nextafterf(step * 0.01f, 0), nextafterf(step * 0.01f, 2000)};
+        for (int i = 0; i < 3; i++) {
+            uint8_t table[4], search[4];
+            float table_freq, search_freq;
+
+            pll_get_parameters(targets[i], fb_divider_min, fb_divider_max, &table[0], &table[1], &table[2], &table[3], &table_freq);
+            pll_search_parameters(targets[i], fb_divider_min, fb_divider_max, &search[0], &search[1], &search[2], &search[3], &search_freq);
+
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(search, table, 4);
+            TEST_ASSERT_EQUAL_FLOAT(search_freq, table_freq);
+        }
+    }
+}
+
+TEST_CASE("PLL table picks the same settings as the search from 0 to 1000 MHz", "[pll]")
+{
+    check_table_range(60, 200);  // BM1397
+    check_table_range(144, 235); // BM1366, BM1368
+    check_table_range(160, 239); // BM1370
+}
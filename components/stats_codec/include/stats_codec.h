@@ -0,0 +1,68 @@
+#ifndef STATS_CODEC_H_
+#define STATS_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Records of the statistics history. A record is a keyframe with absolute values or
+// a delta against the previous record, every value a zigzag varint. A byte that
+// starts no record, like the 0xFF of erased flash, ends a run of records.
+
+#define RECORD_KEYFRAME 'K'
+#define RECORD_DELTA 'D'
+#define RECORD_EMPTY 0xFF
+
+#define HISTORY_CLOCK_JUMP 60             // seconds the clock may move before a keyframe records it
+
+// The order is part of the format in flash, new columns only go at the end
+typedef enum
+{
+    COL_HASHRATE,
+    COL_ERROR_COUNT,
+    COL_ASIC_TEMP,
+    COL_VR_TEMP,
+    COL_POWER,
+    COL_VOLTAGE,
+    COL_CURRENT,
+    COL_ASIC_VOLTAGE,
+    COL_FAN_SPEED,
+    COL_FAN_RPM,
+    COL_FAN2_RPM,
+    COL_WIFI_RSSI,
+    COL_FREE_HEAP,
+    HISTORY_COLUMNS // last
+} HistoryColumn;
+
+// Tag, boot, uptime and clock, then one value per column, 5 bytes per varint at most
+#define HISTORY_RECORD_MAX (1 + 3 * 5 + HISTORY_COLUMNS * 5)
+
+// One record, or what the next delta refers to
+typedef struct
+{
+    bool keyed;
+    uint32_t boot;
+    uint32_t uptime;
+    uint32_t clock;         // unix time minus uptime, 0 while unknown
+    int32_t values[HISTORY_COLUMNS];
+} HistoryCursor;
+
+// Called for every decoded record. Returning false stops decoding.
+typedef bool (*HistoryRecordCallback)(const HistoryCursor * record, void * ctx);
+
+uint32_t zigzag(int32_t value);
+int32_t unzigzag(uint32_t value);
+size_t putVarint(uint8_t * out, uint32_t value);
+bool getVarint(const uint8_t * in, size_t length, size_t * pos, uint32_t * value);
+
+// Encodes record as a delta against previous where it can, as a keyframe otherwise.
+// Out takes HISTORY_RECORD_MAX bytes, the length is returned.
+size_t encodeRecord(const HistoryCursor * previous, const HistoryCursor * record, uint8_t * out);
+
+// Decodes the records of page from pos on, cursor follows each of them. Returns
+// where decoding stopped: after the record the callback declined, or at the first
+// byte that doesn't start a whole record.
+size_t decodePage(const uint8_t * page, size_t pos, size_t length, HistoryCursor * cursor,
+                  HistoryRecordCallback callback, void * ctx);
+
+#endif // STATS_CODEC_H_
@@ -0,0 +1,113 @@
+#include "stats_codec.h"
+
+uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+int32_t unzigzag(uint32_t value)
+{
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+size_t putVarint(uint8_t * out, uint32_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+bool getVarint(const uint8_t * in, size_t length, size_t * pos, uint32_t * value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 35 && *pos < length; shift += 7) {
+        uint8_t byte = in[(*pos)++];
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        if (0 == (byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool clockJumped(uint32_t previous, uint32_t clock)
+{
+    if ((0 == previous) != (0 == clock)) {
+        return true;
+    }
+    return (previous > clock ? previous - clock : clock - previous) > HISTORY_CLOCK_JUMP;
+}
+
+size_t encodeRecord(const HistoryCursor * previous, const HistoryCursor * record, uint8_t * out)
+{
+    size_t length = 0;
+
+    if (!previous->keyed || record->boot != previous->boot || record->uptime < previous->uptime ||
+        clockJumped(previous->clock, record->clock)) {
+        out[length++] = RECORD_KEYFRAME;
+        length += putVarint(out + length, record->boot);
+        length += putVarint(out + length, record->uptime);
+        length += putVarint(out + length, record->clock);
+        for (int i = 0; i < HISTORY_COLUMNS; i++) {
+            length += putVarint(out + length, zigzag(record->values[i]));
+        }
+    } else {
+        out[length++] = RECORD_DELTA;
+        length += putVarint(out + length, record->uptime - previous->uptime);
+        for (int i = 0; i < HISTORY_COLUMNS; i++) {
+            length += putVarint(out + length, zigzag((int32_t) ((uint32_t) record->values[i] - (uint32_t) previous->values[i])));
+        }
+    }
+
+    return length;
+}
+
+size_t decodePage(const uint8_t * page, size_t pos, size_t length, HistoryCursor * cursor,
+                  HistoryRecordCallback callback, void * ctx)
+{
+    while (pos < length) {
+        size_t start = pos;
+        uint8_t tag = page[pos++];
+        uint32_t value;
+        HistoryCursor next = *cursor;
+
+        if (RECORD_KEYFRAME == tag) {
+            if (!getVarint(page, length, &pos, &next.boot) || !getVarint(page, length, &pos, &next.uptime) ||
+                !getVarint(page, length, &pos, &next.clock)) {
+                return start;
+            }
+            for (int i = 0; i < HISTORY_COLUMNS; i++) {
+                if (!getVarint(page, length, &pos, &value)) {
+                    return start;
+                }
+                next.values[i] = unzigzag(value);
+            }
+            next.keyed = true;
+        } else if (RECORD_DELTA == tag && cursor->keyed) {
+            if (!getVarint(page, length, &pos, &value)) {
+                return start;
+            }
+            next.uptime += value;
+            for (int i = 0; i < HISTORY_COLUMNS; i++) {
+                if (!getVarint(page, length, &pos, &value)) {
+                    return start;
+                }
+                next.values[i] = (int32_t) ((uint32_t) next.values[i] + (uint32_t) unzigzag(value));
+            }
+        } else {
+            // Erased rest of the page, or nothing a cursor can follow
+            return start;
+        }
+
+        *cursor = next;
+        if (!callback(cursor, ctx)) {
+            return pos;
+        }
+    }
+
+    return pos;
+}
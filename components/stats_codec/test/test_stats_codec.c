@@ -0,0 +1,197 @@
+#include <string.h>
+#include "unity.h"
+
+#include "stats_codec.h"
+
+#define PAGE_SIZE 256
+
+typedef struct
+{
+    HistoryCursor records[8];
+    int count;
+    int limit;
+} Collected;
+
+static bool collect(const HistoryCursor * record, void * ctx)
+{
+    Collected * collected = ctx;
+    collected->records[collected->count++] = *record;
+    return collected->count < collected->limit;
+}
+
+static HistoryCursor make_record(uint32_t boot, uint32_t uptime, uint32_t clock, int32_t base)
+{
+    HistoryCursor record = { .keyed = true, .boot = boot, .uptime = uptime, .clock = clock };
+    for (int i = 0; i < HISTORY_COLUMNS; i++) {
+        record.values[i] = base * (i % 2 ? -1 : 1) + i;
+    }
+    return record;
+}
+
+// Encodes the records after each other into an erased page, returns the length
+static size_t encode_records(uint8_t * page, const HistoryCursor * records, int count)
+{
+    HistoryCursor previous = {};
+    size_t length = 0;
+
+    memset(page, RECORD_EMPTY, PAGE_SIZE);
+    for (int i = 0; i < count; i++) {
+        length += encodeRecord(&previous, &records[i], page + length);
+        previous = records[i];
+    }
+    return length;
+}
+
+static void assert_record(const HistoryCursor * expected, const HistoryCursor * actual)
+{
+    TEST_ASSERT_EQUAL_UINT32(expected->boot, actual->boot);
+    TEST_ASSERT_EQUAL_UINT32(expected->uptime, actual->uptime);
+    TEST_ASSERT_EQUAL_UINT32(expected->clock, actual->clock);
+    TEST_ASSERT_EQUAL_INT32_ARRAY(expected->values, actual->values, HISTORY_COLUMNS);
+}
+
+TEST_CASE("zigzag maps small magnitudes to small codes", "[stats_codec]")
+{
+    TEST_ASSERT_EQUAL_UINT32(0, zigzag(0));
+    TEST_ASSERT_EQUAL_UINT32(1, zigzag(-1));
+    TEST_ASSERT_EQUAL_UINT32(2, zigzag(1));
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFE, zigzag(INT32_MAX));
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, zigzag(INT32_MIN));
+
+    const int32_t values[] = { 0, 1, -1, 63, -64, 1000000, -1000000, INT32_MAX, INT32_MIN };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        TEST_ASSERT_EQUAL_INT32(values[i], unzigzag(zigzag(values[i])));
+    }
+}
+
+TEST_CASE("putVarint and getVarint round trip", "[stats_codec]")
+{
+    const uint32_t values[] = { 0, 1, 127, 128, 16383, 16384, 0x0FFFFFFF, UINT32_MAX };
+    const size_t lengths[] = { 1, 1, 1, 2, 2, 3, 4, 5 };
+    uint8_t buffer[5];
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        size_t length = putVarint(buffer, values[i]);
+        TEST_ASSERT_EQUAL(lengths[i], length);
+
+        size_t pos = 0;
+        uint32_t value;
+        TEST_ASSERT_TRUE(getVarint(buffer, length, &pos, &value));
+        TEST_ASSERT_EQUAL_UINT32(values[i], value);
+        TEST_ASSERT_EQUAL(length, pos);
+    }
+
+    buffer[0] = 0x80;
+    buffer[1] = 0x01;
+    size_t pos = 0;
+    uint32_t value;
+    TEST_ASSERT_TRUE(getVarint(buffer, 2, &pos, &value));
+    TEST_ASSERT_EQUAL_UINT32(128, value);
+}
+
+TEST_CASE("getVarint rejects cut off and erased input", "[stats_codec]")
+{
+    uint8_t buffer[8];
+    size_t pos = 0;
+    uint32_t value;
+
+    size_t length = putVarint(buffer, 300000);
+    TEST_ASSERT_FALSE(getVarint(buffer, length - 1, &pos, &value));
+
+    // Erased flash never ends a varint
+    memset(buffer, RECORD_EMPTY, sizeof(buffer));
+    pos = 0;
+    TEST_ASSERT_FALSE(getVarint(buffer, sizeof(buffer), &pos, &value));
+}
+
+TEST_CASE("decodePage restores keyframes and deltas", "[stats_codec]")
+{
+    const HistoryCursor records[] = {
+        make_record(3, 100, 1700000000, 5000),
+        make_record(3, 105, 1700000000, 5100),
+        make_record(3, 110, 1700000000, -20),
+    };
+    uint8_t page[PAGE_SIZE];
+    size_t length = encode_records(page, records, 3);
+
+    TEST_ASSERT_EQUAL_UINT8(RECORD_KEYFRAME, page[0]);
+
+    Collected collected = { .limit = 8 };
+    HistoryCursor cursor = {};
+    size_t end = decodePage(page, 0, PAGE_SIZE, &cursor, collect, &collected);
+
+    // The erased tail ends the page right after the last record
+    TEST_ASSERT_EQUAL(length, end);
+    TEST_ASSERT_EQUAL(3, collected.count);
+    for (int i = 0; i < 3; i++) {
+        assert_record(&records[i], &collected.records[i]);
+    }
+}
+
+TEST_CASE("encodeRecord starts a keyframe on a new boot or clock jump", "[stats_codec]")
+{
+    HistoryCursor previous = make_record(1, 100, 1700000000, 1);
+    HistoryCursor record = make_record(1, 105, 1700000000, 1);
+    uint8_t out[HISTORY_RECORD_MAX];
+
+    encodeRecord(&previous, &record, out);
+    TEST_ASSERT_EQUAL_UINT8(RECORD_DELTA, out[0]);
+
+    record.boot = 2;
+    encodeRecord(&previous, &record, out);
+    TEST_ASSERT_EQUAL_UINT8(RECORD_KEYFRAME, out[0]);
+
+    record = make_record(1, 105, 1700000000 + HISTORY_CLOCK_JUMP + 1, 1);
+    encodeRecord(&previous, &record, out);
+    TEST_ASSERT_EQUAL_UINT8(RECORD_KEYFRAME, out[0]);
+
+    record = make_record(1, 99, 1700000000, 1);
+    encodeRecord(&previous, &record, out);
+    TEST_ASSERT_EQUAL_UINT8(RECORD_KEYFRAME, out[0]);
+}
+
+TEST_CASE("decodePage stops at a record cut off by a reset", "[stats_codec]")
+{
+    const HistoryCursor records[] = {
+        make_record(1, 100, 0, 70000),
+        make_record(1, 105, 0, 70001),
+    };
+    uint8_t page[PAGE_SIZE];
+    HistoryCursor previous = {};
+    size_t first = encodeRecord(&previous, &records[0], page);
+    size_t length = encode_records(page, records, 2);
+
+    // Only the start of the second record made it to flash
+    memset(page + length - 3, RECORD_EMPTY, PAGE_SIZE - (length - 3));
+
+    Collected collected = { .limit = 8 };
+    HistoryCursor cursor = {};
+    size_t end = decodePage(page, 0, PAGE_SIZE, &cursor, collect, &collected);
+
+    TEST_ASSERT_EQUAL(first, end);
+    TEST_ASSERT_EQUAL(1, collected.count);
+    assert_record(&records[0], &collected.records[0]);
+}
+
+TEST_CASE("decodePage skips deltas without a keyframe and stops when asked", "[stats_codec]")
+{
+    const HistoryCursor records[] = {
+        make_record(1, 100, 0, 10),
+        make_record(1, 105, 0, 11),
+        make_record(1, 110, 0, 12),
+    };
+    uint8_t page[PAGE_SIZE];
+    HistoryCursor previous = {};
+    size_t first = encodeRecord(&previous, &records[0], page);
+    encode_records(page, records, 3);
+
+    // A delta is nothing to follow for a cursor without a keyframe
+    Collected collected = { .limit = 8 };
+    HistoryCursor cursor = {};
+    TEST_ASSERT_EQUAL(first, decodePage(page, first, PAGE_SIZE, &cursor, collect, &collected));
+    TEST_ASSERT_EQUAL(0, collected.count);
+
+    collected = (Collected) { .limit = 1 };
+    TEST_ASSERT_EQUAL(first, decodePage(page, 0, PAGE_SIZE, &cursor, collect, &collected));
+    TEST_ASSERT_EQUAL(1, collected.count);
+}
@@ -23,6 +23,10 @@ typedef struct
     uint32_t pool_diff;
     char *jobid;
     char *extranonce2;
+    // Order in which the job was sent to the chain
+    uint32_t dispatch_seq;
+    // Ticket mask difficulty the chips hashed the job at, the least any of its nonces is worth
+    uint32_t asic_diff;
 } bm_job;
 
 void free_bm_job(bm_job *job);
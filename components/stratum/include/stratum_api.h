@@ -48,6 +48,8 @@ typedef struct
 {
     char * extranonce_str;
     int extranonce_2_len;
+    // mining.subscribe result, subscription id usable for session resume
+    char * session_id;
 
     int64_t message_id;
     // Indicates the type of request the message represents.
@@ -75,7 +77,7 @@ void STRATUM_V1_initialize_buffer();
 
 char *STRATUM_V1_receive_jsonrpc_line(int sockfd);
 
-int STRATUM_V1_subscribe(int socket, int send_uid, const char * model);
+int STRATUM_V1_subscribe(int socket, int send_uid, const char * model, const char * session_id);
 
 void STRATUM_V1_parse(StratumApiV1Message *message, const char *stratum_json);
 
@@ -11,6 +11,7 @@
 #include "lwip/sockets.h"
 #include "utils.h"
 #include "esp_timer.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -18,6 +19,7 @@
 
 #define BUFFER_SIZE 1024
 #define MAX_EXTRANONCE_2_LEN 32
+#define MAX_SUBSCRIPTION_ID_LEN 64
 static const char * TAG = "stratum_api";
 
 static char * json_rpc_buffer = NULL;
@@ -71,6 +73,7 @@ double STRATUM_V1_get_response_time_ms(int request_id)
 }
 
 static void debug_stratum_tx(const char *);
+static char * _parse_stratum_subscription_id(cJSON * subscriptions_json);
 int _parse_stratum_subscribe_result_message(const char * result_json_str, char ** extranonce, int * extranonce2_len);
 
 void STRATUM_V1_initialize_buffer()
@@ -259,6 +262,7 @@ void STRATUM_V1_parse(StratumApiV1Message * message, const char * stratum_json)
                 goto done;
             }
             message->extranonce_str = strdup(extranonce_json->valuestring);
+            message->session_id = _parse_stratum_subscription_id(cJSON_GetArrayItem(result_json, 0));
             message->response_success = true;
         //if the id is STRATUM_ID_CONFIGURE parse it
         } else if (parsed_id == STRATUM_ID_CONFIGURE) {
@@ -374,13 +378,65 @@ int _parse_stratum_subscribe_result_message(const char * result_json_str, char *
     return 0;
 }
 
-int STRATUM_V1_subscribe(int socket, int send_uid, const char * model)
+// The id goes back to the pool unescaped in mining.subscribe, only take plain ids
+static char * _copy_subscription_id(cJSON * id_json)
 {
-    // Subscribe
+    if (!cJSON_IsString(id_json) || id_json->valuestring[0] == '\0') {
+        return NULL;
+    }
+    for (const char * c = id_json->valuestring; *c != '\0'; c++) {
+        if (!isalnum((unsigned char) *c) || c - id_json->valuestring >= MAX_SUBSCRIPTION_ID_LEN) {
+            ESP_LOGW(TAG, "Ignoring subscription id: %s", id_json->valuestring);
+            return NULL;
+        }
+    }
+    return strdup(id_json->valuestring);
+}
+
+// The subscription id is the second element of the mining.notify pair, e.g.
+// [["mining.set_difficulty","<id>"],["mining.notify","<id>"]] or ["mining.notify","<id>"]
+static char * _parse_stratum_subscription_id(cJSON * subscriptions_json)
+{
+    if (!cJSON_IsArray(subscriptions_json)) {
+        return NULL;
+    }
+
+    cJSON * first = cJSON_GetArrayItem(subscriptions_json, 0);
+    if (cJSON_IsString(first)) {
+        cJSON * id_json = cJSON_GetArrayItem(subscriptions_json, 1);
+        return _copy_subscription_id(id_json);
+    }
+
+    cJSON * fallback_id_json = NULL;
+    cJSON * subscription;
+    cJSON_ArrayForEach(subscription, subscriptions_json) {
+        cJSON * method_json = cJSON_GetArrayItem(subscription, 0);
+        cJSON * id_json = cJSON_GetArrayItem(subscription, 1);
+        if (!cJSON_IsString(method_json) || !cJSON_IsString(id_json)) {
+            continue;
+        }
+        if (strcmp(method_json->valuestring, "mining.notify") == 0) {
+            return _copy_subscription_id(id_json);
+        }
+        if (fallback_id_json == NULL) {
+            fallback_id_json = id_json;
+        }
+    }
+
+    return _copy_subscription_id(fallback_id_json);
+}
+
+int STRATUM_V1_subscribe(int socket, int send_uid, const char * model, const char * session_id)
+{
+    // Subscribe, optionally asking the pool to resume a previous session
     char subscribe_msg[BUFFER_SIZE];
     const esp_app_desc_t *app_desc = esp_app_get_description();
     const char *version = app_desc->version;	
-    sprintf(subscribe_msg, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"bitaxe/%s/%s\"]}\n", send_uid, model, version);
+    if (session_id != NULL && session_id[0] != '\0') {
+        snprintf(subscribe_msg, sizeof(subscribe_msg), "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"bitaxe/%s/%s\", \"%s\"]}\n", send_uid, model, version, session_id);
+    } else {
+        sprintf(subscribe_msg, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"bitaxe/%s/%s\"]}\n", send_uid, model, version);
+    }
     debug_stratum_tx(subscribe_msg);
 
     return write(socket, subscribe_msg, strlen(subscribe_msg));
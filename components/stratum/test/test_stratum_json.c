@@ -105,6 +105,50 @@ TEST_CASE("Parse stratum notify params", "[mining.notify]")
 //     TEST_ASSERT_EQUAL_INT(extranonce2_len, 4);
 // }
 
+TEST_CASE("Parse stratum mining.subscribe result", "[mining.subscribe]")
+{
+    StratumApiV1Message stratum_api_v1_message = {};
+    const char *json_string = "{\"result\":["
+        "[[\"mining.set_difficulty\",\"731ec5e0649606ff\"],"
+        "[\"mining.notify\",\"731ec5e0649606fe\"]],"
+        "\"e9695791\",4],"
+        "\"id\":2,\"error\":null}";
+    STRATUM_V1_parse(&stratum_api_v1_message, json_string);
+    TEST_ASSERT_EQUAL(STRATUM_RESULT_SUBSCRIBE, stratum_api_v1_message.method);
+    TEST_ASSERT_TRUE(stratum_api_v1_message.response_success);
+    TEST_ASSERT_EQUAL_STRING("e9695791", stratum_api_v1_message.extranonce_str);
+    TEST_ASSERT_EQUAL_INT(4, stratum_api_v1_message.extranonce_2_len);
+    TEST_ASSERT_EQUAL_STRING("731ec5e0649606fe", stratum_api_v1_message.session_id);
+}
+
+TEST_CASE("Parse stratum mining.subscribe result session id variants", "[mining.subscribe]")
+{
+    StratumApiV1Message stratum_api_v1_message = {};
+    const char *json_string_single = "{\"id\":2,\"result\":[[\"mining.notify\",\"ae6812eb4cd7735a302a8a9dd95cf71f\"],\"08000002\",4],\"error\":null}";
+    STRATUM_V1_parse(&stratum_api_v1_message, json_string_single);
+    TEST_ASSERT_EQUAL(STRATUM_RESULT_SUBSCRIBE, stratum_api_v1_message.method);
+    TEST_ASSERT_EQUAL_STRING("08000002", stratum_api_v1_message.extranonce_str);
+    TEST_ASSERT_EQUAL_STRING("ae6812eb4cd7735a302a8a9dd95cf71f", stratum_api_v1_message.session_id);
+
+    StratumApiV1Message stratum_api_v1_message_no_id = {};
+    const char *json_string_null = "{\"id\":2,\"result\":[null,\"08000002\",8],\"error\":null}";
+    STRATUM_V1_parse(&stratum_api_v1_message_no_id, json_string_null);
+    TEST_ASSERT_EQUAL(STRATUM_RESULT_SUBSCRIBE, stratum_api_v1_message_no_id.method);
+    TEST_ASSERT_EQUAL_INT(8, stratum_api_v1_message_no_id.extranonce_2_len);
+    TEST_ASSERT_NULL(stratum_api_v1_message_no_id.session_id);
+}
+
+TEST_CASE("Parse stratum mining.subscribe result ignores unsafe session ids", "[mining.subscribe]")
+{
+    StratumApiV1Message stratum_api_v1_message = {};
+    const char *json_string = "{\"id\":2,\"result\":[[\"mining.notify\",\"ab\\\"],\\\"x\"],\"08000002\",4],\"error\":null}";
+    STRATUM_V1_parse(&stratum_api_v1_message, json_string);
+    TEST_ASSERT_EQUAL(STRATUM_RESULT_SUBSCRIBE, stratum_api_v1_message.method);
+    TEST_ASSERT_TRUE(stratum_api_v1_message.response_success);
+    TEST_ASSERT_EQUAL_STRING("08000002", stratum_api_v1_message.extranonce_str);
+    TEST_ASSERT_NULL(stratum_api_v1_message.session_id);
+}
+
 TEST_CASE("Parse stratum mining.set_version_mask params", "[stratum]")
 {
     StratumApiV1Message stratum_api_v1_message = {};
@@ -290,11 +290,11 @@ void BAP_handle_settings(const char *parameter, const char *value) {
                 if (success) {
                     //ESP_LOGI(TAG, "Frequency successfully set to %.2f MHz", target_frequency);
                     
-                    bap_global_state->POWER_MANAGEMENT_MODULE.frequency_value = target_frequency;
+                    bap_global_state->POWER_MANAGEMENT_MODULE.frequency_value = ASIC_get_frequency(bap_global_state);
                     nvs_config_set_u16(NVS_CONFIG_ASIC_FREQUENCY, target_frequency);
                     
                     char freq_str[32];
-                    snprintf(freq_str, sizeof(freq_str), "%.2f", target_frequency);
+                    snprintf(freq_str, sizeof(freq_str), "%.2f", bap_global_state->POWER_MANAGEMENT_MODULE.frequency_value);
                     BAP_send_message(BAP_CMD_ACK, parameter, freq_str);
                 } else {
                     ESP_LOGE(TAG, "Failed to set frequency to %.2f MHz", target_frequency);
@@ -3,10 +3,14 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
 #include "asic_task.h"
+#include "create_jobs_task.h"
 #include "common.h"
 #include "power_management_task.h"
 #include "hashrate_monitor_task.h"
+#include "frequency_tuner_task.h"
+#include "nonce_range_task.h"
 #include "serial.h"
 #include "stratum_api.h"
 #include "work_queue.h"
@@ -90,16 +94,19 @@ typedef struct
     DeviceConfig DEVICE_CONFIG;
     DisplayConfig DISPLAY_CONFIG;
     AsicTaskModule ASIC_TASK_MODULE;
+    JobsTaskModule JOBS_TASK_MODULE;
     PowerManagementModule POWER_MANAGEMENT_MODULE;
     SelfTestModule SELF_TEST_MODULE;
     HashrateMonitorModule HASHRATE_MONITOR_MODULE;
+    FrequencyTunerModule FREQUENCY_TUNER_MODULE;
+    NonceRangeModule NONCE_RANGE_MODULE;
 
     char * extranonce_str;
     int extranonce_2_len;
     int abandon_work;
 
-    uint8_t * valid_jobs;
-    pthread_mutex_t valid_jobs_lock;
+    // Serializes sending jobs with dropping them on a clean job
+    pthread_mutex_t jobs_lock;
 
     uint32_t pool_difficulty;
     bool new_set_mining_difficulty_msg;
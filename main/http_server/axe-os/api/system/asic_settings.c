@@ -1,4 +1,6 @@
+#include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_http_server.h"
 #include "cJSON.h"
@@ -8,7 +10,9 @@
 
 static int system_asic_prebuffer_len = 256;
 
-// static const char *TAG = "asic_settings";
+#define CORES_CSV_BUFFER_SIZE 2048
+
+static const char *TAG = "asic_settings";
 static GlobalState *GLOBAL_STATE = NULL;
 
 // Function declarations from http_server.c
@@ -71,3 +75,125 @@ esp_err_t GET_system_asic(httpd_req_t *req)
 
     return res;
 }
+
+// Cores and small cores per core the chip can report nonces from
+static void core_dimensions(uint16_t *cores, uint16_t *small_cores)
+{
+    const AsicConfig *asic = &GLOBAL_STATE->DEVICE_CONFIG.family.asic;
+    *cores = asic->core_count < ASIC_CORE_SLOTS ? asic->core_count : ASIC_CORE_SLOTS;
+    *small_cores = asic->core_count > 0 ? (asic->small_core_count + asic->core_count - 1) / asic->core_count : 1;
+    if (*small_cores > ASIC_SMALL_CORE_SLOTS) {
+        *small_cores = ASIC_SMALL_CORE_SLOTS;
+    }
+}
+
+// Three little endian uint16 (chips, cores, small cores per core), then one
+// little endian uint32 per small core, chip by chip and core by core
+static esp_err_t send_cores_binary(httpd_req_t *req, uint16_t asic_count, uint16_t cores, uint16_t small_cores)
+{
+    uint16_t header[3] = { asic_count, cores, small_cores };
+    if (httpd_resp_send_chunk(req, (const char *)header, sizeof(header)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    uint32_t *counters = malloc(cores * small_cores * sizeof(uint32_t));
+    if (counters == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t res = ESP_OK;
+    for (uint16_t asic_nr = 0; asic_nr < asic_count && res == ESP_OK; asic_nr++) {
+        for (uint16_t core = 0; core < cores; core++) {
+            memcpy(&counters[core * small_cores], asic_core_nonces(&GLOBAL_STATE->ASIC_TASK_MODULE, asic_nr, core), small_cores * sizeof(uint32_t));
+        }
+        res = httpd_resp_send_chunk(req, (const char *)counters, cores * small_cores * sizeof(uint32_t));
+    }
+
+    free(counters);
+    return res;
+}
+
+// One row per core: asic,core,total,then one column per small core
+static esp_err_t send_cores_csv(httpd_req_t *req, uint16_t asic_count, uint16_t cores, uint16_t small_cores)
+{
+    char *buffer = malloc(CORES_CSV_BUFFER_SIZE);
+    if (buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int length = snprintf(buffer, CORES_CSV_BUFFER_SIZE, "asic,core,total");
+    for (uint16_t small_core = 0; small_core < small_cores; small_core++) {
+        length += snprintf(buffer + length, CORES_CSV_BUFFER_SIZE - length, ",sc%u", small_core);
+    }
+    buffer[length++] = '\n';
+
+    esp_err_t res = ESP_OK;
+    for (uint16_t asic_nr = 0; asic_nr < asic_count && res == ESP_OK; asic_nr++) {
+        for (uint16_t core = 0; core < cores && res == ESP_OK; core++) {
+            // A row is at most 16 columns of 10 digits, flush well before that no longer fits
+            if (length > CORES_CSV_BUFFER_SIZE - 256) {
+                res = httpd_resp_send_chunk(req, buffer, length);
+                length = 0;
+            }
+
+            const uint32_t *counters = asic_core_nonces(&GLOBAL_STATE->ASIC_TASK_MODULE, asic_nr, core);
+            uint32_t total = 0;
+            for (uint16_t small_core = 0; small_core < small_cores; small_core++) {
+                total += counters[small_core];
+            }
+            length += snprintf(buffer + length, CORES_CSV_BUFFER_SIZE - length, "%u,%u,%" PRIu32, asic_nr, core, total);
+            for (uint16_t small_core = 0; small_core < small_cores; small_core++) {
+                length += snprintf(buffer + length, CORES_CSV_BUFFER_SIZE - length, ",%" PRIu32, counters[small_core]);
+            }
+            buffer[length++] = '\n';
+        }
+    }
+    if (res == ESP_OK && length > 0) {
+        res = httpd_resp_send_chunk(req, buffer, length);
+    }
+
+    free(buffer);
+    return res;
+}
+
+/* Handler for the nonce counts per core and small core */
+esp_err_t GET_system_asic_cores(httpd_req_t *req)
+{
+    if (is_network_allowed(req) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Unauthorized");
+    }
+
+    // Set CORS headers
+    if (set_cors_headers(req) != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    if (GLOBAL_STATE->ASIC_TASK_MODULE.core_nonces == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No core statistics");
+        return ESP_OK;
+    }
+
+    bool binary = false;
+    char query[64];
+    char format[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "format", format, sizeof(format)) == ESP_OK) {
+        binary = strcmp(format, "binary") == 0;
+    }
+
+    uint16_t asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+    uint16_t cores, small_cores;
+    core_dimensions(&cores, &small_cores);
+
+    httpd_resp_set_type(req, binary ? "application/octet-stream" : "text/csv");
+
+    esp_err_t res = binary ? send_cores_binary(req, asic_count, cores, small_cores)
+                           : send_cores_csv(req, asic_count, cores, small_cores);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Sending core statistics failed: %s", esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
@@ -7,11 +7,104 @@ interface IHashrateMonitorAsic {
     total: number;
     domains?: number[];
     error: number;
+    nonceHashrate?: number;
+    nonceHashrateLow?: number;
+    nonceHashrateHigh?: number;
+    disagreement?: number;
+    jobId?: number;
+    jobLag?: number;
+    nonces?: number;
+    duplicates?: number;
+    missedReads?: number;
+    frequency?: number;
+    frequencyLimit?: number;
+    frequencyOffset?: number;
 }
 
 interface IHashrateMonitor {
     asics: IHashrateMonitorAsic[];
     errorCount: number;
+    readsSent?: number;
+    readsMissed?: number;
+    readsUnexpected?: number;
+    nonceHashrate?: number;
+    nonceHashrateLow?: number;
+    nonceHashrateHigh?: number;
+    fusedHashrate?: number;
+    hashrateDisagreement?: number;
+    ticketDifficulty?: number;
+    resultRate?: number;
+    duplicateNonces?: number;
+    readLatency?: number;
+}
+
+interface IFrequencyTuner {
+    supported: boolean;
+    rounds: number;
+    raised: number;
+    lowered: number;
+}
+
+interface INonceRangeResult {
+    hashCounting: number;
+    nonces: number;
+    duration: number;
+    hashrate: number;
+}
+
+interface INonceRange {
+    chipCount: number;
+    minSpan: number;
+    maxSpan: number;
+    coverage: number;
+    hashCounting: number;
+    validNonces: number;
+    running: boolean;
+    pass: number;
+    candidate: number;
+    winner: number;
+    results: INonceRangeResult[];
+}
+
+interface IStatisticsAggregate {
+    duration: number;
+    hashrate: number;
+    errorCount: number;
+    sharesAccepted: number;
+    sharesRejected: number;
+}
+
+interface IFrequencyRamp {
+    startFrequency: number;
+    targetFrequency: number;
+    frequency: number;
+    steps: number;
+    checkedSteps: number;
+    backoffs: number;
+    duration: number;
+    closedLoop: boolean;
+    inProgress: boolean;
+}
+
+interface IWorkQueueMetrics {
+    depth: number;
+    count: number;
+    highWater: number;
+    fullStalls: number;
+    enqueued: number;
+}
+
+interface IAsicRx {
+    frames: number;
+    crcErrors: number;
+    resyncBytes: number;
+}
+
+interface IJobBuilder {
+    builders: number;
+    jobsBuilt: number;
+    buildTime: number;
+    refillRate: number;
 }
 
 export interface ISystemInfo {
@@ -76,6 +169,7 @@ export interface ISystemInfo {
     fanrpm: number,
     fan2rpm: number,
     statsFrequency: number,
+    statsHistory?: number,
     coreVoltageActual: number,
 
     boardtemp1?: number,
@@ -83,11 +177,22 @@ export interface ISystemInfo {
     overheat_mode: number,
     power_fault?: string,
     overclockEnabled?: number,
+    autoFrequency?: number,
+    nonceRangeBenchmark?: number,
 
     blockHeight?: number,
     scriptsig?: string,
     networkDifficulty?: number,
 
     hashrateMonitor: IHashrateMonitor,
+    jobBuilder?: IJobBuilder,
+    frequencyRamp?: IFrequencyRamp,
+    frequencyTuner?: IFrequencyTuner,
+    nonceRange?: INonceRange,
+    aggregates?: { [window: string]: IStatisticsAggregate },
+    asicJobInterval?: number,
+    asicRx?: IAsicRx,
+    stratumQueue?: IWorkQueueMetrics,
+    asicJobsQueue?: IWorkQueueMetrics,
     blockFound: number,
 }
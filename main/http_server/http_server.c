@@ -37,8 +37,10 @@
 #include "power.h"
 #include "connect.h"
 #include "asic.h"
+#include "frequency_transition_bmXX.h"
 #include "TPS546.h"
 #include "statistics_task.h"
+#include "statistics_history_task.h"
 #include "theme_api.h"  // Add theme API include
 #include "axe-os/api/system/asic_settings.h"
 #include "display.h"
@@ -110,6 +112,76 @@ DataSource strToDataSource(const char * sourceStr)
     return SRC_NONE;
 }
 
+// Column order of the statistics responses, the timestamp always comes last
+static const DataSource statsColumns[] = {
+    SRC_HASHRATE, SRC_ASIC_TEMP, SRC_ERROR_COUNT, SRC_VR_TEMP, SRC_ASIC_VOLTAGE, SRC_VOLTAGE, SRC_POWER,
+    SRC_CURRENT, SRC_FAN_SPEED, SRC_FAN_RPM, SRC_FAN2_RPM, SRC_WIFI_RSSI, SRC_FREE_HEAP,
+};
+
+#define STATS_COLUMNS (sizeof(statsColumns) / sizeof(statsColumns[0]))
+
+// SRC_NONE stands for the timestamp
+static const char * dataSourceToStr(DataSource source)
+{
+    switch (source) {
+        case SRC_HASHRATE:     return STATS_LABEL_HASHRATE;
+        case SRC_ERROR_COUNT:  return STATS_LABEL_ERROR_COUNT;
+        case SRC_ASIC_TEMP:    return STATS_LABEL_ASIC_TEMP;
+        case SRC_VR_TEMP:      return STATS_LABEL_VR_TEMP;
+        case SRC_ASIC_VOLTAGE: return STATS_LABEL_ASIC_VOLTAGE;
+        case SRC_VOLTAGE:      return STATS_LABEL_VOLTAGE;
+        case SRC_POWER:        return STATS_LABEL_POWER;
+        case SRC_CURRENT:      return STATS_LABEL_CURRENT;
+        case SRC_FAN_SPEED:    return STATS_LABEL_FAN_SPEED;
+        case SRC_FAN_RPM:      return STATS_LABEL_FAN_RPM;
+        case SRC_FAN2_RPM:     return STATS_LABEL_FAN2_RPM;
+        case SRC_WIFI_RSSI:    return STATS_LABEL_WIFI_RSSI;
+        case SRC_FREE_HEAP:    return STATS_LABEL_FREE_HEAP;
+        default:               return STATS_LABEL_TIMESTAMP;
+    }
+}
+
+// Type of a binary column as Python struct / numpy character: f float32, I uint32, H uint16, h int16, b int8
+static char dataSourceType(DataSource source)
+{
+    switch (source) {
+        case SRC_ERROR_COUNT:
+        case SRC_FREE_HEAP:    return 'I';
+        case SRC_ASIC_VOLTAGE: return 'h';
+        case SRC_FAN_RPM:
+        case SRC_FAN2_RPM:     return 'H';
+        case SRC_WIFI_RSSI:    return 'b';
+        case SRC_NONE:         return 'I';
+        default:               return 'f';
+    }
+}
+
+// Copies the value as stored, the ESP32 is little endian. Returns its size.
+static size_t dataSourceValue(const struct StatisticsData * data, DataSource source, uint8_t * out)
+{
+    const void * value;
+    size_t size;
+
+    switch (source) {
+        case SRC_HASHRATE:     value = &data->hashrate;          size = sizeof(data->hashrate); break;
+        case SRC_ERROR_COUNT:  value = &data->errorCount;        size = sizeof(data->errorCount); break;
+        case SRC_ASIC_TEMP:    value = &data->chipTemperature;   size = sizeof(data->chipTemperature); break;
+        case SRC_VR_TEMP:      value = &data->vrTemperature;     size = sizeof(data->vrTemperature); break;
+        case SRC_ASIC_VOLTAGE: value = &data->coreVoltageActual; size = sizeof(data->coreVoltageActual); break;
+        case SRC_VOLTAGE:      value = &data->voltage;           size = sizeof(data->voltage); break;
+        case SRC_POWER:        value = &data->power;             size = sizeof(data->power); break;
+        case SRC_CURRENT:      value = &data->current;           size = sizeof(data->current); break;
+        case SRC_FAN_SPEED:    value = &data->fanSpeed;          size = sizeof(data->fanSpeed); break;
+        case SRC_FAN_RPM:      value = &data->fanRPM;            size = sizeof(data->fanRPM); break;
+        case SRC_FAN2_RPM:     value = &data->fan2RPM;           size = sizeof(data->fan2RPM); break;
+        case SRC_WIFI_RSSI:    value = &data->wifiRSSI;          size = sizeof(data->wifiRSSI); break;
+        case SRC_FREE_HEAP:    value = &data->freeHeap;          size = sizeof(data->freeHeap); break;
+        default:               value = &data->timestamp;         size = sizeof(data->timestamp); break;
+    }
+    memcpy(out, value, size);
+    return size;
+}
+
 static GlobalState * GLOBAL_STATE;
 static httpd_handle_t server = NULL;
 
@@ -707,6 +779,17 @@ static esp_err_t POST_restart(httpd_req_t * req)
 }
 
 /* Simple handler for getting system handler */
+static cJSON * queue_metrics(work_queue * queue)
+{
+    cJSON * metrics = cJSON_CreateObject();
+    cJSON_AddNumberToObject(metrics, "depth", queue->depth);
+    cJSON_AddNumberToObject(metrics, "count", queue_count(queue));
+    cJSON_AddNumberToObject(metrics, "highWater", atomic_load(&queue->high_water));
+    cJSON_AddNumberToObject(metrics, "fullStalls", atomic_load(&queue->full_stalls));
+    cJSON_AddNumberToObject(metrics, "enqueued", atomic_load(&queue->enqueued));
+    return metrics;
+}
+
 static esp_err_t GET_system_info(httpd_req_t * req)
 {
     if (is_network_allowed(req) != ESP_OK) {
@@ -813,6 +896,8 @@ static esp_err_t GET_system_info(httpd_req_t * req)
 
     cJSON_AddNumberToObject(root, "overheat_mode", nvs_config_get_bool(NVS_CONFIG_OVERHEAT_MODE));
     cJSON_AddNumberToObject(root, "overclockEnabled", nvs_config_get_bool(NVS_CONFIG_OVERCLOCK_ENABLED));
+    cJSON_AddNumberToObject(root, "autoFrequency", nvs_config_get_bool(NVS_CONFIG_FREQUENCY_TUNER));
+    cJSON_AddNumberToObject(root, "nonceRangeBenchmark", nvs_config_get_bool(NVS_CONFIG_NONCE_RANGE_BENCHMARK));
     cJSON_AddStringToObject(root, "display", display);
     cJSON_AddNumberToObject(root, "rotation", nvs_config_get_u16(NVS_CONFIG_ROTATION));
     cJSON_AddNumberToObject(root, "invertscreen", nvs_config_get_bool(NVS_CONFIG_INVERT_SCREEN));
@@ -828,6 +913,7 @@ static esp_err_t GET_system_info(httpd_req_t * req)
     cJSON_AddNumberToObject(root, "fan2rpm", GLOBAL_STATE->POWER_MANAGEMENT_MODULE.fan2_rpm);
 
     cJSON_AddNumberToObject(root, "statsFrequency", nvs_config_get_u16(NVS_CONFIG_STATISTICS_FREQUENCY));
+    cJSON_AddNumberToObject(root, "statsHistory", nvs_config_get_bool(NVS_CONFIG_STATISTICS_HISTORY));
 
     cJSON_AddNumberToObject(root, "blockFound", GLOBAL_STATE->SYSTEM_MODULE.block_found);
 
@@ -847,6 +933,9 @@ static esp_err_t GET_system_info(httpd_req_t * req)
     cJSON *asics_array = cJSON_CreateArray();
     cJSON_AddItemToObject(hashrate_monitor, "asics", asics_array);
 
+    uint16_t chip_count;
+    const chip_frequency_t *chips = frequency_ramp_chips(&chip_count);
+
     if (GLOBAL_STATE->HASHRATE_MONITOR_MODULE.is_initialized) {
         for (int asic_nr = 0; asic_nr < GLOBAL_STATE->DEVICE_CONFIG.family.asic_count; asic_nr++) {
             cJSON *asic = cJSON_CreateObject();
@@ -864,9 +953,137 @@ static esp_err_t GET_system_info(httpd_req_t * req)
             }
 
             cJSON_AddNumberToObject(asic, "error", GLOBAL_STATE->HASHRATE_MONITOR_MODULE.error_measurement[asic_nr].hashrate);
+
+            if (GLOBAL_STATE->HASHRATE_MONITOR_MODULE.nonce_estimates != NULL) {
+                nonce_estimate_t *estimate = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE.nonce_estimates[asic_nr];
+                cJSON_AddNumberToObject(asic, "nonceHashrate", estimate->hashrate);
+                cJSON_AddNumberToObject(asic, "nonceHashrateLow", estimate->hashrate_low);
+                cJSON_AddNumberToObject(asic, "nonceHashrateHigh", estimate->hashrate_high);
+                cJSON_AddNumberToObject(asic, "disagreement", estimate->disagreement);
+            }
+
+            uint32_t missed_reads = 0;
+            for (int i = 0; i < GLOBAL_STATE->HASHRATE_MONITOR_MODULE.poll_count; i++) {
+                register_poll_t *poll = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE.polls[i];
+                if (poll->asic_nr == asic_nr) {
+                    missed_reads += poll->missed;
+                }
+            }
+            cJSON_AddNumberToObject(asic, "missedReads", missed_reads);
+
+            if (asic_nr < chip_count) {
+                cJSON_AddNumberToObject(asic, "frequency", chips[asic_nr].frequency);
+                cJSON_AddNumberToObject(asic, "frequencyLimit", chips[asic_nr].limit);
+            }
+
+            if (GLOBAL_STATE->FREQUENCY_TUNER_MODULE.offsets != NULL) {
+                cJSON_AddNumberToObject(asic, "frequencyOffset", GLOBAL_STATE->FREQUENCY_TUNER_MODULE.offsets[asic_nr]);
+            }
+
+            if (GLOBAL_STATE->ASIC_TASK_MODULE.chip_jobs != NULL) {
+                asic_chip_job_t *chip_job = &GLOBAL_STATE->ASIC_TASK_MODULE.chip_jobs[asic_nr];
+                cJSON_AddNumberToObject(asic, "jobId", chip_job->job_id);
+                cJSON_AddNumberToObject(asic, "jobLag", GLOBAL_STATE->ASIC_TASK_MODULE.dispatch_seq - chip_job->dispatch_seq);
+                cJSON_AddNumberToObject(asic, "nonces", chip_job->nonces);
+                cJSON_AddNumberToObject(asic, "duplicates", chip_job->duplicates);
+            }
         }
     }
     cJSON_AddNumberToObject(hashrate_monitor, "errorCount", GLOBAL_STATE->HASHRATE_MONITOR_MODULE.error_count);
+    cJSON_AddNumberToObject(hashrate_monitor, "readsSent", GLOBAL_STATE->HASHRATE_MONITOR_MODULE.reads_sent);
+    cJSON_AddNumberToObject(hashrate_monitor, "readsMissed", GLOBAL_STATE->HASHRATE_MONITOR_MODULE.reads_missed);
+    cJSON_AddNumberToObject(hashrate_monitor, "readsUnexpected", GLOBAL_STATE->HASHRATE_MONITOR_MODULE.reads_unexpected);
+    nonce_estimate_t *nonce_estimate = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE.nonce_estimate;
+    cJSON_AddNumberToObject(hashrate_monitor, "nonceHashrate", nonce_estimate->hashrate);
+    cJSON_AddNumberToObject(hashrate_monitor, "nonceHashrateLow", nonce_estimate->hashrate_low);
+    cJSON_AddNumberToObject(hashrate_monitor, "nonceHashrateHigh", nonce_estimate->hashrate_high);
+    cJSON_AddNumberToObject(hashrate_monitor, "fusedHashrate", nonce_estimate->fused_hashrate);
+    cJSON_AddNumberToObject(hashrate_monitor, "hashrateDisagreement", nonce_estimate->disagreement);
+    cJSON_AddNumberToObject(hashrate_monitor, "ticketDifficulty", GLOBAL_STATE->ASIC_TASK_MODULE.ticket_difficulty);
+    cJSON_AddNumberToObject(hashrate_monitor, "resultRate", GLOBAL_STATE->ASIC_TASK_MODULE.result_rate);
+    cJSON_AddNumberToObject(hashrate_monitor, "duplicateNonces", GLOBAL_STATE->ASIC_TASK_MODULE.duplicate_nonces);
+    cJSON_AddNumberToObject(hashrate_monitor, "readLatency", GLOBAL_STATE->HASHRATE_MONITOR_MODULE.read_latency_ms);
+
+    const frequency_ramp_stats_t *ramp_stats = frequency_ramp_stats();
+    cJSON *frequency_ramp = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "frequencyRamp", frequency_ramp);
+    cJSON_AddNumberToObject(frequency_ramp, "startFrequency", ramp_stats->start_frequency);
+    cJSON_AddNumberToObject(frequency_ramp, "targetFrequency", ramp_stats->target_frequency);
+    cJSON_AddNumberToObject(frequency_ramp, "frequency", ramp_stats->frequency);
+    cJSON_AddNumberToObject(frequency_ramp, "steps", ramp_stats->steps);
+    cJSON_AddNumberToObject(frequency_ramp, "checkedSteps", ramp_stats->checked_steps);
+    cJSON_AddNumberToObject(frequency_ramp, "backoffs", ramp_stats->backoffs);
+    cJSON_AddNumberToObject(frequency_ramp, "duration", ramp_stats->duration_ms);
+    cJSON_AddBoolToObject(frequency_ramp, "closedLoop", ramp_stats->closed_loop);
+    cJSON_AddBoolToObject(frequency_ramp, "inProgress", ramp_stats->in_progress);
+
+    cJSON *frequency_tuner = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "frequencyTuner", frequency_tuner);
+    cJSON_AddBoolToObject(frequency_tuner, "supported", GLOBAL_STATE->FREQUENCY_TUNER_MODULE.supported);
+    cJSON_AddNumberToObject(frequency_tuner, "rounds", GLOBAL_STATE->FREQUENCY_TUNER_MODULE.rounds);
+    cJSON_AddNumberToObject(frequency_tuner, "raised", GLOBAL_STATE->FREQUENCY_TUNER_MODULE.raised);
+    cJSON_AddNumberToObject(frequency_tuner, "lowered", GLOBAL_STATE->FREQUENCY_TUNER_MODULE.lowered);
+
+    bm13xx_nonce_plan_t nonce_plan;
+    if (ASIC_get_nonce_plan(GLOBAL_STATE, &nonce_plan)) {
+        const NonceRangeModule *NONCE_RANGE_MODULE = &GLOBAL_STATE->NONCE_RANGE_MODULE;
+        cJSON *nonce_range = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, "nonceRange", nonce_range);
+        cJSON_AddNumberToObject(nonce_range, "chipCount", nonce_plan.chip_count);
+        cJSON_AddNumberToObject(nonce_range, "minSpan", nonce_plan.min_span);
+        cJSON_AddNumberToObject(nonce_range, "maxSpan", nonce_plan.max_span);
+        cJSON_AddNumberToObject(nonce_range, "coverage", nonce_plan.covered / 256.0);
+        cJSON_AddNumberToObject(nonce_range, "hashCounting", nonce_plan.hash_counting);
+        cJSON_AddNumberToObject(nonce_range, "validNonces", GLOBAL_STATE->ASIC_TASK_MODULE.valid_nonces);
+        cJSON_AddBoolToObject(nonce_range, "running", NONCE_RANGE_MODULE->running);
+        cJSON_AddNumberToObject(nonce_range, "pass", NONCE_RANGE_MODULE->pass);
+        cJSON_AddNumberToObject(nonce_range, "candidate", NONCE_RANGE_MODULE->candidate);
+        cJSON_AddNumberToObject(nonce_range, "winner", NONCE_RANGE_MODULE->winner);
+
+        cJSON *results = cJSON_CreateArray();
+        cJSON_AddItemToObject(nonce_range, "results", results);
+        for (int i = 0; i < NONCE_RANGE_MODULE->candidate_count; i++) {
+            const nonce_range_result_t *result = &NONCE_RANGE_MODULE->results[i];
+            cJSON *item = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item, "hashCounting", result->hash_counting);
+            cJSON_AddNumberToObject(item, "nonces", result->nonces);
+            cJSON_AddNumberToObject(item, "duration", result->duration_ms);
+            cJSON_AddNumberToObject(item, "hashrate", result->hashrate);
+            cJSON_AddItemToArray(results, item);
+        }
+    }
+
+    cJSON *aggregates = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "aggregates", aggregates);
+    struct StatisticsAggregate aggregate;
+    for (uint8_t index = 0; getStatisticAggregate(index, &aggregate); index++) {
+        cJSON *window = cJSON_CreateObject();
+        cJSON_AddItemToObject(aggregates, aggregate.window, window);
+        cJSON_AddNumberToObject(window, "duration", aggregate.duration);
+        cJSON_AddNumberToObject(window, "hashrate", aggregate.hashrate);
+        cJSON_AddNumberToObject(window, "errorCount", aggregate.errorCount);
+        cJSON_AddNumberToObject(window, "sharesAccepted", aggregate.sharesAccepted);
+        cJSON_AddNumberToObject(window, "sharesRejected", aggregate.sharesRejected);
+    }
+
+    cJSON *job_builder = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "jobBuilder", job_builder);
+    cJSON_AddNumberToObject(job_builder, "builders", GLOBAL_STATE->JOBS_TASK_MODULE.builder_count);
+    cJSON_AddNumberToObject(job_builder, "jobsBuilt", GLOBAL_STATE->JOBS_TASK_MODULE.jobs_built);
+    cJSON_AddNumberToObject(job_builder, "buildTime", GLOBAL_STATE->JOBS_TASK_MODULE.job_build_time_ms);
+    cJSON_AddNumberToObject(job_builder, "refillRate", GLOBAL_STATE->JOBS_TASK_MODULE.refill_rate);
+
+    cJSON_AddNumberToObject(root, "asicJobInterval", GLOBAL_STATE->ASIC_TASK_MODULE.job_interval_ms);
+
+    const rx_stats_t * rx_stats = receive_work_stats();
+    cJSON *asic_rx = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "asicRx", asic_rx);
+    cJSON_AddNumberToObject(asic_rx, "frames", rx_stats->frames);
+    cJSON_AddNumberToObject(asic_rx, "crcErrors", rx_stats->crc_errors);
+    cJSON_AddNumberToObject(asic_rx, "resyncBytes", rx_stats->resync_bytes);
+
+    cJSON_AddItemToObject(root, "stratumQueue", queue_metrics(&GLOBAL_STATE->stratum_queue));
+    cJSON_AddItemToObject(root, "asicJobsQueue", queue_metrics(&GLOBAL_STATE->ASIC_jobs_queue));
 
     free(ssid);
     free(hostname);
@@ -883,14 +1100,54 @@ static esp_err_t GET_system_info(httpd_req_t * req)
     return res;
 }
 
+#define STATS_CHUNK_SIZE 512
+
+// Little endian uint32 currentTimestamp, uint16 rows, uint8 columns, per column its
+// type character, name length and name, then every column's values back to back.
+static esp_err_t send_statistics_binary(httpd_req_t * req, const struct StatisticsData * rowData, uint16_t rows,
+                                        const DataSource * columns, uint8_t columnCount)
+{
+    uint8_t buffer[STATS_CHUNK_SIZE];
+    size_t length = 0;
+
+    uint32_t currentTimestamp = esp_timer_get_time() / 1000;
+
+    memcpy(buffer, &currentTimestamp, sizeof(currentTimestamp));
+    memcpy(buffer + 4, &rows, sizeof(rows));
+    buffer[6] = columnCount;
+    length = 7;
+    for (int column = 0; column < columnCount; column++) {
+        const char * label = dataSourceToStr(columns[column]);
+        size_t labelLength = strlen(label);
+        buffer[length++] = dataSourceType(columns[column]);
+        buffer[length++] = labelLength;
+        memcpy(buffer + length, label, labelLength);
+        length += labelLength;
+    }
+
+    esp_err_t res = ESP_OK;
+    for (int column = 0; column < columnCount && res == ESP_OK; column++) {
+        for (uint16_t row = 0; row < rows && res == ESP_OK; row++) {
+            if (length > STATS_CHUNK_SIZE - sizeof(uint32_t)) {
+                res = httpd_resp_send_chunk(req, (const char *)buffer, length);
+                length = 0;
+            }
+            length += dataSourceValue(&rowData[row], columns[column], buffer + length);
+        }
+    }
+    if (res == ESP_OK && length > 0) {
+        res = httpd_resp_send_chunk(req, (const char *)buffer, length);
+    }
+
+    return res;
+}
+
 static esp_err_t GET_system_statistics(httpd_req_t * req)
 {
     if (is_network_allowed(req) != ESP_OK) {
         return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Unauthorized");
     }
 
-    httpd_resp_set_type(req, "application/json");
-
     // Set CORS headers
     if (set_cors_headers(req) != ESP_OK) {
         httpd_resp_send_500(req);
@@ -900,6 +1157,7 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
     size_t bufLen = httpd_req_get_url_query_len(req) + 1;
     bool dataSelection[SRC_NONE] = {false};
     bool selectionCheck = false;
+    bool binary = false;
 
     // Check query parameters
     if (1 < bufLen) {
@@ -917,6 +1175,10 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
                     param = strtok(NULL, ",");
                 }
             }
+            char format[16];
+            if (httpd_query_key_value(buf, "format", format, sizeof(format)) == ESP_OK) {
+                binary = strcmp(format, "binary") == 0;
+            }
         }
     }
 
@@ -927,6 +1189,45 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
         }
     }
 
+    // One consistent copy of the buffer, the statistics task goes on adding meanwhile
+    StatisticsDataPtr rowData = heap_caps_malloc(sizeof(struct StatisticsData) * STATISTICS_MAX_DATA_COUNT, MALLOC_CAP_SPIRAM);
+    if (NULL == rowData) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    uint16_t rows;
+    if (!getStatisticDataSnapshot(rowData, STATISTICS_MAX_DATA_COUNT, &rows)) {
+        heap_caps_free(rowData);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Statistics busy");
+        return ESP_OK;
+    }
+
+    if (binary) {
+        DataSource columns[STATS_COLUMNS + 1];
+        uint8_t columnCount = 0;
+        for (int i = 0; i < STATS_COLUMNS; i++) {
+            if (dataSelection[statsColumns[i]]) {
+                columns[columnCount++] = statsColumns[i];
+            }
+        }
+        columns[columnCount++] = SRC_NONE;
+
+        httpd_resp_set_type(req, "application/octet-stream");
+
+        esp_err_t res = send_statistics_binary(req, rowData, rows, columns, columnCount);
+        heap_caps_free(rowData);
+        if (res != ESP_OK) {
+            ESP_LOGE(TAG, "Sending statistics failed: %s", esp_err_to_name(res));
+            return ESP_FAIL;
+        }
+
+        return httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+
     // Create object for statistics
     cJSON * root = cJSON_CreateObject();
     cJSON_AddNumberToObject(root, "currentTimestamp", (esp_timer_get_time() / 1000));
@@ -942,6 +1243,7 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
     if (dataSelection[SRC_CURRENT]) { cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_CURRENT)); }
     if (dataSelection[SRC_FAN_SPEED]) { cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_FAN_SPEED)); }
     if (dataSelection[SRC_FAN_RPM]) { cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_FAN_RPM)); }
+    if (dataSelection[SRC_FAN2_RPM]) { cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_FAN2_RPM)); }
     if (dataSelection[SRC_WIFI_RSSI]) { cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_WIFI_RSSI)); }
     if (dataSelection[SRC_FREE_HEAP]) { cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_FREE_HEAP)); }
     cJSON_AddItemToArray(labelArray, cJSON_CreateString(STATS_LABEL_TIMESTAMP));
@@ -949,10 +1251,9 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
     cJSON_AddItemToObject(root, "labels", labelArray);
 
     cJSON * statsArray = cJSON_AddArrayToObject(root, "statistics");
-    struct StatisticsData statsData;
-    uint16_t index = 0;
 
-    while (getStatisticData(index++, &statsData)) {
+    for (uint16_t row = 0; row < rows; row++) {
+        const struct StatisticsData statsData = rowData[row];
         cJSON * valueArray = cJSON_CreateArray();
         if (dataSelection[SRC_HASHRATE]) { cJSON_AddItemToArray(valueArray, cJSON_CreateNumber(statsData.hashrate)); }
         if (dataSelection[SRC_ASIC_TEMP]) { cJSON_AddItemToArray(valueArray, cJSON_CreateNumber(statsData.chipTemperature)); }
@@ -971,6 +1272,7 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
 
         cJSON_AddItemToArray(statsArray, valueArray);
     }
+    heap_caps_free(rowData);
 
     esp_err_t res = HTTP_send_json(req, root, &system_statistics_prebuffer_len);
 
@@ -979,6 +1281,107 @@ static esp_err_t GET_system_statistics(httpd_req_t * req)
     return res;
 }
 
+#define HISTORY_CSV_BUFFER_SIZE 2048
+
+typedef struct
+{
+    httpd_req_t * req;
+    char * buffer;
+    int length;
+    esp_err_t res;
+} HistoryCsvWriter;
+
+static bool write_history_row(const struct StatisticsHistoryRecord * record, void * ctx)
+{
+    HistoryCsvWriter * writer = ctx;
+    const struct StatisticsData * data = &record->data;
+
+    // A row is well under 256 characters
+    if (writer->length > HISTORY_CSV_BUFFER_SIZE - 256) {
+        writer->res = httpd_resp_send_chunk(writer->req, writer->buffer, writer->length);
+        writer->length = 0;
+    }
+
+    writer->length += snprintf(writer->buffer + writer->length, HISTORY_CSV_BUFFER_SIZE - writer->length,
+                               "%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%.2f,%" PRIu32 ",%.1f,%.1f,%.2f,%.0f,%.0f,%d,%.0f,%u,%u,%d,%" PRIu32 "\n",
+                               record->boot, record->uptime, record->time, data->hashrate, data->errorCount,
+                               data->chipTemperature, data->vrTemperature, data->power, data->voltage, data->current,
+                               data->coreVoltageActual, data->fanSpeed, data->fanRPM, data->fan2RPM, data->wifiRSSI, data->freeHeap);
+
+    return ESP_OK == writer->res;
+}
+
+static uint32_t query_u32(const char * query, const char * key, uint32_t fallback)
+{
+    char value[16];
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return fallback;
+    }
+    return strtoul(value, NULL, 10);
+}
+
+/* Statistics history from flash as CSV, streamed while it is decoded */
+static esp_err_t GET_system_statistics_history(httpd_req_t * req)
+{
+    if (is_network_allowed(req) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Unauthorized");
+    }
+
+    // Set CORS headers
+    if (set_cors_headers(req) != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    uint32_t tier = 0, boot = 0, from = 0, to = UINT32_MAX;
+    char query[96];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        tier = query_u32(query, "tier", tier);
+        boot = query_u32(query, "boot", boot);
+        from = query_u32(query, "from", from);
+        to = query_u32(query, "to", to);
+    }
+    if (tier >= HISTORY_TIERS) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown tier");
+        return ESP_OK;
+    }
+
+    HistoryCsvWriter writer = { .req = req, .buffer = malloc(HISTORY_CSV_BUFFER_SIZE), .res = ESP_OK };
+    if (writer.buffer == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "text/csv");
+
+    writer.length = snprintf(writer.buffer, HISTORY_CSV_BUFFER_SIZE, "boot,uptime,time,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
+                             STATS_LABEL_HASHRATE, STATS_LABEL_ERROR_COUNT, STATS_LABEL_ASIC_TEMP, STATS_LABEL_VR_TEMP,
+                             STATS_LABEL_POWER, STATS_LABEL_VOLTAGE, STATS_LABEL_CURRENT, STATS_LABEL_ASIC_VOLTAGE,
+                             STATS_LABEL_FAN_SPEED, STATS_LABEL_FAN_RPM, STATS_LABEL_FAN2_RPM, STATS_LABEL_WIFI_RSSI,
+                             STATS_LABEL_FREE_HEAP);
+
+    esp_err_t res = readStatisticHistory(tier, boot, from, to, write_history_row, &writer);
+    if (res == ESP_ERR_NOT_FOUND) {
+        free(writer.buffer);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No statistics history");
+        return ESP_OK;
+    }
+    if (res == ESP_OK) {
+        res = writer.res;
+    }
+    if (res == ESP_OK && writer.length > 0) {
+        res = httpd_resp_send_chunk(req, writer.buffer, writer.length);
+    }
+    free(writer.buffer);
+
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Sending statistics history failed: %s", esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 esp_err_t POST_WWW_update(httpd_req_t * req)
 {
     if (is_network_allowed(req) != ESP_OK) {
@@ -1163,7 +1566,7 @@ esp_err_t start_rest_server(void * pvParameters)
     config.uri_match_fn = httpd_uri_match_wildcard;
     config.stack_size = 8192;
     config.max_open_sockets = 20;
-    config.max_uri_handlers = 20;
+    config.max_uri_handlers = 24;
     config.close_fn = websocket_close_fn;
     config.lru_purge_enable = true;
 
@@ -1199,6 +1602,15 @@ esp_err_t start_rest_server(void * pvParameters)
     };
     httpd_register_uri_handler(server, &system_asic_get_uri);
 
+    /* URI handler for fetching nonce counts per core */
+    httpd_uri_t system_asic_cores_get_uri = {
+        .uri = "/api/system/asic/cores", 
+        .method = HTTP_GET, 
+        .handler = GET_system_asic_cores, 
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &system_asic_cores_get_uri);
+
     /* URI handler for fetching system statistic values */
     httpd_uri_t system_statistics_get_uri = {
         .uri = "/api/system/statistics", 
@@ -1208,6 +1620,15 @@ esp_err_t start_rest_server(void * pvParameters)
     };
     httpd_register_uri_handler(server, &system_statistics_get_uri);
 
+    /* URI handler for the statistics history in flash */
+    httpd_uri_t system_statistics_history_get_uri = {
+        .uri = "/api/system/statistics/history",
+        .method = HTTP_GET,
+        .handler = GET_system_statistics_history,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &system_statistics_history_get_uri);
+
     /* URI handler for WiFi scan */
     httpd_uri_t wifi_scan_get_uri = {
         .uri = "/api/system/wifi/scan",
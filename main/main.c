@@ -6,7 +6,10 @@
 #include "asic_task.h"
 #include "create_jobs_task.h"
 #include "hashrate_monitor_task.h"
+#include "frequency_tuner_task.h"
+#include "nonce_range_task.h"
 #include "statistics_task.h"
+#include "statistics_history_task.h"
 #include "system.h"
 #include "http_server.h"
 #include "serial.h"
@@ -62,6 +65,8 @@ void app_main(void)
         return;
     }
 
+    pthread_mutex_init(&GLOBAL_STATE.jobs_lock, NULL);
+
     if (self_test(&GLOBAL_STATE)) return;
 
     SYSTEM_init_system(&GLOBAL_STATE);
@@ -94,8 +99,8 @@ void app_main(void)
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
-    queue_init(&GLOBAL_STATE.stratum_queue);
-    queue_init(&GLOBAL_STATE.ASIC_jobs_queue);
+    queue_init(&GLOBAL_STATE.stratum_queue, STRATUM_QUEUE_DEPTH);
+    queue_init(&GLOBAL_STATE.ASIC_jobs_queue, ASIC_JOBS_QUEUE_DEPTH);
 
     if (asic_initialize(&GLOBAL_STATE, ASIC_INIT_COLD_BOOT, 0) == 0) {
         return;
@@ -116,6 +121,15 @@ void app_main(void)
     if (xTaskCreateWithCaps(hashrate_monitor_task, "hashrate monitor", 8192, (void *) &GLOBAL_STATE, 5, NULL, MALLOC_CAP_SPIRAM) != pdPASS) {
         ESP_LOGE(TAG, "Error creating hashrate monitor task");
     }
+    if (xTaskCreateWithCaps(frequency_tuner_task, "frequency tuner", 8192, (void *) &GLOBAL_STATE, 3, NULL, MALLOC_CAP_SPIRAM) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating frequency tuner task");
+    }
+    if (xTaskCreateWithCaps(nonce_range_task, "nonce range", 8192, (void *) &GLOBAL_STATE, 3, NULL, MALLOC_CAP_SPIRAM) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating nonce range task");
+    }
+    if (xTaskCreate(statistics_history_task, "statistics history", 4096, NULL, 2, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating statistics history task");
+    }
     if (xTaskCreateWithCaps(statistics_task, "statistics", 8192, (void *) &GLOBAL_STATE, 3, NULL, MALLOC_CAP_SPIRAM) != pdPASS) {
         ESP_LOGE(TAG, "Error creating statistics task");
     }
@@ -62,6 +62,8 @@ static Settings settings[NVS_CONFIG_COUNT] = {
     [NVS_CONFIG_ASIC_FREQUENCY_FLOAT]                  = {.nvs_key_name = "asicfrequency_f", .type = TYPE_FLOAT, .default_value = {.f   = -1},                                          .rest_name = "frequency",                          .min = 1,  .max = UINT16_MAX},
     [NVS_CONFIG_ASIC_VOLTAGE]                          = {.nvs_key_name = "asicvoltage",     .type = TYPE_U16,   .default_value = {.u16 = CONFIG_ASIC_VOLTAGE},                         .rest_name = "coreVoltage",                        .min = 1,  .max = UINT16_MAX},
     [NVS_CONFIG_OVERCLOCK_ENABLED]                     = {.nvs_key_name = "oc_enabled",      .type = TYPE_BOOL,                                                                         .rest_name = "overclockEnabled",                   .min = 0,  .max = 1},
+    [NVS_CONFIG_FREQUENCY_TUNER]                       = {.nvs_key_name = "freqtuner",       .type = TYPE_BOOL,                                                                         .rest_name = "autoFrequency",                      .min = 0,  .max = 1},
+    [NVS_CONFIG_NONCE_RANGE_BENCHMARK]                 = {.nvs_key_name = "noncebench",      .type = TYPE_BOOL,                                                                         .rest_name = "nonceRangeBenchmark",                .min = 0,  .max = 1},
     
     [NVS_CONFIG_DISPLAY]                               = {.nvs_key_name = "display",         .type = TYPE_STR,   .default_value = {.str = DEFAULT_DISPLAY},                             .rest_name = "display",                            .min = 0,  .max = NVS_STR_LIMIT},
     [NVS_CONFIG_ROTATION]                              = {.nvs_key_name = "rotation",        .type = TYPE_U16,                                                                          .rest_name = "rotation",                           .min = 0,  .max = 270},
@@ -75,6 +77,7 @@ static Settings settings[NVS_CONFIG_COUNT] = {
     [NVS_CONFIG_OVERHEAT_MODE]                         = {.nvs_key_name = "overheat_mode",   .type = TYPE_BOOL,                                                                         .rest_name = "overheat_mode",                      .min = 0,  .max = 0},
 
     [NVS_CONFIG_STATISTICS_FREQUENCY]                  = {.nvs_key_name = "statsFrequency",  .type = TYPE_U16,                                                                          .rest_name = "statsFrequency",                     .min = 0,  .max = UINT16_MAX},
+    [NVS_CONFIG_STATISTICS_HISTORY]                    = {.nvs_key_name = "statsHistory",    .type = TYPE_BOOL,  .default_value = {.b   = true},                                        .rest_name = "statsHistory",                       .min = 0,  .max = 1},
 
     [NVS_CONFIG_BEST_DIFF]                             = {.nvs_key_name = "bestdiff",        .type = TYPE_U64},
     [NVS_CONFIG_SELF_TEST]                             = {.nvs_key_name = "selftest",        .type = TYPE_BOOL},
@@ -85,6 +88,9 @@ static Settings settings[NVS_CONFIG_COUNT] = {
     [NVS_CONFIG_BOARD_VERSION]                         = {.nvs_key_name = "boardversion",    .type = TYPE_STR,   .default_value = {.str = "000"}},
     [NVS_CONFIG_DEVICE_MODEL]                          = {.nvs_key_name = "devicemodel",     .type = TYPE_STR,   .default_value = {.str = "unknown"}},
     [NVS_CONFIG_ASIC_MODEL]                            = {.nvs_key_name = "asicmodel",       .type = TYPE_STR,   .default_value = {.str = "unknown"}},
+    [NVS_CONFIG_ASIC_BAUD]                             = {.nvs_key_name = "asicbaud",        .type = TYPE_I32},
+    [NVS_CONFIG_ASIC_FREQUENCY_MAP]                    = {.nvs_key_name = "asicfreqmap",     .type = TYPE_STR,   .default_value = {.str = ""}},
+    [NVS_CONFIG_ASIC_HASH_COUNTING]                    = {.nvs_key_name = "asichcn",         .type = TYPE_I32},
     [NVS_CONFIG_PLUG_SENSE]                            = {.nvs_key_name = "plug_sense",      .type = TYPE_BOOL},
     [NVS_CONFIG_ASIC_ENABLE]                           = {.nvs_key_name = "asic_enable",     .type = TYPE_BOOL},
     [NVS_CONFIG_EMC2101]                               = {.nvs_key_name = "EMC2101",         .type = TYPE_BOOL},
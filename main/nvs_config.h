@@ -28,6 +28,8 @@ typedef enum {
     NVS_CONFIG_ASIC_FREQUENCY_FLOAT,
     NVS_CONFIG_ASIC_VOLTAGE,
     NVS_CONFIG_OVERCLOCK_ENABLED,
+    NVS_CONFIG_FREQUENCY_TUNER,
+    NVS_CONFIG_NONCE_RANGE_BENCHMARK,
     
     NVS_CONFIG_DISPLAY,
     NVS_CONFIG_ROTATION,
@@ -41,6 +43,7 @@ typedef enum {
     NVS_CONFIG_OVERHEAT_MODE,
     
     NVS_CONFIG_STATISTICS_FREQUENCY,
+    NVS_CONFIG_STATISTICS_HISTORY,
     
     NVS_CONFIG_BEST_DIFF,
     NVS_CONFIG_SELF_TEST,
@@ -51,6 +54,9 @@ typedef enum {
     NVS_CONFIG_BOARD_VERSION,
     NVS_CONFIG_DEVICE_MODEL,
     NVS_CONFIG_ASIC_MODEL,
+    NVS_CONFIG_ASIC_BAUD,
+    NVS_CONFIG_ASIC_FREQUENCY_MAP,
+    NVS_CONFIG_ASIC_HASH_COUNTING,
 
     NVS_CONFIG_PLUG_SENSE,
     NVS_CONFIG_ASIC_ENABLE,
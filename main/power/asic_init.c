@@ -1,18 +1,73 @@
 #include "asic_init.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "asic.h"
 #include "serial.h"
 #include "asic_reset.h"
+#include "nvs_config.h"
+
+// Chip id probes run on every boot to check the stored baud rate
+#define LINK_CHECK_PROBES 8
 
 static const char *TAG = "asic_init";
 
+static bool restart_asics(GlobalState *GLOBAL_STATE)
+{
+    if (asic_reset() != ESP_OK) {
+        return false;
+    }
+    SERIAL_set_baud(UART_FREQ);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+    return ASIC_init(GLOBAL_STATE) > 0;
+}
+
+// Use the baud rate stored for this board. It is calibrated on the first boot,
+// and again whenever the stored rate fails the link check.
+static bool negotiate_baud(GlobalState *GLOBAL_STATE)
+{
+    bm13xx_link_quality_t quality;
+    int baud = nvs_config_get_i32(NVS_CONFIG_ASIC_BAUD);
+
+    if (baud > 0 && ASIC_set_baud(GLOBAL_STATE, baud) == baud && ASIC_probe_link(GLOBAL_STATE, LINK_CHECK_PROBES, &quality)) {
+        ESP_LOGI(TAG, "UART at stored %d baud, round trip %lu us", baud, quality.round_trip_us);
+        return true;
+    }
+
+    if (baud > 0) {
+        // The chips may be on a rate the link doesn't carry, start over from reset
+        ESP_LOGW(TAG, "Stored baud %d failed the link check, recalibrating", baud);
+        if (!restart_asics(GLOBAL_STATE)) {
+            return false;
+        }
+    }
+
+    baud = ASIC_calibrate_baud(GLOBAL_STATE);
+    if (baud == 0) {
+        return false;
+    }
+
+    if (!ASIC_probe_link(GLOBAL_STATE, LINK_CHECK_PROBES, &quality)) {
+        // Switching back from the rate that failed didn't reach the chips
+        ESP_LOGW(TAG, "Lost the chips after calibration, restarting them at %d baud", baud);
+        if (!restart_asics(GLOBAL_STATE) || ASIC_set_baud(GLOBAL_STATE, baud) != baud
+            || !ASIC_probe_link(GLOBAL_STATE, LINK_CHECK_PROBES, &quality)) {
+            return false;
+        }
+    }
+
+    nvs_config_set_i32(NVS_CONFIG_ASIC_BAUD, baud);
+    ESP_LOGI(TAG, "UART at calibrated %d baud, round trip %lu us", baud, quality.round_trip_us);
+    return true;
+}
+
 uint8_t asic_initialize(GlobalState *GLOBAL_STATE, asic_init_mode_t mode, uint32_t stabilization_delay_ms)
 {
     const char *mode_str = (mode == ASIC_INIT_COLD_BOOT) ? "cold boot" : "recovery";
     ESP_LOGI(TAG, "Starting ASIC initialization (%s mode)", mode_str);
 
+    int64_t start_us = esp_timer_get_time();
     if (asic_reset() != ESP_OK) {
         GLOBAL_STATE->SYSTEM_MODULE.asic_status = "ASIC reset failed";
         ESP_LOGE(TAG, "ASIC reset failed!");
@@ -42,6 +97,7 @@ uint8_t asic_initialize(GlobalState *GLOBAL_STATE, asic_init_mode_t mode, uint32
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
+    int64_t init_start_us = esp_timer_get_time();
     ESP_LOGI(TAG, "Detecting ASIC chips...");
     uint8_t chip_count = ASIC_init(GLOBAL_STATE);
     
@@ -51,10 +107,26 @@ uint8_t asic_initialize(GlobalState *GLOBAL_STATE, asic_init_mode_t mode, uint32
         return 0;
     }
 
-    ESP_LOGI(TAG, "Setting max baud rate and clearing buffers");
-    SERIAL_set_baud(ASIC_set_max_baud(GLOBAL_STATE));
+    int64_t baud_start_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Negotiating baud rate and clearing buffers");
+    if (!negotiate_baud(GLOBAL_STATE)) {
+        ESP_LOGE(TAG, "ASIC initialization failed - no working baud rate");
+        GLOBAL_STATE->SYSTEM_MODULE.asic_status = "UART link failed";
+        return 0;
+    }
     SERIAL_clear_buffer();
 
+    // Register 0x10 value the nonce range benchmark picked for this board
+    int32_t hash_counting = nvs_config_get_i32(NVS_CONFIG_ASIC_HASH_COUNTING);
+    if (hash_counting > 0) {
+        ASIC_set_hash_counting(GLOBAL_STATE, hash_counting);
+    }
+
+    int64_t end_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Initialization took %lld ms: reset and UART %lld ms, chips %lld ms, baud %lld ms",
+             (end_us - start_us) / 1000, (init_start_us - start_us) / 1000,
+             (baud_start_us - init_start_us) / 1000, (end_us - baud_start_us) / 1000);
+
     GLOBAL_STATE->ASIC_initalized = true;
     
     if (stabilization_delay_ms > 0) {
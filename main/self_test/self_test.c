@@ -344,14 +344,6 @@ bool self_test(void * pvParameters)
         tests_done(GLOBAL_STATE, false);
     }
 
-    GLOBAL_STATE->ASIC_TASK_MODULE.active_jobs = malloc(sizeof(bm_job *) * 128);
-    GLOBAL_STATE->valid_jobs = malloc(sizeof(uint8_t) * 128);
-
-    for (int i = 0; i < 128; i++) {
-        GLOBAL_STATE->ASIC_TASK_MODULE.active_jobs[i] = NULL;
-        GLOBAL_STATE->valid_jobs[i] = 0;
-    }
-
     vTaskDelay(1000 / portTICK_PERIOD_MS);
 
     mining_notify notify_message;
@@ -433,9 +425,8 @@ bool self_test(void * pvParameters)
         tests_done(GLOBAL_STATE, false);
     }
 
-    free(GLOBAL_STATE->ASIC_TASK_MODULE.active_jobs);
-    free(GLOBAL_STATE->valid_jobs);
-
+    // The test job lives on this stack
+    memset(GLOBAL_STATE->ASIC_TASK_MODULE.jobs, 0, sizeof(GLOBAL_STATE->ASIC_TASK_MODULE.jobs));
 
     float asic_temp = Thermal_get_chip_temp(GLOBAL_STATE);
     ESP_LOGI(TAG, "ASIC Temp %f", asic_temp);
@@ -9,7 +9,7 @@ esp_err_t SYSTEM_init_peripherals(GlobalState * GLOBAL_STATE);
 
 void SYSTEM_notify_accepted_share(GlobalState * GLOBAL_STATE);
 void SYSTEM_notify_rejected_share(GlobalState * GLOBAL_STATE, char * error_msg);
-void SYSTEM_notify_found_nonce(GlobalState * GLOBAL_STATE, double diff, uint8_t job_id);
+void SYSTEM_notify_found_nonce(GlobalState * GLOBAL_STATE, double diff, const bm_job * job);
 void SYSTEM_notify_new_ntime(GlobalState * GLOBAL_STATE, uint32_t ntime);
 
 #endif /* SYSTEM_H_ */
@@ -40,16 +40,62 @@ void ASIC_result_task(void *pvParameters)
 
         uint8_t job_id = asic_result->job_id;
 
-        if (GLOBAL_STATE->valid_jobs[job_id] == 0)
+        uint32_t dispatch_seq;
+        bm_job *active_job = asic_job_lookup(&GLOBAL_STATE->ASIC_TASK_MODULE, job_id, &dispatch_seq);
+        if (active_job == NULL || dispatch_seq != asic_result->dispatch_seq)
         {
             ESP_LOGW(TAG, "Invalid job nonce found, 0x%02X", job_id);
             continue;
         }
 
-        bm_job *active_job = GLOBAL_STATE->ASIC_TASK_MODULE.active_jobs[job_id];
+        asic_chip_job_t *chip_job = NULL;
+        if (GLOBAL_STATE->ASIC_TASK_MODULE.chip_jobs != NULL && asic_result->asic_nr < GLOBAL_STATE->DEVICE_CONFIG.family.asic_count) {
+            chip_job = &GLOBAL_STATE->ASIC_TASK_MODULE.chip_jobs[asic_result->asic_nr];
+        }
+
+        // A result already seen would only be hashed again and rejected by the pool as a duplicate share
+        if (asic_job_seen(&GLOBAL_STATE->ASIC_TASK_MODULE, job_id, dispatch_seq, asic_result->nonce, asic_result->rolled_version))
+        {
+            ESP_LOGD(TAG, "Duplicate nonce %08" PRIX32 " from ASIC %d, job 0x%02X", asic_result->nonce, asic_result->asic_nr, job_id);
+            GLOBAL_STATE->ASIC_TASK_MODULE.duplicate_nonces++;
+            if (chip_job != NULL) {
+                chip_job->duplicates++;
+            }
+            continue;
+        }
+
+        if (chip_job != NULL) {
+            // Late nonces for older jobs don't move the chip back
+            if (chip_job->nonces == 0 || (int32_t)(dispatch_seq - chip_job->dispatch_seq) > 0) {
+                chip_job->job_id = job_id;
+                chip_job->dispatch_seq = dispatch_seq;
+            }
+            chip_job->nonces++;
+        }
         // check the nonce difficulty
         double nonce_diff = test_nonce_value(active_job, asic_result->nonce, asic_result->rolled_version);
 
+        // The ASIC task may have replaced the job meanwhile, what was read from it can't be trusted
+        if (!asic_job_unchanged(&GLOBAL_STATE->ASIC_TASK_MODULE, job_id, dispatch_seq))
+        {
+            ESP_LOGW(TAG, "Job 0x%02X replaced while checking its nonce", job_id);
+            continue;
+        }
+
+        // Anything below the ticket mask the job was hashed at is a hardware error, not work done
+        if (nonce_diff >= active_job->asic_diff) {
+            GLOBAL_STATE->ASIC_TASK_MODULE.valid_nonces++;
+            GLOBAL_STATE->ASIC_TASK_MODULE.valid_work += active_job->asic_diff;
+            if (chip_job != NULL) {
+                chip_job->valid_nonces++;
+                chip_job->valid_work += active_job->asic_diff;
+
+                if (GLOBAL_STATE->ASIC_TASK_MODULE.core_nonces != NULL) {
+                    asic_core_nonces(&GLOBAL_STATE->ASIC_TASK_MODULE, asic_result->asic_nr, asic_result->core_id)[asic_result->small_core_id % ASIC_SMALL_CORE_SLOTS]++;
+                }
+            }
+        }
+
         //log the ASIC response
         ESP_LOGI(TAG, "ID: %s, ASIC nr: %d, ver: %08" PRIX32 " Nonce %08" PRIX32 " diff %.1f of %ld.", active_job->jobid, asic_result->asic_nr, asic_result->rolled_version, asic_result->nonce, nonce_diff, active_job->pool_diff);
 
@@ -72,6 +118,6 @@ void ASIC_result_task(void *pvParameters)
             }
         }
 
-        SYSTEM_notify_found_nonce(GLOBAL_STATE, nonce_diff, job_id);
+        SYSTEM_notify_found_nonce(GLOBAL_STATE, nonce_diff, active_job);
     }
 }
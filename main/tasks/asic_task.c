@@ -2,17 +2,91 @@
 #include "work_queue.h"
 #include "serial.h"
 #include <string.h>
+#include <math.h>
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "asic.h"
 
+// Valid nonces per second on the whole chain. Below the band the hashrate the nonces
+// prove is too noisy, above it the UART and the result task work for nothing.
+#define TICKET_WINDOW_MS 10000
+#define TICKET_RATE_MIN 4.0
+#define TICKET_RATE_MAX 16.0
+#define TICKET_DIFFICULTY_MIN 8
+#define TICKET_DIFFICULTY_MAX (1 << 20)
+
 static const char *TAG = "asic_task";
 
-// static bm_job ** active_jobs; is required to keep track of the active jobs since the
+typedef struct
+{
+    int64_t window_start_us;
+    uint32_t window_nonces;
+    // What the rate asks for, before the pool difficulty caps it
+    uint32_t difficulty;
+} ticket_control_t;
+
+// Difficulty for the result rate of the window just ended, powers of 2 so the
+// band is wider than one step and a single change lands inside it
+static void update_ticket_target(AsicTaskModule *module, ticket_control_t *control, uint32_t current)
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = now_us - control->window_start_us;
+    if (elapsed_us < TICKET_WINDOW_MS * 1000LL) {
+        return;
+    }
+
+    uint32_t nonces = module->valid_nonces - control->window_nonces;
+    control->window_start_us = now_us;
+    control->window_nonces = module->valid_nonces;
+
+    double rate = nonces * 1e6 / elapsed_us;
+    module->result_rate = rate;
+    if (rate >= TICKET_RATE_MIN && rate <= TICKET_RATE_MAX) {
+        return;
+    }
+
+    // Nothing came back, perhaps the chips were idle, one step at a time then
+    double difficulty = nonces > 0 ? current * rate / sqrt(TICKET_RATE_MIN * TICKET_RATE_MAX) : current / 2.0;
+    difficulty = fmin(fmax(difficulty, TICKET_DIFFICULTY_MIN), TICKET_DIFFICULTY_MAX);
+    control->difficulty = _largest_power_of_two((int) difficulty);
+}
+
+// Moves the ticket mask toward the target, never above the pool difficulty of the
+// job. Lowering goes before the job is sent and raising after, so the chips never
+// hash a job at a mask above its pool difficulty. Returns the difficulty to stamp
+// on the job, the mask it is hashed at. That is the raised one when a raise follows
+// the send, the few nonces found before it lands fall below it and go uncounted.
+static uint32_t ticket_mask_before_send(GlobalState *GLOBAL_STATE, ticket_control_t *control, const bm_job *job, uint32_t *raise_to)
+{
+    uint32_t current = ASIC_get_difficulty(GLOBAL_STATE);
+    *raise_to = 0;
+    if (current == 0) {
+        return 0;
+    }
+    if (control->difficulty == 0) {
+        control->difficulty = current;
+    }
+
+    update_ticket_target(&GLOBAL_STATE->ASIC_TASK_MODULE, control, current);
+
+    uint32_t difficulty = control->difficulty;
+    if (job->pool_diff > 0 && job->pool_diff < difficulty) {
+        difficulty = _largest_power_of_two(job->pool_diff);
+    }
+
+    if (difficulty < current) {
+        current = ASIC_set_difficulty(GLOBAL_STATE, difficulty);
+    } else if (difficulty > current) {
+        *raise_to = difficulty;
+        return difficulty;
+    }
+    return current;
+}
 
 void ASIC_task(void *pvParameters)
 {
@@ -21,15 +95,13 @@ void ASIC_task(void *pvParameters)
     //initialize the semaphore
     GLOBAL_STATE->ASIC_TASK_MODULE.semaphore = xSemaphoreCreateBinary();
 
-    GLOBAL_STATE->ASIC_TASK_MODULE.active_jobs = heap_caps_malloc(sizeof(bm_job *) * 128, MALLOC_CAP_SPIRAM);
-    GLOBAL_STATE->valid_jobs = heap_caps_malloc(sizeof(uint8_t) * 128, MALLOC_CAP_SPIRAM);
-    for (int i = 0; i < 128; i++)
-    {
-        GLOBAL_STATE->ASIC_TASK_MODULE.active_jobs[i] = NULL;
-        GLOBAL_STATE->valid_jobs[i] = 0;
-    }
+    GLOBAL_STATE->ASIC_TASK_MODULE.chip_jobs = heap_caps_calloc(GLOBAL_STATE->DEVICE_CONFIG.family.asic_count, sizeof(asic_chip_job_t), MALLOC_CAP_SPIRAM);
+    GLOBAL_STATE->ASIC_TASK_MODULE.core_nonces = heap_caps_calloc(GLOBAL_STATE->DEVICE_CONFIG.family.asic_count * ASIC_CORE_SLOTS * ASIC_SMALL_CORE_SLOTS, sizeof(uint32_t), MALLOC_CAP_SPIRAM);
 
     double asic_job_frequency_ms = ASIC_get_asic_job_frequency_ms(GLOBAL_STATE);
+    GLOBAL_STATE->ASIC_TASK_MODULE.job_interval_ms = asic_job_frequency_ms;
+
+    ticket_control_t ticket_control = { .window_start_us = esp_timer_get_time() };
 
     ESP_LOGI(TAG, "ASIC Job Interval: %.2f ms", asic_job_frequency_ms);
     ESP_LOGI(TAG, "ASIC Ready!");
@@ -45,11 +117,35 @@ void ASIC_task(void *pvParameters)
         bm_job *next_bm_job = (bm_job *)queue_dequeue(&GLOBAL_STATE->ASIC_jobs_queue);
     
         //(*GLOBAL_STATE->ASIC_functions.send_work_fn)(GLOBAL_STATE, next_bm_job); // send the job to the ASIC
+        TickType_t dispatch_tick = xTaskGetTickCount();
+        next_bm_job->dispatch_seq = ++GLOBAL_STATE->ASIC_TASK_MODULE.dispatch_seq;
+        uint32_t raise_to;
+        next_bm_job->asic_diff = ticket_mask_before_send(GLOBAL_STATE, &ticket_control, next_bm_job, &raise_to);
         ASIC_send_work(GLOBAL_STATE, next_bm_job);
+        if (raise_to != 0) {
+            ASIC_set_difficulty(GLOBAL_STATE, raise_to);
+        }
+        GLOBAL_STATE->ASIC_TASK_MODULE.ticket_difficulty = ASIC_get_difficulty(GLOBAL_STATE);
 
-        // Time to execute the above code is ~0.3ms
-        // Delay for ASIC(s) to finish the job
-        //vTaskDelay((asic_job_frequency_ms - 0.3) / portTICK_PERIOD_MS);
-        xSemaphoreTake(GLOBAL_STATE->ASIC_TASK_MODULE.semaphore, asic_job_frequency_ms / portTICK_PERIOD_MS);
+        // Frequency and version mask change at runtime, so the time the chips
+        // need to exhaust a job is recomputed for every dispatch
+        double job_interval_ms = ASIC_get_asic_job_frequency_ms(GLOBAL_STATE);
+        if (job_interval_ms != asic_job_frequency_ms) {
+            ESP_LOGI(TAG, "ASIC Job Interval: %.2f ms", job_interval_ms);
+            asic_job_frequency_ms = job_interval_ms;
+            GLOBAL_STATE->ASIC_TASK_MODULE.job_interval_ms = job_interval_ms;
+        }
+
+        // Wait until just before the chips run out of work, measured from the dispatch
+        // so the send time is not added on top. A clean_jobs gives the semaphore and
+        // dispatches the new work right away.
+        TickType_t interval_ticks = pdMS_TO_TICKS(asic_job_frequency_ms);
+        if (interval_ticks == 0) {
+            interval_ticks = 1;
+        }
+        TickType_t elapsed_ticks = xTaskGetTickCount() - dispatch_tick;
+        if (elapsed_ticks < interval_ticks) {
+            xSemaphoreTake(GLOBAL_STATE->ASIC_TASK_MODULE.semaphore, interval_ticks - elapsed_ticks);
+        }
     }
 }
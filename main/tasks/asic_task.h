@@ -1,19 +1,191 @@
 #ifndef ASIC_TASK_H_
 #define ASIC_TASK_H_
 
+#include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "mining.h"
+
+// Job ids are multiples of 4 below 128 on every chip, that's all the result
+// frames can encode: 16 distinct ids on the BM1366/BM1368/BM1370, 32 on the BM1397
+#define ASIC_JOB_ID_STEP 4
+#define ASIC_JOB_SLOTS (128 / ASIC_JOB_ID_STEP)
+// Results remembered per job, duplicates come back within a few results of the original
+#define ASIC_JOB_RESULTS 8
+
+// Nonce attribution, the core id is 7 bits of the nonce and the small core
+// takes up to 4 bits of the result id byte
+#define ASIC_CORE_SLOTS 128
+#define ASIC_SMALL_CORE_SLOTS 16
+
+typedef struct
+{
+    bm_job *job;
+    // job_generation the job was sent in, a clean job starts a new one
+    uint32_t generation;
+    // dispatch_seq of the job, changes whenever the slot is reused
+    uint32_t dispatch_seq;
+} asic_job_slot_t;
+
+typedef struct
+{
+    // dispatch_seq of the job the results belong to, a reused slot starts over
+    uint32_t dispatch_seq;
+    uint32_t count;
+    uint32_t nonces[ASIC_JOB_RESULTS];
+    uint32_t versions[ASIC_JOB_RESULTS];
+} asic_job_results_t;
+
+typedef struct
+{
+    // Job frames carry no chip address, every chip on the chain works on every job.
+    // This tracks the newest job each chip has returned a nonce for.
+    uint8_t job_id;
+    uint32_t dispatch_seq;
+    uint32_t nonces;
+    // Results this chip returned again, dropped before they are checked
+    uint32_t duplicates;
+    // Nonces that met the ticket mask, and the difficulty 1 shares they are worth
+    uint32_t valid_nonces;
+    uint32_t valid_work;
+} asic_chip_job_t;
+
 typedef struct
 {
     // ASIC may not return the nonce in the same order as the jobs were sent
     // it also may return a previous nonce under some circumstances
-    // so we keep a list of jobs indexed by the job id
-    bm_job **active_jobs;
+    // so we keep the jobs by job id. Only the ASIC task writes the slots,
+    // the result task reads them without a lock.
+    asic_job_slot_t jobs[ASIC_JOB_SLOTS];
+    uint32_t job_generation;
+    // The job the result task looked up last, and a replaced job kept for it until it moves on
+    bm_job *job_in_use;
+    bm_job *retired_job;
+    // Recent results per slot, only the result task touches these
+    asic_job_results_t results[ASIC_JOB_SLOTS];
     //semaphone
     SemaphoreHandle_t semaphore;
+    uint32_t dispatch_seq;
+    // Per chip, a chip lagging behind the latest dispatch is slow to pick up new work
+    asic_chip_job_t *chip_jobs;
+    // Current dispatch interval, derived from frequency, core count and version rolling range
+    double job_interval_ms;
+    // Nonces that met the ticket mask, and the difficulty 1 shares (2^32 hashes) they are worth together
+    uint32_t valid_nonces;
+    uint32_t valid_work;
+    // Ticket mask difficulty on the chips, tuned so valid nonces arrive at result_rate per second within a band
+    uint32_t ticket_difficulty;
+    float result_rate;
+    // Results dropped as already seen for their job
+    uint32_t duplicate_nonces;
+    // Nonces that met the ticket mask per chip, core and small core, asic_count x ASIC_CORE_SLOTS x ASIC_SMALL_CORE_SLOTS
+    uint32_t *core_nonces;
 } AsicTaskModule;
 
 void ASIC_task(void *pvParameters);
 
+static inline asic_job_slot_t * asic_job_slot(AsicTaskModule *module, uint8_t job_id)
+{
+    return &module->jobs[(job_id / ASIC_JOB_ID_STEP) % ASIC_JOB_SLOTS];
+}
+
+// The job last sent under job_id, NULL if there is none or a clean job dropped it.
+// A reader checks asic_job_unchanged before acting on what it read from the job.
+// Only the result task looks jobs up: the job stays allocated until its next lookup,
+// even if the slot is reused meanwhile.
+static inline bm_job * asic_job_lookup(AsicTaskModule *module, uint8_t job_id, uint32_t *dispatch_seq)
+{
+    if (job_id >= 128 || job_id % ASIC_JOB_ID_STEP != 0) {
+        __atomic_store_n(&module->job_in_use, NULL, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+    asic_job_slot_t *slot = asic_job_slot(module, job_id);
+    *dispatch_seq = __atomic_load_n(&slot->dispatch_seq, __ATOMIC_SEQ_CST);
+    bm_job *job = __atomic_load_n(&slot->job, __ATOMIC_SEQ_CST);
+
+    // Published before the slot is checked again, so either the ASIC task sees
+    // the job in use when it replaces it, or the check here sees the replacement
+    __atomic_store_n(&module->job_in_use, job, __ATOMIC_SEQ_CST);
+    if (job == NULL || __atomic_load_n(&slot->job, __ATOMIC_SEQ_CST) != job ||
+        slot->generation != __atomic_load_n(&module->job_generation, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&module->job_in_use, NULL, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+    return job;
+}
+
+// False if the slot was given to a newer job since the lookup, or a clean job dropped it
+static inline bool asic_job_unchanged(AsicTaskModule *module, uint8_t job_id, uint32_t dispatch_seq)
+{
+    asic_job_slot_t *slot = asic_job_slot(module, job_id);
+    return __atomic_load_n(&slot->dispatch_seq, __ATOMIC_ACQUIRE) == dispatch_seq &&
+           slot->generation == __atomic_load_n(&module->job_generation, __ATOMIC_ACQUIRE);
+}
+
+// Frees a job that left its slot, unless the result task still holds it. Only
+// one job can be held at a time, so one kept back is enough.
+static inline void asic_job_retire(AsicTaskModule *module, bm_job *job)
+{
+    bm_job *in_use = __atomic_load_n(&module->job_in_use, __ATOMIC_SEQ_CST);
+    if (module->retired_job != NULL && module->retired_job != in_use) {
+        free_bm_job(module->retired_job);
+        module->retired_job = NULL;
+    }
+    if (job == NULL) {
+        return;
+    }
+    if (job == in_use) {
+        module->retired_job = job;
+    } else {
+        free_bm_job(job);
+    }
+}
+
+// Stores the job, the one it replaces is freed once the result task is done with it
+static inline void asic_job_store(AsicTaskModule *module, uint8_t job_id, bm_job *job)
+{
+    asic_job_slot_t *slot = asic_job_slot(module, job_id);
+    bm_job *old_job = slot->job;
+    __atomic_store_n(&slot->job, job, __ATOMIC_SEQ_CST);
+    slot->generation = __atomic_load_n(&module->job_generation, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&slot->dispatch_seq, job->dispatch_seq, __ATOMIC_SEQ_CST);
+    asic_job_retire(module, old_job);
+}
+
+// ASIC_SMALL_CORE_SLOTS counters of one core
+static inline uint32_t * asic_core_nonces(AsicTaskModule *module, uint8_t asic_nr, uint8_t core_id)
+{
+    return &module->core_nonces[((size_t)asic_nr * ASIC_CORE_SLOTS + core_id % ASIC_CORE_SLOTS) * ASIC_SMALL_CORE_SLOTS];
+}
+
+// Small cores with overlapping ranges and chains can return the same result
+// more than once, true if (nonce, version) was seen for this dispatch already.
+// Otherwise the result is remembered, the oldest one drops out.
+static inline bool asic_job_seen(AsicTaskModule *module, uint8_t job_id, uint32_t dispatch_seq, uint32_t nonce, uint32_t version)
+{
+    asic_job_results_t *results = &module->results[(job_id / ASIC_JOB_ID_STEP) % ASIC_JOB_SLOTS];
+    if (results->dispatch_seq != dispatch_seq) {
+        results->dispatch_seq = dispatch_seq;
+        results->count = 0;
+    }
+
+    uint32_t stored = results->count < ASIC_JOB_RESULTS ? results->count : ASIC_JOB_RESULTS;
+    for (uint32_t i = 0; i < stored; i++) {
+        if (results->nonces[i] == nonce && results->versions[i] == version) {
+            return true;
+        }
+    }
+
+    results->nonces[results->count % ASIC_JOB_RESULTS] = nonce;
+    results->versions[results->count % ASIC_JOB_RESULTS] = version;
+    results->count++;
+    return false;
+}
+
+// Every job sent so far becomes stale at once
+static inline void asic_job_invalidate_all(AsicTaskModule *module)
+{
+    __atomic_add_fetch(&module->job_generation, 1, __ATOMIC_RELEASE);
+}
+
 #endif /* ASIC_TASK_H_ */
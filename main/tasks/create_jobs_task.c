@@ -1,10 +1,12 @@
 #include <sys/time.h>
 #include <limits.h>
+#include <stdatomic.h>
 
 #include "work_queue.h"
 #include "global_state.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "mining.h"
 #include "string.h"
 
@@ -13,14 +15,171 @@
 static const char *TAG = "create_jobs_task";
 
 #define QUEUE_LOW_WATER_MARK 10 // Adjust based on your requirements
+#define MAX_JOB_BUILDERS portNUM_PROCESSORS
+#define EMA_ALPHA 8
+
+typedef struct
+{
+    GlobalState *GLOBAL_STATE;
+    TaskHandle_t builders[MAX_JOB_BUILDERS];
+
+    // Current template, owned by create_jobs_task. Only valid while running is set.
+    mining_notify *notification;
+    uint32_t difficulty;
+    // Copied from the stratum state when the pool starts, stratum_task replaces them any time
+    char *extranonce_str;
+    int extranonce_2_len;
+    uint32_t version_mask;
+    atomic_bool running;
+    atomic_int active_builders;
+
+    // Each builder claims the next extranonce_2 and waits for its turn to enqueue,
+    // so jobs reach the ASIC queue in extranonce_2 order.
+    atomic_uint_fast64_t next_extranonce_2;
+    atomic_uint_fast64_t next_enqueue;
+
+    // Refill burst measurement
+    atomic_bool refill_active;
+    int64_t refill_start_us;
+    uint64_t refill_start_jobs;
+} job_builder_pool_t;
+
+static job_builder_pool_t job_builder_pool;
 
 static bool should_generate_more_work(GlobalState *GLOBAL_STATE);
-static void generate_work(GlobalState *GLOBAL_STATE, mining_notify *notification, uint64_t extranonce_2, uint32_t difficulty);
+static bm_job *generate_work(const job_builder_pool_t *pool, uint64_t extranonce_2);
+
+static void wake_job_builders()
+{
+    for (int i = 0; i < MAX_JOB_BUILDERS; i++) {
+        if (job_builder_pool.builders[i] != NULL) {
+            xTaskNotifyGive(job_builder_pool.builders[i]);
+        }
+    }
+}
+
+static void update_build_time(JobsTaskModule *JOBS_TASK_MODULE, int64_t build_time_us)
+{
+    float build_time_ms = build_time_us / 1000.0f;
+    if (JOBS_TASK_MODULE->job_build_time_ms == 0) {
+        JOBS_TASK_MODULE->job_build_time_ms = build_time_ms;
+    } else {
+        JOBS_TASK_MODULE->job_build_time_ms += (build_time_ms - JOBS_TASK_MODULE->job_build_time_ms) / EMA_ALPHA;
+    }
+}
+
+static void job_builder_task(void *pvParameters)
+{
+    GlobalState *GLOBAL_STATE = job_builder_pool.GLOBAL_STATE;
+    JobsTaskModule *JOBS_TASK_MODULE = &GLOBAL_STATE->JOBS_TASK_MODULE;
+
+    while (1)
+    {
+        if (!atomic_load(&job_builder_pool.running) || !should_generate_more_work(GLOBAL_STATE)) {
+            // Woken by create_jobs_task on new work, otherwise recheck the queue level
+            ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        atomic_fetch_add(&job_builder_pool.active_builders, 1);
+        if (!atomic_load(&job_builder_pool.running)) {
+            atomic_fetch_sub(&job_builder_pool.active_builders, 1);
+            continue;
+        }
+
+        uint64_t extranonce_2 = atomic_fetch_add(&job_builder_pool.next_extranonce_2, 1);
+
+        int64_t build_start_us = esp_timer_get_time();
+        bm_job *next_job = generate_work(&job_builder_pool, extranonce_2);
+        int64_t build_time_us = esp_timer_get_time() - build_start_us;
+
+        // Every enqueue and pool stop wakes all builders, the timeout is only a safety net
+        while (atomic_load(&job_builder_pool.next_enqueue) != extranonce_2 && atomic_load(&job_builder_pool.running)) {
+            ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS);
+        }
+
+        if (next_job != NULL) {
+            if (atomic_load(&job_builder_pool.running)) {
+                queue_enqueue(&GLOBAL_STATE->ASIC_jobs_queue, next_job);
+
+                JOBS_TASK_MODULE->jobs_built++;
+                update_build_time(JOBS_TASK_MODULE, build_time_us);
+
+                if (atomic_load(&job_builder_pool.refill_active) && queue_count(&GLOBAL_STATE->ASIC_jobs_queue) >= QUEUE_LOW_WATER_MARK) {
+                    int64_t refill_time_us = esp_timer_get_time() - job_builder_pool.refill_start_us;
+                    uint64_t refill_jobs = JOBS_TASK_MODULE->jobs_built - job_builder_pool.refill_start_jobs;
+                    if (refill_time_us > 0) {
+                        JOBS_TASK_MODULE->refill_rate = refill_jobs * 1000000.0f / refill_time_us;
+                    }
+                    atomic_store(&job_builder_pool.refill_active, false);
+                }
+            } else {
+                free(next_job->jobid);
+                free(next_job->extranonce2);
+                free(next_job);
+            }
+        }
+
+        atomic_store(&job_builder_pool.next_enqueue, extranonce_2 + 1);
+        atomic_fetch_sub(&job_builder_pool.active_builders, 1);
+        wake_job_builders();
+    }
+}
+
+static void job_builder_pool_start(GlobalState *GLOBAL_STATE, mining_notify *notification, uint32_t difficulty)
+{
+    job_builder_pool.notification = notification;
+    job_builder_pool.difficulty = difficulty;
+
+    // No builder runs while the pool is stopped, the previous copy can go
+    free(job_builder_pool.extranonce_str);
+    job_builder_pool.extranonce_str = strdup(GLOBAL_STATE->extranonce_str != NULL ? GLOBAL_STATE->extranonce_str : "");
+    job_builder_pool.extranonce_2_len = GLOBAL_STATE->extranonce_2_len;
+    job_builder_pool.version_mask = GLOBAL_STATE->version_mask;
+    if (job_builder_pool.extranonce_str == NULL) {
+        ESP_LOGE(TAG, "Failed to copy the extranonce");
+        return;
+    }
+    atomic_store(&job_builder_pool.next_extranonce_2, 0);
+    atomic_store(&job_builder_pool.next_enqueue, 0);
+
+    bool refill = queue_count(&GLOBAL_STATE->ASIC_jobs_queue) < QUEUE_LOW_WATER_MARK;
+    job_builder_pool.refill_start_us = esp_timer_get_time();
+    job_builder_pool.refill_start_jobs = GLOBAL_STATE->JOBS_TASK_MODULE.jobs_built;
+    atomic_store(&job_builder_pool.refill_active, refill);
+
+    atomic_store(&job_builder_pool.running, true);
+    wake_job_builders();
+}
+
+static void job_builder_pool_stop()
+{
+    atomic_store(&job_builder_pool.running, false);
+    wake_job_builders();
+
+    // The notification is freed by the caller, wait until no builder uses it anymore
+    while (atomic_load(&job_builder_pool.active_builders) > 0) {
+        vTaskDelay(1);
+    }
+}
 
 void create_jobs_task(void *pvParameters)
 {
     GlobalState *GLOBAL_STATE = (GlobalState *)pvParameters;
 
+    job_builder_pool.GLOBAL_STATE = GLOBAL_STATE;
+    for (int i = 0; i < MAX_JOB_BUILDERS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "job builder %d", i);
+        if (xTaskCreatePinnedToCore(job_builder_task, name, 8192, NULL, uxTaskPriorityGet(NULL), &job_builder_pool.builders[i], i) != pdPASS) {
+            ESP_LOGE(TAG, "Error creating job builder on core %d", i);
+            job_builder_pool.builders[i] = NULL;
+            continue;
+        }
+        GLOBAL_STATE->JOBS_TASK_MODULE.builder_count++;
+    }
+    ESP_LOGI(TAG, "Started %d job builders", GLOBAL_STATE->JOBS_TASK_MODULE.builder_count);
+
     uint32_t difficulty = GLOBAL_STATE->pool_difficulty;
     while (1)
     {
@@ -46,23 +205,16 @@ void create_jobs_task(void *pvParameters)
             GLOBAL_STATE->new_stratum_version_rolling_msg = false;
         }
 
-        uint64_t extranonce_2 = 0;
-        while (GLOBAL_STATE->stratum_queue.count < 1 && GLOBAL_STATE->abandon_work == 0)
-        {
-            if (should_generate_more_work(GLOBAL_STATE))
-            {
-                generate_work(GLOBAL_STATE, mining_notification, extranonce_2, difficulty);
+        job_builder_pool_start(GLOBAL_STATE, mining_notification, difficulty);
 
-                // Increase extranonce_2 for the next job.
-                extranonce_2++;
-            }
-            else
-            {
-                // If no more work needed, wait a bit before checking again.
-                vTaskDelay(100 / portTICK_PERIOD_MS);
-            }
+        // Woken by the next notification or by stratum_task abandoning the work
+        while (queue_count(&GLOBAL_STATE->stratum_queue) < 1 && GLOBAL_STATE->abandon_work == 0)
+        {
+            queue_wait(&GLOBAL_STATE->stratum_queue);
         }
 
+        job_builder_pool_stop();
+
         if (GLOBAL_STATE->abandon_work == 1)
         {
             GLOBAL_STATE->abandon_work = 0;
@@ -76,41 +228,43 @@ void create_jobs_task(void *pvParameters)
 
 static bool should_generate_more_work(GlobalState *GLOBAL_STATE)
 {
-    return GLOBAL_STATE->ASIC_jobs_queue.count < QUEUE_LOW_WATER_MARK;
+    return queue_count(&GLOBAL_STATE->ASIC_jobs_queue) < QUEUE_LOW_WATER_MARK;
 }
 
-static void generate_work(GlobalState *GLOBAL_STATE, mining_notify *notification, uint64_t extranonce_2, uint32_t difficulty)
+static bm_job *generate_work(const job_builder_pool_t *pool, uint64_t extranonce_2)
 {
-    char extranonce_2_str[GLOBAL_STATE->extranonce_2_len * 2 + 1];
-    extranonce_2_generate(extranonce_2, GLOBAL_STATE->extranonce_2_len, extranonce_2_str);
+    mining_notify *notification = pool->notification;
+
+    char extranonce_2_str[pool->extranonce_2_len * 2 + 1];
+    extranonce_2_generate(extranonce_2, pool->extranonce_2_len, extranonce_2_str);
 
     //print generated extranonce_2
     //ESP_LOGI(TAG, "Generated extranonce_2: %s", extranonce_2_str);
 
-    char *coinbase_tx = construct_coinbase_tx(notification->coinbase_1, notification->coinbase_2, GLOBAL_STATE->extranonce_str, extranonce_2_str);
+    char *coinbase_tx = construct_coinbase_tx(notification->coinbase_1, notification->coinbase_2, pool->extranonce_str, extranonce_2_str);
     if (coinbase_tx == NULL) {
         ESP_LOGE(TAG, "Failed to construct coinbase_tx");
-        return;
+        return NULL;
     }
 
     char merkle_root[65];
     calculate_merkle_root_hash(coinbase_tx, (uint8_t(*)[32])notification->merkle_branches, notification->n_merkle_branches, merkle_root);
 
-    bm_job next_job = construct_bm_job(notification, merkle_root, GLOBAL_STATE->version_mask, difficulty);
+    bm_job next_job = construct_bm_job(notification, merkle_root, pool->version_mask, pool->difficulty);
 
     bm_job *queued_next_job = malloc(sizeof(bm_job));
     if (queued_next_job == NULL) {
         ESP_LOGE(TAG, "Failed to allocate memory for queued_next_job");
         free(coinbase_tx);
-        return;
+        return NULL;
     }
 
     memcpy(queued_next_job, &next_job, sizeof(bm_job));
     queued_next_job->extranonce2 = strdup(extranonce_2_str);
     queued_next_job->jobid = strdup(notification->job_id);
-    queued_next_job->version_mask = GLOBAL_STATE->version_mask;
-
-    queue_enqueue(&GLOBAL_STATE->ASIC_jobs_queue, queued_next_job);
+    queued_next_job->version_mask = pool->version_mask;
 
     free(coinbase_tx);
+
+    return queued_next_job;
 }
\ No newline at end of file
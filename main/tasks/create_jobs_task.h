@@ -1,6 +1,19 @@
 #ifndef CREATE_JOBS_TASK_H_
 #define CREATE_JOBS_TASK_H_
 
+#include <stdint.h>
+
+typedef struct
+{
+    // Job builders run pinned one per core and share the extranonce_2 space
+    uint8_t builder_count;
+    uint64_t jobs_built;
+    // Average time a single builder needs for one job (coinbase, merkle root, midstates)
+    float job_build_time_ms;
+    // Jobs per second during the last queue refill burst, across all builders
+    float refill_rate;
+} JobsTaskModule;
+
 void create_jobs_task(void *pvParameters);
 
-#endif
\ No newline at end of file
+#endif
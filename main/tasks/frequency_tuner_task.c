@@ -0,0 +1,245 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_heap_caps.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "global_state.h"
+#include "nvs_config.h"
+#include "asic.h"
+#include "frequency_transition_bmXX.h"
+
+#define POLL_RATE 5000
+#define ROUND_MS 300000 // the hashrate averages have long settled after a change
+#define STEP_SIZE 6.25  // MHz per change of a chip
+#define MAX_OFFSET 50.0 // MHz either side of the chain frequency
+#define EPSILON 0.0001f
+
+// A chip goes down a step if any of these trip
+#define MIN_HASHRATE_RATIO 0.90f   // measured over expected hashrate
+#define MIN_DOMAIN_RATIO 0.85f     // weakest domain over its share of the expected hashrate
+#define MAX_ERROR_SHARE 0.01f      // error rate over hashrate
+
+// and up a step if all of these hold
+#define RAISE_HASHRATE_RATIO 0.97f
+#define RAISE_ERROR_SHARE 0.002f
+#define RAISE_MAX_TEMP 65.0f       // well below the throttle temperature
+#define RAISE_POWER_HEADROOM 0.95f // of the board's max power
+
+static const char *TAG = "frequency_tuner";
+
+// The map is the offset of every chip in MHz, comma separated. A map
+// saved for a different chip count is ignored.
+static void load_map(GlobalState * GLOBAL_STATE)
+{
+    FrequencyTunerModule * FREQUENCY_TUNER_MODULE = &GLOBAL_STATE->FREQUENCY_TUNER_MODULE;
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+
+    char * map = nvs_config_get_string(NVS_CONFIG_ASIC_FREQUENCY_MAP);
+    if (map == NULL) {
+        return;
+    }
+
+    float offsets[asic_count];
+    int count = 0;
+    for (char * entry = map; *entry != '\0' && count < asic_count; count++) {
+        char * end;
+        offsets[count] = strtof(entry, &end);
+        if (end == entry || fabsf(offsets[count]) > MAX_OFFSET) {
+            break;
+        }
+        entry = *end == ',' ? end + 1 : end;
+    }
+
+    if (count == asic_count) {
+        memcpy(FREQUENCY_TUNER_MODULE->offsets, offsets, sizeof(offsets));
+        ESP_LOGI(TAG, "Loaded frequency map: %s", map);
+    } else if (*map != '\0') {
+        ESP_LOGW(TAG, "Ignoring frequency map for another chain: %s", map);
+    }
+    free(map);
+}
+
+static void save_map(GlobalState * GLOBAL_STATE)
+{
+    FrequencyTunerModule * FREQUENCY_TUNER_MODULE = &GLOBAL_STATE->FREQUENCY_TUNER_MODULE;
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+
+    // Offsets are multiples of the step within MAX_OFFSET, "-43.75," is the longest entry
+    char map[asic_count * 8 + 1];
+    int len = 0;
+    for (int asic_nr = 0; asic_nr < asic_count && len < sizeof(map); asic_nr++) {
+        len += snprintf(map + len, sizeof(map) - len, "%s%g", asic_nr > 0 ? "," : "", FREQUENCY_TUNER_MODULE->offsets[asic_nr]);
+    }
+    nvs_config_set_string(NVS_CONFIG_ASIC_FREQUENCY_MAP, map);
+}
+
+// Moves every chip a step towards the chain frequency plus its offset,
+// returns true once all of them are there
+static bool apply_offsets(GlobalState * GLOBAL_STATE, const chip_frequency_t * chips, float base_frequency, bool enabled)
+{
+    FrequencyTunerModule * FREQUENCY_TUNER_MODULE = &GLOBAL_STATE->FREQUENCY_TUNER_MODULE;
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+
+    bool settled = true;
+    for (int asic_nr = 0; asic_nr < asic_count; asic_nr++) {
+        float target = base_frequency + (enabled ? FREQUENCY_TUNER_MODULE->offsets[asic_nr] : 0);
+        float current = chips[asic_nr].frequency;
+        if (fabsf(target - current) < EPSILON) {
+            continue;
+        }
+
+        settled = false;
+        float next = target > current ? fminf(current + STEP_SIZE, target) : fmaxf(current - STEP_SIZE, target);
+        if (!ASIC_set_chip_frequency(GLOBAL_STATE, asic_nr, next)) {
+            FREQUENCY_TUNER_MODULE->supported = false;
+            return false;
+        }
+    }
+    return settled;
+}
+
+static void tune_chip(GlobalState * GLOBAL_STATE, int asic_nr, float base_frequency)
+{
+    FrequencyTunerModule * FREQUENCY_TUNER_MODULE = &GLOBAL_STATE->FREQUENCY_TUNER_MODULE;
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+    PowerManagementModule * POWER_MANAGEMENT_MODULE = &GLOBAL_STATE->POWER_MANAGEMENT_MODULE;
+
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+    int hash_domains = GLOBAL_STATE->DEVICE_CONFIG.family.asic.hash_domains;
+    float * offset = &FREQUENCY_TUNER_MODULE->offsets[asic_nr];
+
+    // The expected hashrate is for the frequency setting, it scales with the clock
+    float frequency = base_frequency + *offset;
+    float setting = POWER_MANAGEMENT_MODULE->frequency_value;
+    float expected = setting > 0 ? POWER_MANAGEMENT_MODULE->expected_hashrate / asic_count * frequency / setting : 0;
+    float hashrate = HASHRATE_MONITOR_MODULE->total_measurement[asic_nr].hashrate;
+    if (expected <= 0 || hashrate <= 0) {
+        return;
+    }
+
+    float ratio = hashrate / expected;
+    float domain_ratio = ratio;
+    for (int domain_nr = 0; domain_nr < hash_domains; domain_nr++) {
+        domain_ratio = fminf(domain_ratio, HASHRATE_MONITOR_MODULE->domain_measurements[asic_nr][domain_nr].hashrate * hash_domains / expected);
+    }
+    float error_share = HASHRATE_MONITOR_MODULE->error_measurement[asic_nr].hashrate / hashrate;
+
+    if (ratio < MIN_HASHRATE_RATIO || domain_ratio < MIN_DOMAIN_RATIO || error_share > MAX_ERROR_SHARE) {
+        if (*offset - STEP_SIZE >= -MAX_OFFSET - EPSILON) {
+            FREQUENCY_TUNER_MODULE->ceilings[asic_nr] = *offset;
+            *offset -= STEP_SIZE;
+            FREQUENCY_TUNER_MODULE->lowered++;
+            ESP_LOGI(TAG, "ASIC %d at %.0f%% of expected, weakest domain %.0f%%, %.2f%% errors: lowering to %g MHz",
+                     asic_nr, ratio * 100, domain_ratio * 100, error_share * 100, base_frequency + *offset);
+        }
+        return;
+    }
+
+    bool headroom = POWER_MANAGEMENT_MODULE->chip_temp_avg < RAISE_MAX_TEMP &&
+                    POWER_MANAGEMENT_MODULE->power < GLOBAL_STATE->DEVICE_CONFIG.family.max_power * RAISE_POWER_HEADROOM;
+    float next = *offset + STEP_SIZE;
+    if (headroom && ratio >= RAISE_HASHRATE_RATIO && error_share <= RAISE_ERROR_SHARE &&
+        next <= MAX_OFFSET + EPSILON && next < FREQUENCY_TUNER_MODULE->ceilings[asic_nr] - EPSILON) {
+        *offset = next;
+        FREQUENCY_TUNER_MODULE->raised++;
+        ESP_LOGI(TAG, "ASIC %d at %.0f%% of expected, %.2f%% errors: raising to %g MHz", asic_nr, ratio * 100, error_share * 100, base_frequency + *offset);
+    }
+}
+
+static void reset_ceilings(GlobalState * GLOBAL_STATE)
+{
+    for (int asic_nr = 0; asic_nr < GLOBAL_STATE->DEVICE_CONFIG.family.asic_count; asic_nr++) {
+        GLOBAL_STATE->FREQUENCY_TUNER_MODULE.ceilings[asic_nr] = MAX_OFFSET + STEP_SIZE;
+    }
+}
+
+// Chips of the same type differ in the clock they hold. Each chip is moved
+// off the chain frequency on its own hashrate and error counters, one step
+// per round, and the offsets are saved so the next boot starts from them.
+void frequency_tuner_task(void *pvParameters)
+{
+    GlobalState * GLOBAL_STATE = (GlobalState *)pvParameters;
+    FrequencyTunerModule * FREQUENCY_TUNER_MODULE = &GLOBAL_STATE->FREQUENCY_TUNER_MODULE;
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+
+    FREQUENCY_TUNER_MODULE->offsets = heap_caps_calloc(asic_count, sizeof(float), MALLOC_CAP_SPIRAM);
+    FREQUENCY_TUNER_MODULE->ceilings = heap_caps_calloc(asic_count, sizeof(float), MALLOC_CAP_SPIRAM);
+    if (FREQUENCY_TUNER_MODULE->offsets == NULL || FREQUENCY_TUNER_MODULE->ceilings == NULL) {
+        ESP_LOGE(TAG, "Not enough memory for the frequency map");
+        vTaskDelete(NULL);
+        return;
+    }
+    FREQUENCY_TUNER_MODULE->supported = true;
+    reset_ceilings(GLOBAL_STATE);
+    load_map(GLOBAL_STATE);
+
+    float base_frequency = 0;
+    uint32_t round_start_ms = 0;
+
+    while (1) {
+        vTaskDelay(POLL_RATE / portTICK_PERIOD_MS);
+
+        // Re-inits program every chip to the chain frequency,
+        // and the nonce range benchmark needs the chips to hold still
+        if (!GLOBAL_STATE->ASIC_initalized || !HASHRATE_MONITOR_MODULE->is_initialized ||
+            GLOBAL_STATE->NONCE_RANGE_MODULE.running) {
+            continue;
+        }
+
+        uint16_t chip_count;
+        const chip_frequency_t * chips = frequency_ramp_chips(&chip_count);
+        if (chips == NULL || chip_count != asic_count) {
+            continue;
+        }
+
+        // A ramp programs every chip, it mustn't run while chips are moved one at a time
+        if (!frequency_ramp_try_lock()) {
+            continue;
+        }
+
+        // Where the last ramp ended, below the setting if it backed off
+        uint32_t now_ms = esp_timer_get_time() / 1000;
+        float frequency = frequency_ramp_stats()->frequency;
+        if (frequency != base_frequency) {
+            // What held at the old chain frequency says little about the new one
+            base_frequency = frequency;
+            reset_ceilings(GLOBAL_STATE);
+            round_start_ms = now_ms;
+        }
+
+        bool enabled = nvs_config_get_bool(NVS_CONFIG_FREQUENCY_TUNER);
+        bool settled = apply_offsets(GLOBAL_STATE, chips, base_frequency, enabled);
+        frequency_ramp_unlock();
+
+        if (!settled) {
+            if (!FREQUENCY_TUNER_MODULE->supported) {
+                ESP_LOGW(TAG, "Per chip frequency not supported, stopping");
+                vTaskDelete(NULL);
+                return;
+            }
+            // The counters of a chip that just moved need a full round again
+            round_start_ms = now_ms;
+            continue;
+        }
+
+        if (!enabled || now_ms - round_start_ms < ROUND_MS) {
+            continue;
+        }
+        round_start_ms = now_ms;
+        FREQUENCY_TUNER_MODULE->rounds++;
+
+        uint32_t changes = FREQUENCY_TUNER_MODULE->raised + FREQUENCY_TUNER_MODULE->lowered;
+        for (int asic_nr = 0; asic_nr < asic_count; asic_nr++) {
+            tune_chip(GLOBAL_STATE, asic_nr, base_frequency);
+        }
+        if (FREQUENCY_TUNER_MODULE->raised + FREQUENCY_TUNER_MODULE->lowered != changes) {
+            save_map(GLOBAL_STATE);
+        }
+    }
+}
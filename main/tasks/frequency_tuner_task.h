@@ -0,0 +1,21 @@
+#ifndef FREQUENCY_TUNER_TASK_H_
+#define FREQUENCY_TUNER_TASK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    // Per chip offset from the chain frequency in MHz, persisted as the frequency map
+    float *offsets;
+    // Per chip offset the chip last fell short at, the tuner doesn't raise it that far again
+    float *ceilings;
+    bool supported;
+    uint32_t rounds;
+    uint32_t raised;
+    uint32_t lowered;
+} FrequencyTunerModule;
+
+void frequency_tuner_task(void *pvParameters);
+
+#endif /* FREQUENCY_TUNER_TASK_H_ */
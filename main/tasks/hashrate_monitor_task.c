@@ -1,13 +1,22 @@
 #include <string.h>
+#include <math.h>
 #include <esp_heap_caps.h>
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "freertos/semphr.h"
 #include "system.h"
 #include "common.h"
 #include "asic.h"
+#include "frequency_transition_bmXX.h"
 
 #define POLL_RATE 5000
 #define EMA_ALPHA 12
+#define MAX_POLLED_REGISTERS 8
+#define RAMP_SAMPLE_TIMEOUT_MS 50
+#define RAMP_READ_TIMEOUT_MS 2 // added per polled register, a Hex board polls 72
+#define RAMP_REQUEST_MARGIN_MS 100 // for the monitor task to get to a request
+#define ESTIMATE_SLOTS 60 // poll rounds in the nonce estimate window, 5 minutes
+#define ESTIMATE_Z 1.96f  // 95% interval
 
 #define HASH_CNT_LSB 0x100000000uLL // Hash counters are incremented on difficulty 1 (2^32 hashes)
 #define HASHRATE_UNIT 0x100000uLL // Hashrate register unit (2^24 hashes)
@@ -16,6 +25,40 @@ static const char *TAG = "hashrate_monitor";
 
 static float frequency_value;
 
+// Position of each register type in a chip's poll list, -1 if it isn't polled
+static int8_t poll_slot[REGISTER_ERROR_COUNT + 1];
+
+// Counter values at the previous frequency ramp sample, one per poll
+typedef struct {
+    uint32_t value;
+    uint32_t time_ms;
+} counter_snapshot_t;
+
+static counter_snapshot_t * ramp_snapshots;
+
+// Frequency ramp samples are taken in the monitor task, so it stays the only task sending polls.
+// The ramp bumps ramp_sample_requested, the monitor task fills ramp_samples and sets ramp_sample_served.
+static TaskHandle_t monitor_task;
+static SemaphoreHandle_t ramp_sample_done;
+static frequency_ramp_sample_t * ramp_samples;
+static bool ramp_sample_valid;
+static atomic_uint ramp_sample_requested;
+static atomic_uint ramp_sample_served;
+
+// Nonce and counter totals of one chip at the start of a poll round
+typedef struct {
+    uint32_t nonces;
+    uint32_t work;
+    uint32_t time_ms;
+    uint32_t ticks;
+    uint32_t ticks_ms;  // when the counter was read, 0 before the first read
+} estimate_snapshot_t;
+
+// ESTIMATE_SLOTS rounds of asic_count snapshots
+static estimate_snapshot_t * estimate_ring;
+static int estimate_head;
+static int estimate_filled;
+
 static float sum_hashrates(measurement_t * measurement, int asic_count)
 {
     if (asic_count == 1) return measurement[0].hashrate;
@@ -98,6 +141,328 @@ static void update_hash_counter(uint32_t time_ms, uint32_t value, measurement_t
     measurement->time_ms = time_ms;
 }
 
+// Wilson-Hilferty bounds of the Poisson mean behind a count of n
+static void poisson_interval(uint32_t n, float * low, float * high)
+{
+    *low = 0;
+    if (n > 0) {
+        float a = 1.0f - 1.0f / (9.0f * n) - ESTIMATE_Z / (3.0f * sqrtf(n));
+        *low = n * a * a * a;
+    }
+    float b = 1.0f - 1.0f / (9.0f * (n + 1)) + ESTIMATE_Z / (3.0f * sqrtf(n + 1));
+    *high = (n + 1) * b * b * b;
+}
+
+// Nonces and work over duration_ms, against the counter rate over about the same window
+static void estimate(uint32_t nonces, uint32_t work, uint32_t duration_ms, float register_hashrate, uint32_t ticks,
+                     uint32_t ticket_difficulty, nonce_estimate_t * result)
+{
+    *result = (nonce_estimate_t) { .nonces = nonces, .register_hashrate = register_hashrate };
+    if (duration_ms == 0) {
+        return;
+    }
+
+    // GH/s of a single difficulty 1 share, and what one nonce is worth. The mask may have moved during the window.
+    float share_hashrate = hash_counter_to_ghs(duration_ms, 1);
+    float work_per_nonce = nonces > 0 ? (float) work / nonces : ticket_difficulty;
+
+    result->hashrate = share_hashrate * work;
+
+    float low, high;
+    poisson_interval(nonces, &low, &high);
+    result->hashrate_low = share_hashrate * low * work_per_nonce;
+    result->hashrate_high = share_hashrate * high * work_per_nonce;
+
+    if (register_hashrate <= 0 || ticks == 0 || work_per_nonce == 0) {
+        result->fused_hashrate = result->hashrate;
+        return;
+    }
+
+    // Nonces the counter says should have come back, both counts are Poisson
+    float expected = register_hashrate / share_hashrate / work_per_nonce;
+    result->disagreement = (nonces - expected) / sqrtf(expected + expected * expected / ticks);
+
+    // Inverse variance weights, taken at the same rate for both so a low count doesn't look precise.
+    // The counters tick on every difficulty 1 share, they carry most of the weight.
+    result->fused_hashrate = (result->hashrate * expected + register_hashrate * ticks) / (expected + ticks);
+}
+
+// Second estimator next to the counter EMA: the valid nonces each chip returned
+// over a sliding window. A chip whose counters run but whose nonces fall short
+// hashes wrong, the disagreement shows it long before the pool does.
+static void update_nonce_estimates(GlobalState * GLOBAL_STATE)
+{
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+    AsicTaskModule * ASIC_TASK_MODULE = &GLOBAL_STATE->ASIC_TASK_MODULE;
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+
+    if (estimate_ring == NULL || HASHRATE_MONITOR_MODULE->nonce_estimates == NULL || ASIC_TASK_MODULE->chip_jobs == NULL) {
+        return;
+    }
+
+    // The chip counters restart with the chips
+    if (!GLOBAL_STATE->ASIC_initalized) {
+        estimate_filled = 0;
+        return;
+    }
+
+    uint32_t time_ms = esp_timer_get_time() / 1000;
+    estimate_snapshot_t * last = &estimate_ring[estimate_head * asic_count];
+    for (int asic_nr = 0; asic_nr < asic_count; asic_nr++) {
+        last[asic_nr] = (estimate_snapshot_t) {
+            .nonces = ASIC_TASK_MODULE->chip_jobs[asic_nr].valid_nonces,
+            .work = ASIC_TASK_MODULE->chip_jobs[asic_nr].valid_work,
+            .time_ms = time_ms,
+            .ticks = HASHRATE_MONITOR_MODULE->total_measurement[asic_nr].value,
+            .ticks_ms = HASHRATE_MONITOR_MODULE->total_measurement[asic_nr].time_ms,
+        };
+    }
+    estimate_snapshot_t * first = &estimate_ring[((estimate_head + ESTIMATE_SLOTS - estimate_filled) % ESTIMATE_SLOTS) * asic_count];
+    estimate_head = (estimate_head + 1) % ESTIMATE_SLOTS;
+    if (estimate_filled < ESTIMATE_SLOTS - 1) {
+        estimate_filled++;
+    }
+
+    uint32_t ticket_difficulty = ASIC_TASK_MODULE->ticket_difficulty;
+    uint32_t duration_ms = time_ms - first[0].time_ms;
+    uint32_t nonces = 0, work = 0, ticks = 0;
+    float register_hashrate = 0;
+    bool registers_valid = true;
+
+    for (int asic_nr = 0; asic_nr < asic_count; asic_nr++) {
+        // The counter was read at its own time in the round, and not at all after the measurements were cleared
+        float chip_register_hashrate = 0;
+        uint32_t chip_ticks = last[asic_nr].ticks - first[asic_nr].ticks;
+        uint32_t ticks_duration_ms = last[asic_nr].ticks_ms - first[asic_nr].ticks_ms;
+        if (first[asic_nr].ticks_ms != 0 && ticks_duration_ms > 0) {
+            chip_register_hashrate = hash_counter_to_ghs(ticks_duration_ms, chip_ticks);
+        } else {
+            registers_valid = false;
+        }
+
+        uint32_t chip_nonces = last[asic_nr].nonces - first[asic_nr].nonces;
+        uint32_t chip_work = last[asic_nr].work - first[asic_nr].work;
+        estimate(chip_nonces, chip_work, duration_ms, chip_register_hashrate, chip_ticks, ticket_difficulty,
+                 &HASHRATE_MONITOR_MODULE->nonce_estimates[asic_nr]);
+
+        nonces += chip_nonces;
+        work += chip_work;
+        ticks += chip_ticks;
+        register_hashrate += chip_register_hashrate;
+    }
+
+    estimate(nonces, work, duration_ms, registers_valid ? register_hashrate : 0, ticks, ticket_difficulty,
+             &HASHRATE_MONITOR_MODULE->nonce_estimate);
+}
+
+// Every register of every chip gets its own slot in the poll period. Reads go
+// out one at a time, so their answers never arrive in a burst between nonces.
+static bool init_poll_schedule(GlobalState * GLOBAL_STATE)
+{
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+    int asic_count = GLOBAL_STATE->DEVICE_CONFIG.family.asic_count;
+
+    uint8_t registers[MAX_POLLED_REGISTERS];
+    int register_count = ASIC_get_polled_registers(GLOBAL_STATE, registers, MAX_POLLED_REGISTERS);
+
+    memset(poll_slot, -1, sizeof(poll_slot));
+    HASHRATE_MONITOR_MODULE->poll_count = register_count * asic_count;
+    HASHRATE_MONITOR_MODULE->polls = heap_caps_calloc(HASHRATE_MONITOR_MODULE->poll_count, sizeof(register_poll_t), MALLOC_CAP_SPIRAM);
+    if (HASHRATE_MONITOR_MODULE->polls == NULL && HASHRATE_MONITOR_MODULE->poll_count > 0) {
+        ESP_LOGE(TAG, "Not enough memory for the poll schedule");
+        HASHRATE_MONITOR_MODULE->poll_count = 0;
+        return false;
+    }
+
+    // Ordered by register, then chip: back to back reads go to different chips
+    for (int slot = 0; slot < register_count; slot++) {
+        poll_slot[ASIC_get_register_type(GLOBAL_STATE, registers[slot])] = slot;
+        for (int asic_nr = 0; asic_nr < asic_count; asic_nr++) {
+            register_poll_t * poll = &HASHRATE_MONITOR_MODULE->polls[slot * asic_count + asic_nr];
+            poll->asic_nr = asic_nr;
+            poll->reg = registers[slot];
+            atomic_init(&poll->pending, false);
+        }
+    }
+
+    ESP_LOGI(TAG, "Polling %d registers on %d chip(s), one read every %d ms", register_count, asic_count,
+             HASHRATE_MONITOR_MODULE->poll_count > 0 ? POLL_RATE / HASHRATE_MONITOR_MODULE->poll_count : 0);
+    return true;
+}
+
+static void send_poll(GlobalState * GLOBAL_STATE, register_poll_t * poll)
+{
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+
+    poll->sent_ms = esp_timer_get_time() / 1000;
+    if (atomic_exchange(&poll->pending, true)) {
+        poll->missed++;
+        HASHRATE_MONITOR_MODULE->reads_missed++;
+    }
+    ASIC_read_register(GLOBAL_STATE, poll->asic_nr, poll->reg);
+    HASHRATE_MONITOR_MODULE->reads_sent++;
+}
+
+static measurement_t * counter_measurement(GlobalState * GLOBAL_STATE, register_type_t register_type, uint8_t asic_nr)
+{
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+
+    switch (register_type) {
+        case REGISTER_TOTAL_COUNT:
+            return &HASHRATE_MONITOR_MODULE->total_measurement[asic_nr];
+        case REGISTER_DOMAIN_0_COUNT:
+        case REGISTER_DOMAIN_1_COUNT:
+        case REGISTER_DOMAIN_2_COUNT:
+        case REGISTER_DOMAIN_3_COUNT:
+            return &HASHRATE_MONITOR_MODULE->domain_measurements[asic_nr][register_type - REGISTER_DOMAIN_0_COUNT];
+        case REGISTER_ERROR_COUNT:
+            return &HASHRATE_MONITOR_MODULE->error_measurement[asic_nr];
+        default:
+            return NULL;
+    }
+}
+
+static uint32_t ramp_sample_timeout_ms(GlobalState * GLOBAL_STATE)
+{
+    return RAMP_SAMPLE_TIMEOUT_MS + GLOBAL_STATE->HASHRATE_MONITOR_MODULE.poll_count * RAMP_READ_TIMEOUT_MS;
+}
+
+// Reads every polled counter of every chip out of schedule and returns the
+// rates since the previous call, so a ramp step is judged in a fraction of a
+// second instead of a poll period. Runs in the monitor task.
+static bool read_ramp_counters(GlobalState * GLOBAL_STATE, frequency_ramp_sample_t * samples, uint16_t asic_count)
+{
+    HashrateMonitorModule * HASHRATE_MONITOR_MODULE = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
+
+    int hash_domains = GLOBAL_STATE->DEVICE_CONFIG.family.asic.hash_domains;
+    uint32_t timeout_ms = ramp_sample_timeout_ms(GLOBAL_STATE);
+
+    if (!GLOBAL_STATE->ASIC_initalized || poll_slot[REGISTER_TOTAL_COUNT] < 0) {
+        return false;
+    }
+
+    // A read from the schedule still on its way is waited for instead of sent again
+    uint32_t start_ms = esp_timer_get_time() / 1000;
+    for (int i = 0; i < HASHRATE_MONITOR_MODULE->poll_count; i++) {
+        register_poll_t * poll = &HASHRATE_MONITOR_MODULE->polls[i];
+        if (!atomic_load(&poll->pending) || start_ms - poll->sent_ms > timeout_ms) {
+            send_poll(GLOBAL_STATE, poll);
+        }
+    }
+
+    // ASIC_result_task matches the answers
+    for (int i = 0; i < HASHRATE_MONITOR_MODULE->poll_count; ) {
+        if (!atomic_load(&HASHRATE_MONITOR_MODULE->polls[i].pending)) {
+            i++;
+            continue;
+        }
+        if (esp_timer_get_time() / 1000 - start_ms > timeout_ms) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+
+    for (int asic_nr = 0; asic_nr < asic_count; asic_nr++) {
+        samples[asic_nr] = (frequency_ramp_sample_t) { .domain_hashrate = -1 };
+    }
+
+    bool valid = true;
+    for (int i = 0; i < HASHRATE_MONITOR_MODULE->poll_count; i++) {
+        register_poll_t * poll = &HASHRATE_MONITOR_MODULE->polls[i];
+        register_type_t register_type = ASIC_get_register_type(GLOBAL_STATE, poll->reg);
+        measurement_t * measurement = counter_measurement(GLOBAL_STATE, register_type, poll->asic_nr);
+        if (measurement == NULL) {
+            continue;
+        }
+
+        counter_snapshot_t * snapshot = &ramp_snapshots[i];
+        // Nothing to measure from on the first call, or after the measurements were cleared
+        if (snapshot->time_ms == 0 || measurement->time_ms <= snapshot->time_ms) {
+            valid = false;
+        } else {
+            uint32_t counter = measurement->value - snapshot->value;
+            float hashrate = hash_counter_to_ghs(measurement->time_ms - snapshot->time_ms, counter);
+            frequency_ramp_sample_t * sample = &samples[poll->asic_nr];
+
+            if (register_type == REGISTER_TOTAL_COUNT) {
+                sample->hashrate = hashrate;
+                sample->ticks = counter / (hash_domains > 0 ? hash_domains : 1);
+            } else if (register_type == REGISTER_ERROR_COUNT) {
+                sample->error_rate = hashrate;
+            } else if (sample->domain_hashrate < 0 || hashrate * hash_domains < sample->domain_hashrate) {
+                sample->domain_hashrate = hashrate * hash_domains;
+            }
+        }
+
+        snapshot->value = measurement->value;
+        snapshot->time_ms = measurement->time_ms;
+    }
+
+    return valid;
+}
+
+// Answers the latest frequency ramp request, if there is one
+static void serve_ramp_sample(GlobalState * GLOBAL_STATE)
+{
+    unsigned int request = atomic_load(&ramp_sample_requested);
+    if (request == atomic_load(&ramp_sample_served)) {
+        return;
+    }
+
+    ramp_sample_valid = read_ramp_counters(GLOBAL_STATE, ramp_samples, GLOBAL_STATE->DEVICE_CONFIG.family.asic_count);
+    atomic_store(&ramp_sample_served, request);
+    xSemaphoreGive(ramp_sample_done);
+}
+
+// Frequency ramp feedback, runs in the ramping task and hands the reads to the monitor task
+static bool sample_counters(void * ctx, frequency_ramp_sample_t * samples, uint16_t asic_count)
+{
+    GlobalState * GLOBAL_STATE = (GlobalState *)ctx;
+
+    if (!GLOBAL_STATE->ASIC_initalized || asic_count != GLOBAL_STATE->DEVICE_CONFIG.family.asic_count) {
+        return false;
+    }
+
+    unsigned int request = atomic_fetch_add(&ramp_sample_requested, 1) + 1;
+    xTaskNotifyGive(monitor_task);
+
+    // Answers to an earlier request that timed out are skipped
+    TickType_t timeout = pdMS_TO_TICKS(ramp_sample_timeout_ms(GLOBAL_STATE) + RAMP_REQUEST_MARGIN_MS);
+    TickType_t start = xTaskGetTickCount();
+    while (atomic_load(&ramp_sample_served) != request) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout || xSemaphoreTake(ramp_sample_done, timeout - elapsed) != pdTRUE) {
+            return false;
+        }
+    }
+
+    if (!ramp_sample_valid) {
+        return false;
+    }
+    memcpy(samples, ramp_samples, asic_count * sizeof(frequency_ramp_sample_t));
+    return true;
+}
+
+// vTaskDelayUntil that serves frequency ramp requests while it waits. After a
+// request made it late, the schedule continues from now instead of catching up.
+static void wait_for_slot(GlobalState * GLOBAL_STATE, TickType_t * wake_time, TickType_t period)
+{
+    *wake_time += period;
+    while (true) {
+        serve_ramp_sample(GLOBAL_STATE);
+
+        TickType_t now = xTaskGetTickCount();
+        TickType_t remaining = *wake_time - now;
+        if (remaining == 0 || remaining > period) {
+            if (remaining != 0) {
+                *wake_time = now;
+            }
+            return;
+        }
+        ulTaskNotifyTake(pdTRUE, remaining);
+    }
+}
+
 void hashrate_monitor_task(void *pvParameters)
 {
     GlobalState * GLOBAL_STATE = (GlobalState *)pvParameters;
@@ -118,19 +483,45 @@ void hashrate_monitor_task(void *pvParameters)
     HASHRATE_MONITOR_MODULE->error_measurement = heap_caps_malloc(asic_count * sizeof(measurement_t), MALLOC_CAP_SPIRAM);
 
     clear_measurements(GLOBAL_STATE);
+    if (!init_poll_schedule(GLOBAL_STATE)) {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ramp_snapshots = heap_caps_calloc(HASHRATE_MONITOR_MODULE->poll_count, sizeof(counter_snapshot_t), MALLOC_CAP_SPIRAM);
+    ramp_samples = heap_caps_calloc(asic_count, sizeof(frequency_ramp_sample_t), MALLOC_CAP_SPIRAM);
+    ramp_sample_done = xSemaphoreCreateBinary();
+    monitor_task = xTaskGetCurrentTaskHandle();
+    estimate_ring = heap_caps_calloc(ESTIMATE_SLOTS * asic_count, sizeof(estimate_snapshot_t), MALLOC_CAP_SPIRAM);
+    HASHRATE_MONITOR_MODULE->nonce_estimates = heap_caps_calloc(asic_count, sizeof(nonce_estimate_t), MALLOC_CAP_SPIRAM);
+    if (ramp_snapshots != NULL && ramp_samples != NULL && ramp_sample_done != NULL) {
+        frequency_ramp_set_feedback(sample_counters, GLOBAL_STATE);
+    }
 
     HASHRATE_MONITOR_MODULE->is_initialized = true;
 
+    int poll_count = HASHRATE_MONITOR_MODULE->poll_count;
     TickType_t taskWakeTime = xTaskGetTickCount();
     while (1) {
-        ASIC_read_registers(GLOBAL_STATE);
-
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-
+        // Totals from the answers to the previous round
         SYSTEM_MODULE->current_hashrate = sum_hashrates(HASHRATE_MONITOR_MODULE->total_measurement, asic_count);
         HASHRATE_MONITOR_MODULE->error_count = sum_values(HASHRATE_MONITOR_MODULE->error_measurement, asic_count);
+        update_nonce_estimates(GLOBAL_STATE);
+
+        if (poll_count == 0) {
+            wait_for_slot(GLOBAL_STATE, &taskWakeTime, POLL_RATE / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        for (int i = 0; i < poll_count; i++) {
+            if (GLOBAL_STATE->ASIC_initalized) {
+                send_poll(GLOBAL_STATE, &HASHRATE_MONITOR_MODULE->polls[i]);
+            }
 
-        vTaskDelayUntil(&taskWakeTime, POLL_RATE / portTICK_PERIOD_MS);
+            // Slot boundaries are spread over the period so the rounding doesn't add up
+            TickType_t slot_ticks = pdMS_TO_TICKS((i + 1) * POLL_RATE / poll_count) - pdMS_TO_TICKS(i * POLL_RATE / poll_count);
+            wait_for_slot(GLOBAL_STATE, &taskWakeTime, slot_ticks > 0 ? slot_ticks : 1);
+        }
     }
 }
 
@@ -149,6 +540,18 @@ void hashrate_monitor_register_read(void *pvParameters, register_type_t register
         return;
     }
 
+    // Match the answer to its read
+    int slot = register_type <= REGISTER_ERROR_COUNT ? poll_slot[register_type] : -1;
+    if (slot >= 0 && HASHRATE_MONITOR_MODULE->polls != NULL) {
+        register_poll_t * poll = &HASHRATE_MONITOR_MODULE->polls[slot * asic_count + asic_nr];
+        if (atomic_exchange(&poll->pending, false)) {
+            float latency_ms = time_ms - poll->sent_ms;
+            HASHRATE_MONITOR_MODULE->read_latency_ms = ((HASHRATE_MONITOR_MODULE->read_latency_ms * (EMA_ALPHA - 1)) + latency_ms) / EMA_ALPHA;
+        } else {
+            HASHRATE_MONITOR_MODULE->reads_unexpected++;
+        }
+    }
+
     // Reset statistics on start and when frequency changes
     if (POWER_MANAGEMENT_MODULE->frequency_value != frequency_value) {
         clear_measurements(GLOBAL_STATE);
@@ -1,6 +1,7 @@
 #ifndef HASHRATE_MONITOR_TASK_H_
 #define HASHRATE_MONITOR_TASK_H_
 
+#include <stdatomic.h>
 #include "common.h"
 
 typedef struct {
@@ -10,12 +11,43 @@ typedef struct {
     float expected_hashrate;
 } measurement_t;
 
+// Hashrate the valid nonces prove over the estimate window, against the counter registers
+typedef struct {
+    float hashrate;           // GH/s of valid nonces times their ticket difficulty
+    float hashrate_low;       // 95% interval from Poisson statistics on the nonce count
+    float hashrate_high;
+    float register_hashrate;  // GH/s of the total counter over the same window
+    float fused_hashrate;     // both, weighted by their inverse variance
+    float disagreement;       // nonces against what the counter predicts, in standard deviations
+    uint32_t nonces;          // valid nonces in the window
+} nonce_estimate_t;
+
+// One register of one chip in the poll schedule
+typedef struct {
+    uint8_t asic_nr;
+    uint8_t reg;
+    atomic_bool pending;    // read sent, no answer yet
+    uint32_t sent_ms;
+    uint32_t missed;        // reads still unanswered when the register came up again
+} register_poll_t;
+
 typedef struct {
     measurement_t* total_measurement;
     measurement_t** domain_measurements;
     measurement_t* error_measurement;
 
     int error_count;
+
+    register_poll_t* polls;
+    int poll_count;
+    uint32_t reads_sent;
+    uint32_t reads_missed;
+    uint32_t reads_unexpected; // answers without an outstanding read
+    float read_latency_ms;     // send to answer, averaged
+
+    nonce_estimate_t* nonce_estimates; // per chip
+    nonce_estimate_t nonce_estimate;   // whole chain
+
     bool is_initialized;
 } HashrateMonitorModule;
 
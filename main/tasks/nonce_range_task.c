@@ -0,0 +1,147 @@
+#include <math.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "global_state.h"
+#include "nvs_config.h"
+#include "asic.h"
+#include "frequency_transition_bmXX.h"
+
+#define POLL_RATE 5000
+#define SETTLE_MS 30000   // the chips finish the work queued under the previous value
+#define WINDOW_MS 200000  // several hundred nonces per window at the tuned ticket mask
+#define PASSES 3          // windows per value, interleaved so drift hits every value alike
+#define MIN_SIGMAS 2.0    // a value replaces the chip default only if it wins by this much noise
+
+static const char *TAG = "nonce_range";
+
+static const double NONCE_SPACE = 4294967296.0; //  2^32
+
+// Waits ms, false if the benchmark was switched off or anything moved the chips meanwhile
+static bool wait_ms(GlobalState * GLOBAL_STATE, uint32_t ms)
+{
+    for (uint32_t waited = 0; waited < ms; waited += POLL_RATE) {
+        vTaskDelay(POLL_RATE / portTICK_PERIOD_MS);
+        if (!nvs_config_get_bool(NVS_CONFIG_NONCE_RANGE_BENCHMARK) || !GLOBAL_STATE->ASIC_initalized ||
+            frequency_ramp_stats()->in_progress) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool measure(GlobalState * GLOBAL_STATE, nonce_range_result_t * result)
+{
+    if (!ASIC_set_hash_counting(GLOBAL_STATE, result->hash_counting) || !wait_ms(GLOBAL_STATE, SETTLE_MS)) {
+        return false;
+    }
+
+    uint32_t nonces = GLOBAL_STATE->ASIC_TASK_MODULE.valid_nonces;
+    uint32_t work = GLOBAL_STATE->ASIC_TASK_MODULE.valid_work;
+    int64_t start_us = esp_timer_get_time();
+    if (!wait_ms(GLOBAL_STATE, WINDOW_MS)) {
+        return false;
+    }
+    result->nonces += GLOBAL_STATE->ASIC_TASK_MODULE.valid_nonces - nonces;
+    result->work += GLOBAL_STATE->ASIC_TASK_MODULE.valid_work - work;
+    result->duration_ms += (esp_timer_get_time() - start_us) / 1000;
+
+    // The ticket mask may move meanwhile, the work counts every nonce at the mask it was found at
+    result->hashrate = result->work * NONCE_SPACE / (result->duration_ms / 1000.0) / 1e9;
+    return true;
+}
+
+// Nonces arrive as a Poisson process, a rate from n nonces is good to rate / sqrt(n)
+static bool beats(const nonce_range_result_t * a, const nonce_range_result_t * b)
+{
+    if (a->nonces == 0 || b->nonces == 0) {
+        return false;
+    }
+    double sigma = sqrt(a->hashrate * a->hashrate / a->nonces + b->hashrate * b->hashrate / b->nonces);
+    return a->hashrate - b->hashrate > MIN_SIGMAS * sigma;
+}
+
+static void run_benchmark(GlobalState * GLOBAL_STATE)
+{
+    NonceRangeModule * NONCE_RANGE_MODULE = &GLOBAL_STATE->NONCE_RANGE_MODULE;
+
+    const uint32_t * candidates;
+    int count = ASIC_get_hash_counting_candidates(GLOBAL_STATE, &candidates);
+    if (count < 2) {
+        ESP_LOGW(TAG, "Nothing to compare on %s", GLOBAL_STATE->DEVICE_CONFIG.family.asic.name);
+        return;
+    }
+    if (count > NONCE_RANGE_MAX_CANDIDATES) {
+        count = NONCE_RANGE_MAX_CANDIDATES;
+    }
+
+    memset(NONCE_RANGE_MODULE->results, 0, sizeof(NONCE_RANGE_MODULE->results));
+    for (int i = 0; i < count; i++) {
+        NONCE_RANGE_MODULE->results[i].hash_counting = candidates[i];
+    }
+    NONCE_RANGE_MODULE->candidate_count = count;
+    NONCE_RANGE_MODULE->running = true;
+
+    ESP_LOGI(TAG, "Benchmarking %d hash counting numbers, %d s each", count, PASSES * (SETTLE_MS + WINDOW_MS) / 1000);
+
+    bool finished = true;
+    for (int pass = 0; pass < PASSES && finished; pass++) {
+        NONCE_RANGE_MODULE->pass = pass;
+        for (int i = 0; i < count && finished; i++) {
+            nonce_range_result_t * result = &NONCE_RANGE_MODULE->results[i];
+            NONCE_RANGE_MODULE->candidate = i;
+            finished = measure(GLOBAL_STATE, result);
+            if (finished) {
+                ESP_LOGI(TAG, "0x%08" PRIX32 ": %.1f GH/s from %" PRIu32 " nonces", result->hash_counting, result->hashrate, result->nonces);
+            }
+        }
+    }
+    NONCE_RANGE_MODULE->running = false;
+
+    if (!finished) {
+        // Back to what the board ran before
+        ESP_LOGW(TAG, "Benchmark interrupted");
+        if (GLOBAL_STATE->ASIC_initalized) {
+            int32_t stored = nvs_config_get_i32(NVS_CONFIG_ASIC_HASH_COUNTING);
+            ASIC_set_hash_counting(GLOBAL_STATE, stored > 0 ? stored : 0);
+        }
+        return;
+    }
+
+    // The chip default stays unless another value is clearly better
+    const nonce_range_result_t * best = &NONCE_RANGE_MODULE->results[0];
+    for (int i = 1; i < count; i++) {
+        if (NONCE_RANGE_MODULE->results[i].hashrate > best->hashrate && beats(&NONCE_RANGE_MODULE->results[i], &NONCE_RANGE_MODULE->results[0])) {
+            best = &NONCE_RANGE_MODULE->results[i];
+        }
+    }
+
+    NONCE_RANGE_MODULE->winner = best->hash_counting;
+    ASIC_set_hash_counting(GLOBAL_STATE, best->hash_counting);
+    nvs_config_set_i32(NVS_CONFIG_ASIC_HASH_COUNTING, best->hash_counting);
+    ESP_LOGI(TAG, "Hash counting number 0x%08" PRIX32 " wins with %.1f GH/s", best->hash_counting, best->hashrate);
+}
+
+// Register 0x10 changes how the chips split the nonce space, but what it does
+// isn't documented. Overlapping or skipped nonces don't show on the hash
+// counters, so the values known from stock firmware are compared on the work
+// the returned nonces prove. Runs when the benchmark setting is switched on,
+// and switches it off again when done. Only real chips can be benchmarked, the
+// simulated chain records register 0x10 writes without modelling them.
+void nonce_range_task(void *pvParameters)
+{
+    GlobalState * GLOBAL_STATE = (GlobalState *)pvParameters;
+
+    while (1) {
+        vTaskDelay(POLL_RATE / portTICK_PERIOD_MS);
+
+        if (!GLOBAL_STATE->ASIC_initalized || !nvs_config_get_bool(NVS_CONFIG_NONCE_RANGE_BENCHMARK)) {
+            continue;
+        }
+
+        run_benchmark(GLOBAL_STATE);
+        nvs_config_set_bool(NVS_CONFIG_NONCE_RANGE_BENCHMARK, false);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef NONCE_RANGE_TASK_H_
+#define NONCE_RANGE_TASK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NONCE_RANGE_MAX_CANDIDATES 8
+
+typedef struct
+{
+    uint32_t hash_counting;
+    // Valid nonces and time over all windows of this value
+    uint32_t nonces;
+    uint32_t work;  // difficulty 1 shares the nonces are worth
+    uint32_t duration_ms;
+    // GH/s of work the nonces prove, register counters can't see overlapping or skipped nonces
+    float hashrate;
+} nonce_range_result_t;
+
+typedef struct
+{
+    bool running;
+    uint8_t candidate;
+    uint8_t candidate_count;
+    uint8_t pass;
+    nonce_range_result_t results[NONCE_RANGE_MAX_CANDIDATES];
+    // Value the last finished benchmark picked, 0 before one finished
+    uint32_t winner;
+} NonceRangeModule;
+
+void nonce_range_task(void *pvParameters);
+
+#endif /* NONCE_RANGE_TASK_H_ */
@@ -308,8 +308,9 @@ void POWER_MANAGEMENT_task(void * pvParameters)
             bool success = ASIC_set_frequency(GLOBAL_STATE, asic_frequency);
             
             if (success) {
-                power_management->frequency_value = asic_frequency;
-                power_management->expected_hashrate = expected_hashrate(GLOBAL_STATE, asic_frequency);
+                // The ramp stops short of the request if the chips don't keep up
+                power_management->frequency_value = ASIC_get_frequency(GLOBAL_STATE);
+                power_management->expected_hashrate = expected_hashrate(GLOBAL_STATE, power_management->frequency_value);
             }
             
             last_asic_frequency = asic_frequency;
@@ -0,0 +1,447 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "stats_codec.h"
+#include "statistics_history_task.h"
+
+// Every tier is a ring of flash sectors in the "stats" partition. A sector starts
+// with a header carrying a sequence number that only counts up, so the newest one
+// is found again after a restart. Every record goes to flash as soon as it is taken,
+// into the erased bytes right after the previous one, so a panic, watchdog reset or
+// brownout loses nothing already written. Records never cross a page, the rest of a
+// page stays erased and its first 0xFF ends decoding.
+//
+// Every sector, every start and every clock jump begins with a keyframe, so any
+// sector decodes on its own.
+
+#define HISTORY_PARTITION_LABEL "stats"
+#define HISTORY_SECTOR_SIZE 4096
+#define HISTORY_PAGE_SIZE 256
+#define HISTORY_PAGES (HISTORY_SECTOR_SIZE / HISTORY_PAGE_SIZE)
+#define HISTORY_MAGIC 0x31485342 // "BSH1"
+#define HISTORY_HEADER_SIZE 8
+#define HISTORY_QUEUE_DEPTH 8
+#define HISTORY_FLUSH_TIMEOUT_MS 1000     // a restart waits at most this long for the queued samples
+#define HISTORY_TIER1_SAMPLES 12          // statistics samples per tier 1 record, a minute at the 5 s poll rate
+#define HISTORY_CLOCK_VALID 1600000000    // unix times before this mean the clock wasn't synced yet
+
+static const char * TAG = "statistics_history";
+
+typedef struct
+{
+    uint32_t uptime;
+    uint32_t time;
+    struct StatisticsData data;
+    bool flush;             // no sample, the shutdown handler waits until this one is reached
+} HistorySample;
+
+typedef struct
+{
+    uint32_t firstSector;
+    uint32_t sectorCount;
+    uint32_t sector;        // head, relative to firstSector
+    uint32_t sequence;      // of the head sector
+    uint32_t offset;        // where the next record goes, within the head sector
+    HistoryCursor last;     // what the next delta refers to
+} HistoryTier;
+
+typedef struct
+{
+    uint32_t boot;
+    uint32_t from;
+    uint32_t to;
+    StatisticsHistoryCallback callback;
+    void * ctx;
+    bool stopped;
+} HistoryQuery;
+
+static const esp_partition_t * partition;
+static HistoryTier tiers[HISTORY_TIERS];
+static uint32_t boot;
+static QueueHandle_t historyQueue;
+static SemaphoreHandle_t historyFlushed;
+static pthread_mutex_t historyLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Tier 1 means of the samples so far, the error counter keeps its last value and the free heap its minimum
+static int64_t tier1Sums[HISTORY_COLUMNS];
+static uint16_t tier1Samples;
+
+static void toColumns(const struct StatisticsData * data, int32_t * values)
+{
+    values[COL_HASHRATE] = lroundf(data->hashrate * 100);
+    values[COL_ERROR_COUNT] = (int32_t) data->errorCount;
+    values[COL_ASIC_TEMP] = lroundf(data->chipTemperature * 10);
+    values[COL_VR_TEMP] = lroundf(data->vrTemperature * 10);
+    values[COL_POWER] = lroundf(data->power * 100);
+    values[COL_VOLTAGE] = lroundf(data->voltage);
+    values[COL_CURRENT] = lroundf(data->current);
+    values[COL_ASIC_VOLTAGE] = data->coreVoltageActual;
+    values[COL_FAN_SPEED] = lroundf(data->fanSpeed);
+    values[COL_FAN_RPM] = data->fanRPM;
+    values[COL_FAN2_RPM] = data->fan2RPM;
+    values[COL_WIFI_RSSI] = data->wifiRSSI;
+    values[COL_FREE_HEAP] = (int32_t) data->freeHeap;
+}
+
+static void fromColumns(const int32_t * values, struct StatisticsData * data)
+{
+    data->hashrate = values[COL_HASHRATE] / 100.0f;
+    data->errorCount = (uint32_t) values[COL_ERROR_COUNT];
+    data->chipTemperature = values[COL_ASIC_TEMP] / 10.0f;
+    data->vrTemperature = values[COL_VR_TEMP] / 10.0f;
+    data->power = values[COL_POWER] / 100.0f;
+    data->voltage = values[COL_VOLTAGE];
+    data->current = values[COL_CURRENT];
+    data->coreVoltageActual = values[COL_ASIC_VOLTAGE];
+    data->fanSpeed = values[COL_FAN_SPEED];
+    data->fanRPM = values[COL_FAN_RPM];
+    data->fan2RPM = values[COL_FAN2_RPM];
+    data->wifiRSSI = values[COL_WIFI_RSSI];
+    data->freeHeap = (uint32_t) values[COL_FREE_HEAP];
+}
+
+static size_t sectorAddress(const HistoryTier * tier, uint32_t sector)
+{
+    return (tier->firstSector + sector) * HISTORY_SECTOR_SIZE;
+}
+
+static bool isErased(const uint8_t * data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (RECORD_EMPTY != data[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---- Writer, called with historyLock held
+
+// Erases the oldest sector and starts it with a header
+static void advanceSector(HistoryTier * tier)
+{
+    tier->sector = (tier->sector + 1) % tier->sectorCount;
+    tier->sequence++;
+    tier->offset = HISTORY_HEADER_SIZE;
+    tier->last.keyed = false;
+
+    esp_err_t err = esp_partition_erase_range(partition, sectorAddress(tier, tier->sector), HISTORY_SECTOR_SIZE);
+    if (ESP_OK != err) {
+        ESP_LOGE(TAG, "Erasing the statistics history failed: %s", esp_err_to_name(err));
+    }
+
+    const uint32_t header[2] = { HISTORY_MAGIC, tier->sequence };
+    err = esp_partition_write(partition, sectorAddress(tier, tier->sector), header, HISTORY_HEADER_SIZE);
+    if (ESP_OK != err) {
+        ESP_LOGE(TAG, "Writing the statistics history failed: %s", esp_err_to_name(err));
+    }
+}
+
+// NOR flash programs the erased bytes after the previous record without another erase
+static void appendRecord(HistoryTier * tier, const HistoryCursor * record)
+{
+    uint8_t encoded[HISTORY_RECORD_MAX];
+
+    if (HISTORY_SECTOR_SIZE <= tier->offset) {
+        advanceSector(tier);
+    }
+
+    size_t length = encodeRecord(&tier->last, record, encoded);
+    uint32_t pageEnd = (tier->offset / HISTORY_PAGE_SIZE + 1) * HISTORY_PAGE_SIZE;
+    if (pageEnd < tier->offset + length) {
+        tier->offset = pageEnd;
+        if (HISTORY_SECTOR_SIZE <= tier->offset) {
+            // The new sector has to start with a keyframe
+            advanceSector(tier);
+            length = encodeRecord(&tier->last, record, encoded);
+        }
+    }
+
+    esp_err_t err = esp_partition_write(partition, sectorAddress(tier, tier->sector) + tier->offset, encoded, length);
+    if (ESP_OK != err) {
+        ESP_LOGE(TAG, "Writing the statistics history failed: %s", esp_err_to_name(err));
+    }
+
+    tier->offset += length;
+    tier->last = *record;
+}
+
+static void addTier1Sample(const HistoryCursor * sample)
+{
+    for (int i = 0; i < HISTORY_COLUMNS; i++) {
+        int32_t value = sample->values[i];
+        if (COL_ERROR_COUNT == i) {
+            tier1Sums[i] = value;
+        } else if (COL_FREE_HEAP == i) {
+            tier1Sums[i] = (0 == tier1Samples || (uint32_t) value < (uint32_t) tier1Sums[i]) ? (uint32_t) value : tier1Sums[i];
+        } else {
+            tier1Sums[i] += value;
+        }
+    }
+
+    if (HISTORY_TIER1_SAMPLES <= ++tier1Samples) {
+        HistoryCursor means = *sample;
+        for (int i = 0; i < HISTORY_COLUMNS; i++) {
+            means.values[i] = (COL_ERROR_COUNT == i || COL_FREE_HEAP == i) ? (int32_t) tier1Sums[i] : (int32_t) llround((double) tier1Sums[i] / tier1Samples);
+            tier1Sums[i] = 0;
+        }
+        tier1Samples = 0;
+        appendRecord(&tiers[1], &means);
+    }
+}
+
+// esp_restart may come from a task with its stack in PSRAM, which must not touch the
+// flash. The history task writes the samples still queued and the restart waits for it.
+static void flushStatisticHistory(void)
+{
+    const HistorySample marker = { .flush = true };
+
+    if (pdTRUE == xQueueSend(historyQueue, &marker, pdMS_TO_TICKS(HISTORY_FLUSH_TIMEOUT_MS))) {
+        xSemaphoreTake(historyFlushed, pdMS_TO_TICKS(HISTORY_FLUSH_TIMEOUT_MS));
+    }
+}
+
+// ---- Reader
+
+static bool emitRecord(const HistoryCursor * cursor, void * ctx)
+{
+    HistoryQuery * query = ctx;
+
+    if ((0 != query->boot && cursor->boot != query->boot) || cursor->uptime < query->from || cursor->uptime > query->to) {
+        return true;
+    }
+
+    struct StatisticsHistoryRecord record = {
+        .boot = cursor->boot,
+        .uptime = cursor->uptime,
+        .time = 0 != cursor->clock ? cursor->clock + cursor->uptime : 0,
+    };
+    fromColumns(cursor->values, &record.data);
+    record.data.timestamp = cursor->uptime * 1000;
+
+    query->stopped = !query->callback(&record, query->ctx);
+    return !query->stopped;
+}
+
+static bool readHeader(const HistoryTier * tier, uint32_t sector, uint32_t * sequence)
+{
+    uint32_t header[2];
+    if (ESP_OK != esp_partition_read(partition, sectorAddress(tier, sector), header, HISTORY_HEADER_SIZE) ||
+        HISTORY_MAGIC != header[0]) {
+        return false;
+    }
+    *sequence = header[1];
+    return true;
+}
+
+// Decodes the first pages of a sector, stops where the writer erased it meanwhile
+static void readSector(const HistoryTier * tier, uint32_t sector, uint32_t sequence, uint32_t pages, HistoryCursor * cursor, HistoryQuery * query)
+{
+    uint8_t page[HISTORY_PAGE_SIZE];
+
+    for (uint32_t i = 0; i < pages && !query->stopped; i++) {
+        uint32_t current;
+        if (ESP_OK != esp_partition_read(partition, sectorAddress(tier, sector) + i * HISTORY_PAGE_SIZE, page, HISTORY_PAGE_SIZE) ||
+            !readHeader(tier, sector, &current) || current != sequence) {
+            return;
+        }
+        decodePage(page, 0 == i ? HISTORY_HEADER_SIZE : 0, HISTORY_PAGE_SIZE, cursor, emitRecord, query);
+    }
+}
+
+esp_err_t readStatisticHistory(uint8_t tier, uint32_t boot, uint32_t from, uint32_t to,
+                               StatisticsHistoryCallback callback, void * ctx)
+{
+    if (HISTORY_TIERS <= tier || NULL == callback) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (NULL == historyQueue) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    HistoryQuery query = { .boot = boot, .from = from, .to = to, .callback = callback, .ctx = ctx };
+
+    // The head as it is now, records the writer appends meanwhile may show up as well
+    HistoryTier * config = &tiers[tier];
+
+    pthread_mutex_lock(&historyLock);
+
+    uint32_t head = config->sector;
+    uint32_t headSequence = config->sequence;
+    uint32_t headOffset = config->offset;
+
+    pthread_mutex_unlock(&historyLock);
+
+    // Oldest sector first
+    for (uint32_t i = 1; i <= config->sectorCount && !query.stopped; i++) {
+        uint32_t sector = (head + i) % config->sectorCount;
+        HistoryCursor cursor = {};
+
+        if (sector == head) {
+            if (0 != headSequence) {
+                readSector(config, sector, headSequence, (headOffset + HISTORY_PAGE_SIZE - 1) / HISTORY_PAGE_SIZE, &cursor, &query);
+            }
+            continue;
+        }
+
+        uint32_t sequence;
+        if (readHeader(config, sector, &sequence) && sequence < headSequence && headSequence - sequence < config->sectorCount) {
+            readSector(config, sector, sequence, HISTORY_PAGES, &cursor, &query);
+        }
+    }
+
+    return ESP_OK;
+}
+
+uint32_t getStatisticHistoryBoot(void)
+{
+    return boot;
+}
+
+void addStatisticHistory(const struct StatisticsData * data)
+{
+    if (NULL == historyQueue || NULL == data) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    HistorySample sample = {
+        .uptime = esp_timer_get_time() / 1000000,
+        .time = now > HISTORY_CLOCK_VALID ? now : 0,
+        .data = *data,
+    };
+
+    // A full queue means the flash is busy, the sample is dropped rather than waited for
+    xQueueSend(historyQueue, &sample, 0);
+}
+
+static bool findBoot(const struct StatisticsHistoryRecord * record, void * ctx)
+{
+    uint32_t * lastBoot = ctx;
+    if (record->boot > *lastBoot) {
+        *lastBoot = record->boot;
+    }
+    return true;
+}
+
+// Picks up every tier where it ended before the restart
+static void initTier(HistoryTier * tier, uint32_t firstSector, uint32_t sectorCount)
+{
+    *tier = (HistoryTier) {
+        .firstSector = firstSector,
+        .sectorCount = sectorCount,
+        .sector = sectorCount - 1,
+        .offset = HISTORY_SECTOR_SIZE,
+    };
+
+    for (uint32_t sector = 0; sector < sectorCount; sector++) {
+        uint32_t sequence;
+        if (readHeader(tier, sector, &sequence) && sequence > tier->sequence) {
+            tier->sector = sector;
+            tier->sequence = sequence;
+        }
+    }
+    if (0 == tier->sequence) {
+        // Empty, the first record starts sector 0
+        return;
+    }
+
+    // Writing goes on right after the last record. A record cut off by a reset leaves
+    // bytes that aren't erased behind the last whole one, its page is given up then.
+    uint32_t lastBoot = 0;
+    HistoryQuery query = { .to = UINT32_MAX, .callback = findBoot, .ctx = &lastBoot };
+    HistoryCursor cursor = {};
+    uint8_t page[HISTORY_PAGE_SIZE];
+
+    tier->offset = HISTORY_HEADER_SIZE;
+    for (uint32_t i = 0; i < HISTORY_PAGES; i++) {
+        size_t start = 0 == i ? HISTORY_HEADER_SIZE : 0;
+        if (ESP_OK != esp_partition_read(partition, sectorAddress(tier, tier->sector) + i * HISTORY_PAGE_SIZE, page, HISTORY_PAGE_SIZE)) {
+            // Unknown how far the sector is written, the next record starts a new one
+            tier->offset = HISTORY_SECTOR_SIZE;
+            break;
+        }
+
+        size_t end = decodePage(page, start, HISTORY_PAGE_SIZE, &cursor, emitRecord, &query);
+        if (!isErased(page + end, HISTORY_PAGE_SIZE - end)) {
+            end = HISTORY_PAGE_SIZE;
+        }
+        if (end > start) {
+            tier->offset = i * HISTORY_PAGE_SIZE + end;
+        }
+    }
+
+    if (lastBoot >= boot) {
+        boot = lastBoot + 1;
+    }
+}
+
+// Writes the statistics samples to flash. Runs on its own so the statistics task,
+// which has its stack in PSRAM, never does flash operations, and a slow erase only
+// ever delays this task.
+void statistics_history_task(void * pvParameters)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, HISTORY_PARTITION_LABEL);
+    uint32_t sectorCount = NULL != partition ? partition->size / HISTORY_SECTOR_SIZE : 0;
+    if (sectorCount < 4) {
+        ESP_LOGW(TAG, "No statistics history partition, history is off");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    // Tier 1 takes 3/8, a week of minutes; tier 0 the rest, about a day of 5 s samples in 512 KB
+    uint32_t tier1Sectors = sectorCount * 3 / 8;
+    boot = 1;
+    initTier(&tiers[0], 0, sectorCount - tier1Sectors);
+    initTier(&tiers[1], sectorCount - tier1Sectors, tier1Sectors);
+
+    ESP_LOGI(TAG, "Boot %lu, %lu KB of history", (unsigned long) boot, (unsigned long) partition->size / 1024);
+
+    historyFlushed = xSemaphoreCreateBinary();
+    QueueHandle_t queue = xQueueCreate(HISTORY_QUEUE_DEPTH, sizeof(HistorySample));
+    if (NULL == historyFlushed || NULL == queue) {
+        ESP_LOGE(TAG, "Not enough memory for the statistics history queue!");
+        vTaskDelete(NULL);
+        return;
+    }
+    historyQueue = queue;
+    esp_register_shutdown_handler(flushStatisticHistory);
+
+    HistorySample sample;
+
+    while (1) {
+        if (pdTRUE != xQueueReceive(historyQueue, &sample, portMAX_DELAY)) {
+            continue;
+        }
+
+        if (sample.flush) {
+            // Everything queued before the marker is in flash
+            xSemaphoreGive(historyFlushed);
+            continue;
+        }
+
+        HistoryCursor record = {
+            .keyed = true,
+            .boot = boot,
+            .uptime = sample.uptime,
+            .clock = 0 != sample.time ? sample.time - sample.uptime : 0,
+        };
+        toColumns(&sample.data, record.values);
+
+        pthread_mutex_lock(&historyLock);
+
+        appendRecord(&tiers[0], &record);
+        addTier1Sample(&record);
+
+        pthread_mutex_unlock(&historyLock);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef STATISTICS_HISTORY_TASK_H_
+#define STATISTICS_HISTORY_TASK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "statistics_task.h"
+
+// Tier 0 keeps every statistics sample, tier 1 one-minute means of them
+#define HISTORY_TIERS 2
+
+typedef struct StatisticsHistoryRecord * StatisticsHistoryRecordPtr;
+
+struct StatisticsHistoryRecord
+{
+    uint32_t boot;      // counts up on every start
+    uint32_t uptime;    // seconds since that start
+    uint32_t time;      // unix seconds, 0 while the clock wasn't synced
+    struct StatisticsData data;
+};
+
+// Called for every record of a read, oldest first. Returning false stops the read.
+typedef bool (*StatisticsHistoryCallback)(const struct StatisticsHistoryRecord * record, void * ctx);
+
+// Hands a sample to the history task, never blocks
+void addStatisticHistory(const struct StatisticsData * data);
+
+// Records of one tier with boot (0 for every boot) and uptime within [from, to]
+esp_err_t readStatisticHistory(uint8_t tier, uint32_t boot, uint32_t from, uint32_t to,
+                               StatisticsHistoryCallback callback, void * ctx);
+
+uint32_t getStatisticHistoryBoot(void);
+
+void statistics_history_task(void * pvParameters);
+
+#endif // STATISTICS_HISTORY_TASK_H_
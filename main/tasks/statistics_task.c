@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include "esp_log.h"
 #include "esp_timer.h"
@@ -6,6 +8,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "statistics_task.h"
+#include "statistics_history_task.h"
 #include "global_state.h"
 #include "nvs_config.h"
 #include "power.h"
@@ -17,14 +20,54 @@
 
 static const char * TAG = "statistics_task";
 
+#define SNAPSHOT_RETRIES 8
+
+// Only the statistics task writes the buffer. Adding a sample is guarded by a
+// seqlock: the version is odd while a write is in progress, readers copy what
+// they need and retry if the version moved meanwhile, so they never hold up the
+// writer. The lock only guards allocating and freeing the buffer.
 static StatisticsDataPtr statisticsBuffer;
 static uint16_t statisticsDataStart;
 static uint16_t statisticsDataSize;
+static atomic_uint statisticsDataVersion;
 static pthread_mutex_t statisticsDataLock = PTHREAD_MUTEX_INITIALIZER;
 
-static const uint16_t maxDataCount = 720;
+static const uint16_t maxDataCount = STATISTICS_MAX_DATA_COUNT;
 static uint16_t statsFrequency;
 
+// Rolling windows, each a ring of buckets. Every sample goes into the newest bucket
+// of every window, the oldest one is dropped when a new one starts, so a window
+// covers its length to within one bucket at constant memory.
+typedef struct
+{
+    const char * name;
+    uint32_t bucketSeconds;
+    uint16_t bucketCount;
+} AggregateWindow;
+
+static const AggregateWindow aggregateWindows[] = {
+    { "1m",     5, 12 },
+    { "10m",   30, 20 },
+    { "1h",   300, 12 },
+    { "24h", 1800, 48 },
+};
+
+#define AGGREGATE_WINDOWS (sizeof(aggregateWindows) / sizeof(aggregateWindows[0]))
+
+typedef struct
+{
+    float hashrateSum;
+    uint16_t samples;
+    uint32_t errorCount;
+    uint32_t sharesAccepted;
+    uint32_t sharesRejected;
+} AggregateBucket;
+
+static AggregateBucket * aggregateBuckets[AGGREGATE_WINDOWS];
+static uint16_t aggregateHead[AGGREGATE_WINDOWS];
+static uint32_t aggregateSamples;
+static pthread_mutex_t aggregateLock = PTHREAD_MUTEX_INITIALIZER;
+
 void createStatisticsBuffer()
 {
     if (NULL == statisticsBuffer) {
@@ -60,54 +103,176 @@ void removeStatisticsBuffer()
 
 bool addStatisticData(StatisticsDataPtr data)
 {
-    bool result = false;
-
     if (NULL == data) {
-        return result;
+        return false;
     }
 
     createStatisticsBuffer();
 
-    pthread_mutex_lock(&statisticsDataLock);
+    // Only this task frees the buffer, it can't go away in between
+    if (NULL == statisticsBuffer) {
+        return false;
+    }
 
-    if (NULL != statisticsBuffer) {
-        statisticsDataSize++;
+    unsigned int version = atomic_load_explicit(&statisticsDataVersion, memory_order_relaxed);
+    atomic_store_explicit(&statisticsDataVersion, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    uint16_t start = statisticsDataStart;
+    uint16_t size = statisticsDataSize + 1;
+
+    if (maxDataCount < size) {
+        size = maxDataCount;
+        start = (start + 1) % maxDataCount;
+    }
+
+    statisticsBuffer[(start + size - 1) % maxDataCount] = *data;
+    statisticsDataStart = start;
+    statisticsDataSize = size;
+
+    atomic_store_explicit(&statisticsDataVersion, version + 2, memory_order_release);
 
-        if (maxDataCount < statisticsDataSize) {
-            statisticsDataSize = maxDataCount;
-            statisticsDataStart++;
-            statisticsDataStart = statisticsDataStart % maxDataCount;
+    return true;
+}
+
+// Copies the newest count entries, or fewer if there aren't as many. Called with
+// statisticsDataLock held, returns false if a write got in the way.
+static bool copyStatisticData(StatisticsDataPtr dataOut, uint16_t count, uint16_t * copied)
+{
+    unsigned int version = atomic_load_explicit(&statisticsDataVersion, memory_order_acquire);
+    if (version & 1) {
+        return false;
+    }
+
+    uint16_t size = statisticsDataSize;
+    uint16_t start = statisticsDataStart;
+    if (count > size) {
+        count = size;
+    }
+
+    // At most two pieces, up to the end of the ring and from its beginning
+    uint16_t first = (start + size - count) % maxDataCount;
+    uint16_t tail = count < maxDataCount - first ? count : maxDataCount - first;
+    memcpy(dataOut, &statisticsBuffer[first], tail * sizeof(struct StatisticsData));
+    memcpy(dataOut + tail, statisticsBuffer, (count - tail) * sizeof(struct StatisticsData));
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&statisticsDataVersion, memory_order_relaxed) != version) {
+        return false;
+    }
+
+    *copied = count;
+    return true;
+}
+
+bool getStatisticDataSnapshot(StatisticsDataPtr dataOut, uint16_t maxCount, uint16_t * countOut)
+{
+    if ((NULL == dataOut) || (NULL == countOut)) {
+        return false;
+    }
+
+    for (int retry = 0; retry < SNAPSHOT_RETRIES; retry++) {
+        pthread_mutex_lock(&statisticsDataLock);
+        *countOut = 0;
+        bool consistent = (NULL == statisticsBuffer) || copyStatisticData(dataOut, maxCount, countOut);
+        pthread_mutex_unlock(&statisticsDataLock);
+
+        if (consistent) {
+            return true;
         }
 
-        const uint16_t last = (statisticsDataStart + statisticsDataSize - 1) % maxDataCount;
-        statisticsBuffer[last] = *data;
-        result = true;
+        // The writer may be on this core with a lower priority, let it finish
+        vTaskDelay(1);
     }
 
-    pthread_mutex_unlock(&statisticsDataLock);
+    ESP_LOGW(TAG, "No consistent statistics snapshot after %d tries", SNAPSHOT_RETRIES);
+    return false;
+}
 
-    return result;
+static void createAggregates()
+{
+    for (int window = 0; window < AGGREGATE_WINDOWS; window++) {
+        aggregateBuckets[window] = heap_caps_calloc(aggregateWindows[window].bucketCount, sizeof(AggregateBucket), MALLOC_CAP_SPIRAM);
+        if (NULL == aggregateBuckets[window]) {
+            ESP_LOGW(TAG, "Not enough memory for the %s statistics window!", aggregateWindows[window].name);
+        }
+    }
 }
 
-bool getStatisticData(uint16_t index, StatisticsDataPtr dataOut)
+static void addAggregateSample(float hashrate, uint32_t errorCount, uint32_t sharesAccepted, uint32_t sharesRejected)
 {
-    bool result = false;
+    pthread_mutex_lock(&aggregateLock);
+
+    for (int window = 0; window < AGGREGATE_WINDOWS; window++) {
+        const AggregateWindow * config = &aggregateWindows[window];
+        if (NULL == aggregateBuckets[window]) {
+            continue;
+        }
 
-    if ((NULL == statisticsBuffer) || (NULL == dataOut) || (maxDataCount <= index)) {
-        return result;
+        // Start the next bucket, dropping the oldest
+        if (0 != aggregateSamples && 0 == aggregateSamples % (config->bucketSeconds * 1000 / DEFAULT_POLL_RATE)) {
+            aggregateHead[window] = (aggregateHead[window] + 1) % config->bucketCount;
+            aggregateBuckets[window][aggregateHead[window]] = (AggregateBucket) {};
+        }
+
+        AggregateBucket * bucket = &aggregateBuckets[window][aggregateHead[window]];
+        bucket->hashrateSum += hashrate;
+        bucket->samples++;
+        bucket->errorCount += errorCount;
+        bucket->sharesAccepted += sharesAccepted;
+        bucket->sharesRejected += sharesRejected;
     }
+    aggregateSamples++;
 
-    pthread_mutex_lock(&statisticsDataLock);
+    pthread_mutex_unlock(&aggregateLock);
+}
 
-    if ((NULL != statisticsBuffer) && (index < statisticsDataSize)) {
-        index = (statisticsDataStart + index) % maxDataCount;
-        *dataOut = statisticsBuffer[index];
-        result = true;
+bool getStatisticAggregate(uint8_t index, StatisticsAggregatePtr dataOut)
+{
+    if ((AGGREGATE_WINDOWS <= index) || (NULL == dataOut) || (NULL == aggregateBuckets[index])) {
+        return false;
     }
 
-    pthread_mutex_unlock(&statisticsDataLock);
+    const AggregateWindow * config = &aggregateWindows[index];
+    float hashrateSum = 0;
+    uint32_t samples = 0;
+
+    *dataOut = (struct StatisticsAggregate) { .window = config->name };
+
+    pthread_mutex_lock(&aggregateLock);
+
+    for (int i = 0; i < config->bucketCount; i++) {
+        const AggregateBucket * bucket = &aggregateBuckets[index][i];
+        hashrateSum += bucket->hashrateSum;
+        samples += bucket->samples;
+        dataOut->errorCount += bucket->errorCount;
+        dataOut->sharesAccepted += bucket->sharesAccepted;
+        dataOut->sharesRejected += bucket->sharesRejected;
+    }
 
-    return result;
+    pthread_mutex_unlock(&aggregateLock);
+
+    dataOut->duration = samples * DEFAULT_POLL_RATE / 1000;
+    dataOut->hashrate = 0 != samples ? hashrateSum / samples : 0;
+
+    return true;
+}
+
+// Increase of a counter since the previous sample
+static uint32_t counterDelta(uint64_t value, uint64_t * previous)
+{
+    uint64_t delta = value - *previous;
+    *previous = value;
+    return delta;
+}
+
+// The error counters read 0 from when the measurements are cleared until the chips
+// answer again, and not all chips answer at once. Only a rise is counted.
+static uint32_t errorCountDelta(uint32_t value, uint32_t * previous)
+{
+    uint32_t delta = (0 != *previous && value >= *previous) ? value - *previous : 0;
+    *previous = value;
+    return delta;
 }
 
 void statistics_task(void * pvParameters)
@@ -120,38 +285,59 @@ void statistics_task(void * pvParameters)
     HashrateMonitorModule * hashrate_monitor = &GLOBAL_STATE->HASHRATE_MONITOR_MODULE;
     struct StatisticsData statsData = {};
 
+    createAggregates();
+    uint32_t lastErrorCount = hashrate_monitor->error_count;
+    uint64_t lastSharesAccepted = sys_module->shares_accepted;
+    uint64_t lastSharesRejected = sys_module->shares_rejected;
+
     TickType_t taskWakeTime = xTaskGetTickCount();
 
     while (1) {
+        addAggregateSample(sys_module->current_hashrate,
+                           errorCountDelta(hashrate_monitor->error_count, &lastErrorCount),
+                           counterDelta(sys_module->shares_accepted, &lastSharesAccepted),
+                           counterDelta(sys_module->shares_rejected, &lastSharesRejected));
+
         const int32_t currentTime = esp_timer_get_time() / 1000;
         statsFrequency = nvs_config_get_u16(NVS_CONFIG_STATISTICS_FREQUENCY) * 1000;
+        const bool history = nvs_config_get_bool(NVS_CONFIG_STATISTICS_HISTORY);
 
-        if (0 != statsFrequency) {
-            const int32_t waitingTime = statsData.timestamp + statsFrequency - (DEFAULT_POLL_RATE / 2);
-
-            if (currentTime > waitingTime) {
-                int8_t wifiRSSI = -90;
-                get_wifi_current_rssi(&wifiRSSI);
-
-                statsData.timestamp = currentTime;
-                statsData.hashrate = sys_module->current_hashrate;
-                statsData.errorCount = hashrate_monitor->error_count;
-                statsData.chipTemperature = power_management->chip_temp_avg;
-                statsData.vrTemperature = power_management->vr_temp;
-                statsData.power = power_management->power;
-                statsData.voltage = power_management->voltage;
-                statsData.current = Power_get_current(GLOBAL_STATE);
-                statsData.coreVoltageActual = VCORE_get_voltage_mv(GLOBAL_STATE);
-                statsData.fanSpeed = power_management->fan_perc;
-                statsData.fanRPM = power_management->fan_rpm;
-                statsData.fan2RPM = power_management->fan2_rpm;
-                statsData.wifiRSSI = wifiRSSI;
-                statsData.freeHeap = esp_get_free_heap_size();
+        // The flash history takes every sample, the buffer only what the frequency setting asks for
+        const int32_t waitingTime = statsData.timestamp + statsFrequency - (DEFAULT_POLL_RATE / 2);
+        const bool dataDue = 0 != statsFrequency && currentTime > waitingTime;
 
+        if (0 == statsFrequency) {
+            removeStatisticsBuffer();
+        }
+
+        // The samples take I2C reads, nobody asking for one means none are done
+        if (history || dataDue) {
+            struct StatisticsData sample = {};
+            int8_t wifiRSSI = -90;
+            get_wifi_current_rssi(&wifiRSSI);
+
+            sample.timestamp = currentTime;
+            sample.hashrate = sys_module->current_hashrate;
+            sample.errorCount = hashrate_monitor->error_count;
+            sample.chipTemperature = power_management->chip_temp_avg;
+            sample.vrTemperature = power_management->vr_temp;
+            sample.power = power_management->power;
+            sample.voltage = power_management->voltage;
+            sample.current = Power_get_current(GLOBAL_STATE);
+            sample.coreVoltageActual = VCORE_get_voltage_mv(GLOBAL_STATE);
+            sample.fanSpeed = power_management->fan_perc;
+            sample.fanRPM = power_management->fan_rpm;
+            sample.fan2RPM = power_management->fan2_rpm;
+            sample.wifiRSSI = wifiRSSI;
+            sample.freeHeap = esp_get_free_heap_size();
+
+            if (history) {
+                addStatisticHistory(&sample);
+            }
+            if (dataDue) {
+                statsData = sample;
                 addStatisticData(&statsData);
             }
-        } else {
-            removeStatisticsBuffer();
         }
 
         vTaskDelayUntil(&taskWakeTime, DEFAULT_POLL_RATE / portTICK_PERIOD_MS); // taskWakeTime is automatically updated
@@ -1,6 +1,8 @@
 #ifndef STATISTICS_TASK_H_
 #define STATISTICS_TASK_H_
 
+#define STATISTICS_MAX_DATA_COUNT 720
+
 typedef struct StatisticsData * StatisticsDataPtr;
 
 struct StatisticsData
@@ -21,7 +23,23 @@ struct StatisticsData
     uint32_t freeHeap;
 };
 
-bool getStatisticData(uint16_t index, StatisticsDataPtr dataOut);
+typedef struct StatisticsAggregate * StatisticsAggregatePtr;
+
+// Averages and totals over one rolling window
+struct StatisticsAggregate
+{
+    const char * window;
+    uint32_t duration;      // seconds the window covers so far
+    float hashrate;
+    uint32_t errorCount;    // error counter increments
+    uint32_t sharesAccepted;
+    uint32_t sharesRejected;
+};
+
+// Copies the newest maxCount entries as of one moment, oldest first, and sets countOut to how many.
+// False if the statistics task kept writing through every attempt.
+bool getStatisticDataSnapshot(StatisticsDataPtr dataOut, uint16_t maxCount, uint16_t * countOut);
+bool getStatisticAggregate(uint8_t index, StatisticsAggregatePtr dataOut);
 
 void statistics_task(void * pvParameters);
 
@@ -14,6 +14,7 @@
 #include <sys/time.h>
 #include "esp_timer.h"
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "utils.h"
 
 #define MAX_RETRY_ATTEMPTS 3
@@ -22,6 +23,9 @@
 
 #define BUFFER_SIZE 1024
 
+// Queued jobs are only worth keeping across a reconnect for a short while
+#define SESSION_RESUME_TIMEOUT_MS 60000
+
 static const char * TAG = "stratum_task";
 
 static StratumApiV1Message stratum_api_v1_message = {};
@@ -29,6 +33,18 @@ static StratumApiV1Message stratum_api_v1_message = {};
 static const char * primary_stratum_url;
 static uint16_t primary_stratum_port;
 
+typedef struct {
+    char * session_id;          // subscription id returned by mining.subscribe
+    const char * pool_url;
+    uint16_t pool_port;
+    int64_t disconnected_us;
+    bool resume_pending;        // waiting for the pool to confirm the extranonce
+} stratum_session_t;
+
+// Only stratum_task touches the session, other tasks ask for a reset through the flag
+static stratum_session_t stratum_session = {};
+static atomic_bool session_reset_requested = false;
+
 struct timeval tcp_snd_timeout = {
     .tv_sec = 5,
     .tv_usec = 0
@@ -154,13 +170,33 @@ void cleanQueue(GlobalState * GLOBAL_STATE) {
     ESP_LOGI(TAG, "Clean Jobs: clearing queue");
     GLOBAL_STATE->abandon_work = 1;
     queue_clear(&GLOBAL_STATE->stratum_queue);
+    queue_wake_consumer(&GLOBAL_STATE->stratum_queue);
 
-    pthread_mutex_lock(&GLOBAL_STATE->valid_jobs_lock);
+    pthread_mutex_lock(&GLOBAL_STATE->jobs_lock);
     ASIC_jobs_queue_clear(&GLOBAL_STATE->ASIC_jobs_queue);
-    for (int i = 0; i < 128; i = i + 4) {
-        GLOBAL_STATE->valid_jobs[i] = 0;
+    asic_job_invalidate_all(&GLOBAL_STATE->ASIC_TASK_MODULE);
+    pthread_mutex_unlock(&GLOBAL_STATE->jobs_lock);
+}
+
+static void stratum_session_reset()
+{
+    free(stratum_session.session_id);
+    stratum_session.session_id = NULL;
+    stratum_session.pool_url = NULL;
+    stratum_session.pool_port = 0;
+    stratum_session.disconnected_us = 0;
+    stratum_session.resume_pending = false;
+}
+
+static bool stratum_session_can_resume(GlobalState * GLOBAL_STATE, const char * url, uint16_t port)
+{
+    if (stratum_session.session_id == NULL || stratum_session.pool_url == NULL || GLOBAL_STATE->extranonce_str == NULL) {
+        return false;
     }
-    pthread_mutex_unlock(&GLOBAL_STATE->valid_jobs_lock);
+    if (stratum_session.pool_port != port || strcmp(stratum_session.pool_url, url) != 0) {
+        return false;
+    }
+    return (esp_timer_get_time() - stratum_session.disconnected_us) / 1000 < SESSION_RESUME_TIMEOUT_MS;
 }
 
 void stratum_reset_uid(GlobalState * GLOBAL_STATE)
@@ -170,6 +206,8 @@ void stratum_reset_uid(GlobalState * GLOBAL_STATE)
 }
 
 
+// Any task may call this, it only shuts the socket down. The receive in
+// stratum_task then fails and stratum_disconnect does the rest.
 void stratum_close_connection(GlobalState * GLOBAL_STATE)
 {
     if (GLOBAL_STATE->sock < 0) {
@@ -179,8 +217,24 @@ void stratum_close_connection(GlobalState * GLOBAL_STATE)
 
     ESP_LOGE(TAG, "Shutting down socket and restarting...");
     shutdown(GLOBAL_STATE->sock, SHUT_RDWR);
-    close(GLOBAL_STATE->sock);
-    cleanQueue(GLOBAL_STATE);
+}
+
+static void stratum_disconnect(GlobalState * GLOBAL_STATE)
+{
+    if (GLOBAL_STATE->sock >= 0) {
+        shutdown(GLOBAL_STATE->sock, SHUT_RDWR);
+        close(GLOBAL_STATE->sock);
+        GLOBAL_STATE->sock = -1;
+    }
+    if (atomic_exchange(&session_reset_requested, false) ||
+        stratum_session.session_id == NULL || stratum_session.resume_pending) {
+        // Nothing to resume, don't keep hashing stale work
+        stratum_session_reset();
+        cleanQueue(GLOBAL_STATE);
+    } else {
+        // Keep the queued jobs, they stay valid if the pool resumes the session
+        stratum_session.disconnected_us = esp_timer_get_time();
+    }
     vTaskDelay(1000 / portTICK_PERIOD_MS);
 }
 
@@ -240,7 +294,7 @@ void stratum_primary_heartbeat(void * pvParameters)
         }
 
         int send_uid = 1;
-        STRATUM_V1_subscribe(sock, send_uid++, GLOBAL_STATE->DEVICE_CONFIG.family.asic.name);
+        STRATUM_V1_subscribe(sock, send_uid++, GLOBAL_STATE->DEVICE_CONFIG.family.asic.name, NULL);
         STRATUM_V1_authorize(sock, send_uid++, GLOBAL_STATE->SYSTEM_MODULE.pool_user, GLOBAL_STATE->SYSTEM_MODULE.pool_pass);
 
         char recv_buffer[BUFFER_SIZE];
@@ -258,6 +312,7 @@ void stratum_primary_heartbeat(void * pvParameters)
         if (strstr(recv_buffer, "mining.notify") != NULL && !GLOBAL_STATE->SYSTEM_MODULE.use_fallback_stratum) {
             ESP_LOGI(TAG, "Heartbeat successful and in fallback mode. Switching back to primary.");
             GLOBAL_STATE->SYSTEM_MODULE.is_using_fallback = false;
+            atomic_store(&session_reset_requested, true);
             stratum_close_connection(GLOBAL_STATE);
             continue;
         }
@@ -446,14 +501,25 @@ void stratum_task(void * pvParameters)
         GLOBAL_STATE->SYSTEM_MODULE.pool_addr_family = conn_info.addr_family;
 
         stratum_reset_uid(GLOBAL_STATE);
-        cleanQueue(GLOBAL_STATE);
+
+        stratum_session.resume_pending = !atomic_exchange(&session_reset_requested, false) &&
+                                         stratum_session_can_resume(GLOBAL_STATE, stratum_url, port);
+        if (stratum_session.resume_pending) {
+            ESP_LOGI(TAG, "Resuming session %s, keeping %d queued jobs", stratum_session.session_id, queue_count(&GLOBAL_STATE->ASIC_jobs_queue));
+        } else {
+            stratum_session_reset();
+            cleanQueue(GLOBAL_STATE);
+        }
+        stratum_session.pool_url = stratum_url;
+        stratum_session.pool_port = port;
 
         ///// Start Stratum Action
         // mining.configure - ID: 1
         STRATUM_V1_configure_version_rolling(GLOBAL_STATE->sock, GLOBAL_STATE->send_uid++, &GLOBAL_STATE->version_mask);
 
         // mining.subscribe - ID: 2
-        STRATUM_V1_subscribe(GLOBAL_STATE->sock, GLOBAL_STATE->send_uid++, GLOBAL_STATE->DEVICE_CONFIG.family.asic.name);
+        STRATUM_V1_subscribe(GLOBAL_STATE->sock, GLOBAL_STATE->send_uid++, GLOBAL_STATE->DEVICE_CONFIG.family.asic.name,
+                             stratum_session.resume_pending ? stratum_session.session_id : NULL);
 
         char * username = GLOBAL_STATE->SYSTEM_MODULE.is_using_fallback ? GLOBAL_STATE->SYSTEM_MODULE.fallback_pool_user : GLOBAL_STATE->SYSTEM_MODULE.pool_user;
         char * password = GLOBAL_STATE->SYSTEM_MODULE.is_using_fallback ? GLOBAL_STATE->SYSTEM_MODULE.fallback_pool_pass : GLOBAL_STATE->SYSTEM_MODULE.pool_pass;
@@ -471,7 +537,7 @@ void stratum_task(void * pvParameters)
             if (!line) {
                 ESP_LOGE(TAG, "Failed to receive JSON-RPC line, reconnecting...");
                 retry_attempts++;
-                stratum_close_connection(GLOBAL_STATE);
+                stratum_disconnect(GLOBAL_STATE);
                 break;
             }
 
@@ -488,12 +554,14 @@ void stratum_task(void * pvParameters)
                 GLOBAL_STATE->SYSTEM_MODULE.work_received++;
                 SYSTEM_notify_new_ntime(GLOBAL_STATE, stratum_api_v1_message.mining_notification->ntime);
                 if (stratum_api_v1_message.should_abandon_work &&
-                    (GLOBAL_STATE->stratum_queue.count > 0 || GLOBAL_STATE->ASIC_jobs_queue.count > 0)) {
+                    (queue_count(&GLOBAL_STATE->stratum_queue) > 0 || queue_count(&GLOBAL_STATE->ASIC_jobs_queue) > 0)) {
                     cleanQueue(GLOBAL_STATE);
                 }
-                if (GLOBAL_STATE->stratum_queue.count == QUEUE_SIZE) {
-                    mining_notify * next_notify_json_str = (mining_notify *) queue_dequeue(&GLOBAL_STATE->stratum_queue);
-                    STRATUM_V1_free_mining_notify(next_notify_json_str);
+                if (queue_is_full(&GLOBAL_STATE->stratum_queue)) {
+                    mining_notify * next_notify_json_str = (mining_notify *) queue_try_dequeue(&GLOBAL_STATE->stratum_queue);
+                    if (next_notify_json_str != NULL) {
+                        STRATUM_V1_free_mining_notify(next_notify_json_str);
+                    }
                 }
                 queue_enqueue(&GLOBAL_STATE->stratum_queue, stratum_api_v1_message.mining_notification);
                 decode_mining_notification(GLOBAL_STATE, stratum_api_v1_message.mining_notification);
@@ -514,6 +582,22 @@ void stratum_task(void * pvParameters)
                              stratum_api_v1_message.extranonce_2_len, MAX_EXTRANONCE_2_LEN);
                     stratum_api_v1_message.extranonce_2_len = MAX_EXTRANONCE_2_LEN;
                 }
+                if (stratum_api_v1_message.method == STRATUM_RESULT_SUBSCRIBE) {
+                    if (stratum_session.resume_pending) {
+                        if (GLOBAL_STATE->extranonce_str != NULL &&
+                            strcmp(GLOBAL_STATE->extranonce_str, stratum_api_v1_message.extranonce_str) == 0 &&
+                            GLOBAL_STATE->extranonce_2_len == stratum_api_v1_message.extranonce_2_len) {
+                            ESP_LOGI(TAG, "Session resumed, keeping queued jobs");
+                        } else {
+                            ESP_LOGI(TAG, "Session not resumed, new extranonce assigned");
+                            cleanQueue(GLOBAL_STATE);
+                        }
+                        stratum_session.resume_pending = false;
+                    }
+                    free(stratum_session.session_id);
+                    stratum_session.session_id = stratum_api_v1_message.session_id;
+                    stratum_api_v1_message.session_id = NULL;
+                }
                 ESP_LOGI(TAG, "Set extranonce: %s, extranonce_2_len: %d", stratum_api_v1_message.extranonce_str, stratum_api_v1_message.extranonce_2_len);
                 char * old_extranonce_str = GLOBAL_STATE->extranonce_str;
                 GLOBAL_STATE->extranonce_str = stratum_api_v1_message.extranonce_str;
@@ -521,7 +605,7 @@ void stratum_task(void * pvParameters)
                 free(old_extranonce_str);
             } else if (stratum_api_v1_message.method == CLIENT_RECONNECT) {
                 ESP_LOGE(TAG, "Pool requested client reconnect...");
-                stratum_close_connection(GLOBAL_STATE);
+                stratum_disconnect(GLOBAL_STATE);
                 break;
             } else if (stratum_api_v1_message.method == STRATUM_RESULT) {
                 if (stratum_api_v1_message.response_success) {
@@ -544,6 +628,12 @@ void stratum_task(void * pvParameters)
                     }
                 } else {
                     ESP_LOGE(TAG, "setup message rejected: %s", stratum_api_v1_message.error_str);
+                    if (stratum_api_v1_message.message_id == STRATUM_ID_SUBSCRIBE && stratum_session.resume_pending) {
+                        // Pool refused the resume, reconnect with a fresh subscription
+                        ESP_LOGW(TAG, "Session resume rejected, reconnecting...");
+                        stratum_disconnect(GLOBAL_STATE);
+                        break;
+                    }
                 }
             }
         }
@@ -1,82 +1,130 @@
 #include "work_queue.h"
+#include <assert.h>
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 
-void queue_init(work_queue *queue)
+static const char *TAG = "work_queue";
+
+void queue_init(work_queue *queue, uint32_t depth)
+{
+    assert(depth > 0 && (depth & (depth - 1)) == 0);
+
+    queue->buffer = heap_caps_calloc(depth, sizeof(void *), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (queue->buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate queue of depth %lu", depth);
+        abort();
+    }
+    queue->depth = depth;
+    queue->mask = depth - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->waiting_consumer, NULL);
+    atomic_init(&queue->waiting_producer, NULL);
+    atomic_init(&queue->high_water, 0);
+    atomic_init(&queue->full_stalls, 0);
+    atomic_init(&queue->enqueued, 0);
+}
+
+static void wake(_Atomic(TaskHandle_t) *waiting)
 {
-    queue->head = 0;
-    queue->tail = 0;
-    queue->count = 0;
-    pthread_mutex_init(&queue->lock, NULL);
-    pthread_cond_init(&queue->not_empty, NULL);
-    pthread_cond_init(&queue->not_full, NULL);
+    TaskHandle_t task = atomic_exchange(waiting, NULL);
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
 }
 
 void queue_enqueue(work_queue *queue, void *new_work)
 {
-    pthread_mutex_lock(&queue->lock);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail - atomic_load(&queue->head) >= queue->depth) {
+        atomic_fetch_add(&queue->full_stalls, 1);
+        while (tail - atomic_load(&queue->head) >= queue->depth) {
+            atomic_store(&queue->waiting_producer, xTaskGetCurrentTaskHandle());
+            // Recheck after registering so a dequeue in between is not missed
+            if (tail - atomic_load(&queue->head) < queue->depth) {
+                atomic_store(&queue->waiting_producer, NULL);
+                break;
+            }
+            ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS);
+        }
+    }
+
+    queue->buffer[tail & queue->mask] = new_work;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    atomic_fetch_add(&queue->enqueued, 1);
 
-    while (queue->count == QUEUE_SIZE)
-    {
-        pthread_cond_wait(&queue->not_full, &queue->lock);
+    uint32_t count = tail + 1 - atomic_load(&queue->head);
+    if (count > atomic_load(&queue->high_water)) {
+        atomic_store(&queue->high_water, count);
     }
 
-    queue->buffer[queue->tail] = new_work;
-    queue->tail = (queue->tail + 1) % QUEUE_SIZE;
-    queue->count++;
+    wake(&queue->waiting_consumer);
+}
 
-    pthread_cond_signal(&queue->not_empty);
-    pthread_mutex_unlock(&queue->lock);
+void *queue_try_dequeue(work_queue *queue)
+{
+    uint32_t head = atomic_load(&queue->head);
+    while (head != atomic_load_explicit(&queue->tail, memory_order_acquire)) {
+        void *next_work = queue->buffer[head & queue->mask];
+        // Only the winner of the CAS owns the entry, a loser rereads head and retries
+        if (atomic_compare_exchange_weak(&queue->head, &head, head + 1)) {
+            wake(&queue->waiting_producer);
+            return next_work;
+        }
+    }
+    return NULL;
 }
 
 void *queue_dequeue(work_queue *queue)
 {
-    pthread_mutex_lock(&queue->lock);
-
-    while (queue->count == 0)
-    {
-        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    while (1) {
+        void *next_work = queue_try_dequeue(queue);
+        if (next_work != NULL) {
+            return next_work;
+        }
+
+        atomic_store(&queue->waiting_consumer, xTaskGetCurrentTaskHandle());
+        // Recheck after registering so an enqueue in between is not missed
+        if (queue_count(queue) > 0) {
+            atomic_store(&queue->waiting_consumer, NULL);
+            continue;
+        }
+        ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS);
     }
+}
 
-    void *next_work = queue->buffer[queue->head];
-    queue->head = (queue->head + 1) % QUEUE_SIZE;
-    queue->count--;
-
-    pthread_cond_signal(&queue->not_full);
-    pthread_mutex_unlock(&queue->lock);
+// Blocks until the ring has an entry or queue_wake_consumer is called, the
+// timeout covers a wake that came just before the caller registered
+void queue_wait(work_queue *queue)
+{
+    atomic_store(&queue->waiting_consumer, xTaskGetCurrentTaskHandle());
+    if (queue_count(queue) > 0) {
+        atomic_store(&queue->waiting_consumer, NULL);
+        return;
+    }
+    ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS);
+}
 
-    return next_work;
+void queue_wake_consumer(work_queue *queue)
+{
+    wake(&queue->waiting_consumer);
 }
 
 void queue_clear(work_queue *queue)
 {
-    pthread_mutex_lock(&queue->lock);
-
-    while (queue->count > 0)
-    {
-        mining_notify *next_work = queue->buffer[queue->head];
+    mining_notify *next_work;
+    while ((next_work = queue_try_dequeue(queue)) != NULL) {
         STRATUM_V1_free_mining_notify(next_work);
-        queue->head = (queue->head + 1) % QUEUE_SIZE;
-        queue->count--;
     }
-
-    pthread_cond_signal(&queue->not_full);
-    pthread_mutex_unlock(&queue->lock);
 }
 
 void ASIC_jobs_queue_clear(work_queue *queue)
 {
-    pthread_mutex_lock(&queue->lock);
-
-    while (queue->count > 0)
-    {
-        bm_job *next_work = queue->buffer[queue->head];
+    bm_job *next_work;
+    while ((next_work = queue_try_dequeue(queue)) != NULL) {
         free(next_work->jobid);
         free(next_work->extranonce2);
         free(next_work);
-        queue->head = (queue->head + 1) % QUEUE_SIZE;
-        queue->count--;
     }
-
-    pthread_cond_signal(&queue->not_full);
-    pthread_mutex_unlock(&queue->lock);
 }
@@ -1,26 +1,59 @@
 #ifndef WORK_QUEUE_H
 #define WORK_QUEUE_H
 
-#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "mining.h"
 
-#define QUEUE_SIZE 12
+// Ring depths, must be a power of two
+#define STRATUM_QUEUE_DEPTH 16
+#define ASIC_JOBS_QUEUE_DEPTH 16
 
+// Single producer / single consumer ring buffer. head and tail are free running
+// counters, the slot is selected with (index & mask). Clearing and dropping the
+// oldest entry from the producer side claim slots with a CAS on head, so those
+// stay safe against the consumer without a lock. Multiple producers must
+// serialize their enqueues themselves (see the job builders).
 typedef struct
 {
-    void *buffer[QUEUE_SIZE];
-    int head;
-    int tail;
-    int count;
-    pthread_mutex_t lock;
-    pthread_cond_t not_empty;
-    pthread_cond_t not_full;
+    void **buffer;
+    uint32_t depth;
+    uint32_t mask;
+    atomic_uint_fast32_t head;
+    atomic_uint_fast32_t tail;
+
+    // Tasks blocked on an empty or full ring, woken with a task notification
+    _Atomic(TaskHandle_t) waiting_consumer;
+    _Atomic(TaskHandle_t) waiting_producer;
+
+    // Metrics
+    atomic_uint_fast32_t high_water;
+    atomic_uint_fast32_t full_stalls;
+    atomic_uint_fast32_t enqueued;
 } work_queue;
 
-void queue_init(work_queue *queue);
+void queue_init(work_queue *queue, uint32_t depth);
 void queue_enqueue(work_queue *queue, void *new_work);
 void ASIC_jobs_queue_clear(work_queue *queue);
 void *queue_dequeue(work_queue *queue);
+void *queue_try_dequeue(work_queue *queue);
+void queue_wait(work_queue *queue);
+void queue_wake_consumer(work_queue *queue);
 void queue_clear(work_queue *queue);
 
-#endif // WORK_QUEUE_H
\ No newline at end of file
+static inline uint32_t queue_count(work_queue *queue)
+{
+    // Load head first, tail can only move further ahead of it
+    uint32_t head = atomic_load(&queue->head);
+    return atomic_load(&queue->tail) - head;
+}
+
+static inline bool queue_is_full(work_queue *queue)
+{
+    return queue_count(queue) >= queue->depth;
+}
+
+#endif // WORK_QUEUE_H